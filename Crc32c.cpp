@@ -0,0 +1,162 @@
+/**********************************************************
+ * File: Crc32c.cpp
+ *
+ * Implementation of CRC-32C.
+ *
+ * As with the AVX2 kernel in HuffmanSimd.cpp, the SSE4.2
+ * version is compiled for SSE4.2 by a target attribute and
+ * only called once the processor has been seen to support
+ * it.  The ARM version needs the CRC extension at compile
+ * time, which ARMv8.1 and later always have.
+ */
+
+#include <cstring>
+#include "Crc32c.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HUFFMAN_HAVE_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#define HUFFMAN_HAVE_ARM_CRC 1
+#include <arm_acle.h>
+#endif
+
+/* Constant: CRC32C_POLYNOMIAL
+ * The Castagnoli polynomial, bit-reversed.
+ */
+static const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78u;
+
+/* Type: CrcTables
+ * --------------------------------------------------------
+ * lookup[0] is the usual byte-at-a-time table; lookup[k]
+ * gives the effect of a byte followed by k zero bytes, so
+ * eight bytes can be folded in with eight independent
+ * lookups.
+ */
+struct CrcTables {
+	uint32_t lookup[8][256];
+
+	CrcTables() {
+		for (int byte = 0; byte < 256; byte++) {
+			uint32_t crc = uint32_t(byte);
+			for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ ((crc & 1)? CRC32C_POLYNOMIAL : 0);
+			lookup[0][byte] = crc;
+		}
+		for (int byte = 0; byte < 256; byte++) {
+			for (int k = 1; k < 8; k++) {
+				uint32_t previous = lookup[k - 1][byte];
+				lookup[k][byte] = (previous >> 8) ^ lookup[0][previous & 0xFF];
+			}
+		}
+	}
+};
+
+/* Function: crc32cPortable
+ * Usage: uint32_t crc = crc32cPortable(0, data, length);
+ * --------------------------------------------------------
+ * Slicing by eight.
+ */
+uint32_t crc32cPortable(uint32_t crc, const char* data, size_t length) {
+	static const CrcTables tables;
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint32_t state = ~crc;
+	for (; length >= 8; bytes += 8, length -= 8) {
+		uint32_t low = state ^ (uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 |
+		                        uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24);
+		state = tables.lookup[7][low & 0xFF] ^ tables.lookup[6][(low >> 8) & 0xFF] ^
+		        tables.lookup[5][(low >> 16) & 0xFF] ^ tables.lookup[4][low >> 24] ^
+		        tables.lookup[3][bytes[4]] ^ tables.lookup[2][bytes[5]] ^
+		        tables.lookup[1][bytes[6]] ^ tables.lookup[0][bytes[7]];
+	}
+	for (; length > 0; bytes++, length--) {
+		state = (state >> 8) ^ tables.lookup[0][(state ^ *bytes) & 0xFF];
+	}
+	return ~state;
+}
+
+#ifdef HUFFMAN_HAVE_SSE42
+
+/* Function: cpuHasSse42
+ * --------------------------------------------------------
+ * Asks the processor whether it has the SSE4.2 CRC32
+ * instruction.
+ */
+static bool cpuHasSse42() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2") != 0;
+}
+
+/* Function: crc32cSse42
+ * --------------------------------------------------------
+ * One crc32 instruction per eight bytes.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const char* data, size_t length) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t state = ~crc;
+	for (; length >= 8; bytes += 8, length -= 8) {
+		uint64_t word;
+		memcpy(&word, bytes, 8);
+		state = _mm_crc32_u64(state, word);
+	}
+	for (; length > 0; bytes++, length--) {
+		state = _mm_crc32_u8(uint32_t(state), *bytes);
+	}
+	return ~uint32_t(state);
+}
+
+#endif
+
+#ifdef HUFFMAN_HAVE_ARM_CRC
+
+/* Function: crc32cArm
+ * --------------------------------------------------------
+ * One crc32cx instruction per eight bytes.
+ */
+static uint32_t crc32cArm(uint32_t crc, const char* data, size_t length) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint32_t state = ~crc;
+	for (; length >= 8; bytes += 8, length -= 8) {
+		uint64_t word;
+		memcpy(&word, bytes, 8);
+		state = __crc32cd(state, word);
+	}
+	for (; length > 0; bytes++, length--) {
+		state = __crc32cb(state, *bytes);
+	}
+	return ~state;
+}
+
+#endif
+
+/* Function: isCrc32cAccelerated
+ * Usage: if (isCrc32cAccelerated()) { ... }
+ * --------------------------------------------------------
+ * The processor is asked once; the answer can't change.
+ */
+bool isCrc32cAccelerated() {
+#if defined(HUFFMAN_HAVE_SSE42)
+	static const bool supported = cpuHasSse42();
+	return supported;
+#elif defined(HUFFMAN_HAVE_ARM_CRC)
+	return true;
+#else
+	return false;
+#endif
+}
+
+/* Function: crc32c
+ * Usage: uint32_t crc = crc32c(0, data, length);
+ * --------------------------------------------------------
+ * Picks the fastest version this machine can run.
+ */
+uint32_t crc32c(uint32_t crc, const char* data, size_t length) {
+#if defined(HUFFMAN_HAVE_SSE42)
+	if (isCrc32cAccelerated()) return crc32cSse42(crc, data, length);
+#elif defined(HUFFMAN_HAVE_ARM_CRC)
+	return crc32cArm(crc, data, length);
+#endif
+	return crc32cPortable(crc, data, length);
+}
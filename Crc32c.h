@@ -0,0 +1,44 @@
+/**********************************************************
+ * File: Crc32c.h
+ *
+ * The CRC-32C (Castagnoli) checksum, which the block
+ * container stores for every frame.  x86 processors since
+ * SSE4.2 and ARMv8 processors with the CRC extension compute
+ * it in hardware, at several bytes a cycle, so checking a
+ * file costs little more than reading it.
+ */
+
+#ifndef Crc32c_Included
+#define Crc32c_Included
+
+#include <cstddef>
+#include <stdint.h>
+
+/* Function: crc32c
+ * Usage: uint32_t crc = crc32c(0, data, length);
+ *        crc = crc32c(crc, more, moreLength);
+ * --------------------------------------------------------
+ * Returns the CRC-32C of the given bytes, continuing from
+ * crc, the checksum of the bytes before them (0 for none).
+ * Uses the processor's CRC instructions when it has them.
+ */
+uint32_t crc32c(uint32_t crc, const char* data, size_t length);
+
+/* Function: crc32cPortable
+ * Usage: uint32_t crc = crc32cPortable(0, data, length);
+ * --------------------------------------------------------
+ * As crc32c, but always computed with tables, eight bytes a
+ * step.  crc32c falls back on this where there are no CRC
+ * instructions.
+ */
+uint32_t crc32cPortable(uint32_t crc, const char* data, size_t length);
+
+/* Function: isCrc32cAccelerated
+ * Usage: if (isCrc32cAccelerated()) { ... }
+ * --------------------------------------------------------
+ * Returns whether crc32c uses CRC instructions on this
+ * machine.
+ */
+bool isCrc32cAccelerated();
+
+#endif
@@ -0,0 +1,335 @@
+/**********************************************************
+ * File: HuffmanBenchmark.cpp
+ *
+ * A non-interactive benchmark for the Huffman encoder.  It
+ * times the separate stages (counting, tree building,
+ * encoding, decoding) and whole compress/decompress runs in
+ * each file format, over generated inputs of several kinds
+ * and sizes, and prints one CSV line per measurement so that
+ * runs can be compared by a script.
+ *
+ * This is a program of its own: build it from the other
+ * sources in place of HuffmanEncodingTest.cpp.  It takes
+ * optional arguments:
+ *
+ *   --max-size=BYTES   largest input to time (default 4MB;
+ *                      sizes go up by 16x from 1KB to 1GB)
+ *   --min-time=SECONDS how long to repeat each measurement
+ *                      (default 0.25)
+ *   --filter=TEXT      only run benchmarks whose name, input
+ *                      or format contains TEXT
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "bstream.h"
+#include "HuffmanEncoding.h"
+#include "HuffmanSimd.h"
+using namespace std;
+
+/* Constant: MIN_SIZE, MAX_SIZE
+ * The smallest and largest input sizes the benchmark knows.
+ */
+static const size_t MIN_SIZE = 1 << 10;
+static const size_t MAX_SIZE = size_t(1) << 30;
+
+/* Type: Settings
+ * What the command line asked for.
+ */
+struct Settings {
+	size_t maxSize;
+	double minTime;
+	string filter;
+};
+
+/* Type: Corpus
+ * One kind of generated input.
+ */
+struct Corpus {
+	string name;
+	void (*generate)(string& data, size_t length);
+};
+
+/* Type: Format
+ * One set of options for compress, with a name for the report.
+ */
+struct Format {
+	string name;
+	HuffmanOptions options;
+};
+
+/* Function: nextRandom
+ * --------------------------------------------------------
+ * A xorshift generator, so every run sees the same inputs.
+ */
+static uint64_t nextRandom(uint64_t& state) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/* Functions: generateText, generateBinary, generateRandom,
+ *            generateSkewed, generateSingle
+ * --------------------------------------------------------
+ * Fill data with length bytes of English-like words, of
+ * structured binary records, of uniform noise, of bytes whose
+ * frequencies fall off geometrically, and of one repeated
+ * byte.
+ */
+static void generateText(string& data, size_t length) {
+	static const char* const words[] = {
+		"the", "of", "and", "a", "to", "in", "is", "you", "that", "it", "he", "was", "for",
+		"on", "are", "as", "with", "his", "they", "at", "be", "this", "have", "from", "or",
+		"one", "had", "by", "word", "but", "not", "what", "all", "were", "we", "when", "your"
+	};
+	const size_t numWords = sizeof words / sizeof words[0];
+	uint64_t state = 0x2545F4914F6CDD1DULL;
+	data.clear();
+	data.reserve(length + 16);
+	while (data.size() < length) {
+		uint64_t r = nextRandom(state);
+		data += words[(r % numWords) * (r % numWords) / numWords];
+		data += (r % 11 == 0)? ".\n" : " ";
+	}
+	data.resize(length);
+}
+static void generateBinary(string& data, size_t length) {
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	data.resize(length);
+	for (size_t i = 0; i < length; i++) {
+		size_t record = i / 16, field = i % 16;
+		if (field < 4) {
+			data[i] = char(record >> (8 * field));
+		} else if (field < 8) {
+			data[i] = char(nextRandom(state) % 4);
+		} else {
+			data[i] = (field == 8)? char(nextRandom(state)) : '\0';
+		}
+	}
+}
+static void generateRandom(string& data, size_t length) {
+	uint64_t state = 0xD1B54A32D192ED03ULL;
+	data.resize(length);
+	for (size_t i = 0; i < length; i++) {
+		data[i] = char(nextRandom(state));
+	}
+}
+static void generateSkewed(string& data, size_t length) {
+	uint64_t state = 0x8CB92BA72F3D8DD7ULL;
+	data.resize(length);
+	for (size_t i = 0; i < length; i++) {
+		uint64_t r = nextRandom(state);
+		int zeros = 0;
+		while (zeros < 63 && (r & (uint64_t(1) << zeros)) == 0) zeros++;
+		data[i] = char('a' + zeros);
+	}
+}
+static void generateSingle(string& data, size_t length) {
+	data.assign(length, '\0');
+}
+
+/* Function: parseSettings
+ * --------------------------------------------------------
+ * Reads the command line, exiting with a message on anything
+ * it doesn't understand.
+ */
+static Settings parseSettings(int argc, char** argv) {
+	Settings settings;
+	settings.maxSize = 4 << 20;
+	settings.minTime = 0.25;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.compare(0, 11, "--max-size=") == 0) {
+			settings.maxSize = size_t(strtoull(arg.c_str() + 11, NULL, 10));
+		} else if (arg.compare(0, 11, "--min-time=") == 0) {
+			settings.minTime = atof(arg.c_str() + 11);
+		} else if (arg.compare(0, 9, "--filter=") == 0) {
+			settings.filter = arg.substr(9);
+		} else {
+			cerr << "Usage: " << argv[0] << " [--max-size=BYTES] [--min-time=SECONDS] [--filter=TEXT]" << endl;
+			exit(1);
+		}
+	}
+	if (settings.maxSize > MAX_SIZE) settings.maxSize = MAX_SIZE;
+	return settings;
+}
+
+/* Function: report
+ * --------------------------------------------------------
+ * Prints one measurement: the seconds one run took on
+ * average, over bytes of input.
+ */
+static void report(const string& benchmark, const string& corpus, const string& format,
+                   size_t bytes, int runs, double seconds) {
+	double perRun = seconds / runs;
+	cout << benchmark << ',' << corpus << ',' << format << ',' << bytes << ',' << runs << ','
+	     << perRun << ',' << (bytes / perRun) / 1e6 << ',' << perRun * 1e9 / bytes << endl;
+}
+
+/* Function: measure
+ * --------------------------------------------------------
+ * Runs task until at least minTime has passed (and at least
+ * once), then reports the average.  The clock only runs
+ * during task itself; setup, whatever it costs, is left out.
+ */
+static void measure(const Settings& settings, const string& benchmark, const string& corpus,
+                    const string& format, size_t bytes,
+                    const function<void()>& setup, const function<void()>& task) {
+	if (!settings.filter.empty() && (benchmark + ' ' + corpus + ' ' + format).find(settings.filter) == string::npos) {
+		return;
+	}
+	double elapsed = 0;
+	int runs = 0;
+	while (runs == 0 || elapsed < settings.minTime) {
+		setup();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		task();
+		elapsed += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		runs++;
+	}
+	report(benchmark, corpus, format, bytes, runs, elapsed);
+}
+
+/* Function: benchmarkStages
+ * --------------------------------------------------------
+ * Times each stage of the original pipeline on its own:
+ * getFrequencyTable, buildEncodingTree, then encodeFile and
+ * decodeFile with that tree, and then packCodes with each
+ * kernel this machine supports.
+ */
+static void benchmarkStages(const Settings& settings, const string& corpus, const string& data) {
+	const size_t bytes = data.size();
+
+	Map<ext_char, int> frequencies;
+	istringbstream source;
+	measure(settings, "getFrequencyTable", corpus, "-", bytes,
+	        [&] { source.clear(); source.str(data); },
+	        [&] { frequencies = getFrequencyTable(source); });
+	if (frequencies.isEmpty()) {
+		source.clear();
+		source.str(data);
+		frequencies = getFrequencyTable(source);
+	}
+
+	NodeArena arena;
+	measure(settings, "buildEncodingTree", corpus, "-", bytes,
+	        [&] { arena.release(); },
+	        [&] { buildEncodingTree(frequencies, arena); });
+	arena.release();
+	Node* tree = buildEncodingTree(frequencies, arena);
+
+	unique_ptr<ostringbstream> encoded;
+	measure(settings, "encodeFile", corpus, "-", bytes,
+	        [&] { source.clear(); source.str(data); encoded.reset(new ostringbstream); },
+	        [&] { encodeFile(source, tree, *encoded); });
+	source.clear();
+	source.str(data);
+	encoded.reset(new ostringbstream);
+	encodeFile(source, tree, *encoded);
+
+	string bits = encoded->str();
+	istringbstream packed;
+	unique_ptr<ostringbstream> decoded;
+	measure(settings, "decodeFile", corpus, "-", bytes,
+	        [&] { packed.clear(); packed.str(bits); decoded.reset(new ostringbstream); },
+	        [&] { decodeFile(packed, tree, *decoded); });
+
+	EncodeTable table;
+	buildEncodeTable(tree, table);
+	const EncodeKernel kernels[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_NEON};
+	for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+		if (!isKernelSupported(kernels[k])) continue;
+		measure(settings, "packCodes", corpus, kernelName(kernels[k]), bytes,
+		        [&] { encoded.reset(new ostringbstream); },
+		        [&] { packCodes(data.data(), data.size(), table, *encoded, kernels[k]); encoded->flushBits(); });
+	}
+}
+
+/* Function: benchmarkFormats
+ * --------------------------------------------------------
+ * Times compress and decompress in every format, and prints
+ * the compressed size as a ratio line of its own so ratio
+ * regressions show up next to speed ones.
+ */
+static void benchmarkFormats(const Settings& settings, const string& corpus, const string& data,
+                             const vector<Format>& formats) {
+	const size_t bytes = data.size();
+	for (size_t f = 0; f < formats.size(); f++) {
+		const HuffmanOptions& options = formats[f].options;
+		istringbstream source;
+		unique_ptr<ostringbstream> packed;
+		measure(settings, "compress", corpus, formats[f].name, bytes,
+		        [&] { source.clear(); source.str(data); packed.reset(new ostringbstream); },
+		        [&] { compress(source, *packed, options); });
+
+		source.clear();
+		source.str(data);
+		packed.reset(new ostringbstream);
+		compress(source, *packed, options);
+		string compressed = packed->str();
+		if (settings.filter.empty() || ("ratio " + corpus + ' ' + formats[f].name).find(settings.filter) != string::npos) {
+			cout << "ratio," << corpus << ',' << formats[f].name << ',' << bytes << ",1,"
+			     << double(compressed.size()) / bytes << ",0,0" << endl;
+		}
+
+		istringbstream packedSource;
+		unique_ptr<ostringbstream> unpacked;
+		measure(settings, "decompress", corpus, formats[f].name, bytes,
+		        [&] { packedSource.clear(); packedSource.str(compressed); unpacked.reset(new ostringbstream); },
+		        [&] { decompress(packedSource, *unpacked, options); });
+	}
+}
+
+/* Function: main
+ * --------------------------------------------------------
+ * Runs every benchmark on every corpus at every size up to
+ * the limit.  Each line is benchmark, input, format, input
+ * bytes, runs timed, seconds per run, MB/s and ns/byte; for
+ * ratio lines the seconds column holds the compressed size
+ * over the input size.
+ */
+int main(int argc, char** argv) {
+	Settings settings = parseSettings(argc, argv);
+
+	const Corpus corpora[] = {
+		{"text", generateText},
+		{"binary", generateBinary},
+		{"random", generateRandom},
+		{"skewed", generateSkewed},
+		{"single", generateSingle}
+	};
+
+	vector<Format> formats(6);
+	formats[0].name = "frequencies";
+	formats[1].name = "canonical";
+	formats[1].options.format = FORMAT_CANONICAL;
+	formats[2].name = "counted";
+	formats[2].options.format = FORMAT_COUNTED;
+	formats[3].name = "blocks";
+	formats[3].options.format = FORMAT_BLOCKS;
+	formats[4].name = "blocks-1thread";
+	formats[4].options.format = FORMAT_BLOCKS;
+	formats[4].options.numThreads = 1;
+	formats[5].name = "context";
+	formats[5].options.format = FORMAT_CONTEXT;
+
+	cout << "benchmark,input,format,bytes,runs,seconds,mb_per_s,ns_per_byte" << endl;
+	cout.precision(6);
+	for (size_t size = MIN_SIZE; size <= settings.maxSize; size *= 16) {
+		for (size_t c = 0; c < sizeof corpora / sizeof corpora[0]; c++) {
+			string data;
+			corpora[c].generate(data, size);
+			benchmarkStages(settings, corpora[c].name, data);
+			benchmarkFormats(settings, corpora[c].name, data, formats);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,1097 @@
+/**********************************************************
+ * File: HuffmanBlocks.cpp
+ *
+ * Implementation of the block container from HuffmanBlocks.h.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Crc32c.h"
+#include "Pipeline.h"
+#include "ThreadPool.h"
+#include "TableCache.h"
+#include "HuffmanStats.h"
+#include "HuffmanBlocks.h"
+
+/* Constant: BLOCKS_VERSION
+ * The container version written after BLOCKS_TAG.  Version 1
+ * had no index and version 2 no checksums; both are still
+ * read.
+ */
+static const int BLOCKS_VERSION = 3;
+
+/* Constants: sizes of the fixed parts of the container. */
+static const size_t HEADER_SIZE = 6;
+static const size_t FRAME_HEADER_SIZE = 9;
+static const size_t INDEX_ENTRY_SIZE = 20;
+static const size_t TRAILER_SIZE = 16;
+static const size_t CHECKSUM_SIZE = 4;
+
+/* Constant: VERIFY_CHUNK_SIZE
+ * How much of a payload verifyBlocks reads at a time.
+ */
+static const size_t VERIFY_CHUNK_SIZE = 1 << 16;
+
+/* Constant: INDEX_MAGIC
+ * The last four bytes of a container with an index, "HIDX"
+ * read as a little-endian integer.
+ */
+static const uint32_t INDEX_MAGIC = 0x58444948;
+
+/* Function: loadBytes
+ * --------------------------------------------------------
+ * Reads a little-endian integer of the given number of bytes
+ * from memory.
+ */
+static uint64_t loadBytes(const char* data, int bytes) {
+	uint64_t result = 0;
+	for (int i = bytes - 1; i >= 0; i--) {
+		result = (result << 8) | (unsigned char)data[i];
+	}
+	return result;
+}
+
+/* Function: storeBytes
+ * --------------------------------------------------------
+ * Writes value to memory as a little-endian integer of the
+ * given number of bytes.
+ */
+static void storeBytes(char* data, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) {
+		data[i] = char(value >> (8 * i));
+	}
+}
+
+/* Function: frameChecksum
+ * --------------------------------------------------------
+ * The CRC-32C of a frame's header fields and payload, which
+ * is what follows the payload from version 3 on.
+ */
+static uint32_t frameChecksum(size_t length, size_t payloadSize, int type, const char* payload) {
+	char header[FRAME_HEADER_SIZE];
+	storeBytes(header, length, 4);
+	storeBytes(header + 4, payloadSize, 4);
+	header[8] = char(type);
+	return crc32c(crc32c(0, header, FRAME_HEADER_SIZE), payload, payloadSize);
+}
+
+/* Function: checkFrame
+ * --------------------------------------------------------
+ * Checks the checksum that ends a frame of frameSize bytes in
+ * a container of the given version, and returns the size of
+ * the frame without it.  Frames of earlier versions have no
+ * checksum and are returned whole.
+ */
+static size_t checkFrame(const char* frame, size_t frameSize, int version, size_t blockNumber) {
+	if (version < 3) return frameSize;
+	if (frameSize < FRAME_HEADER_SIZE + CHECKSUM_SIZE) error("Block index disagrees with its frame.");
+	size_t size = frameSize - CHECKSUM_SIZE;
+	if (crc32c(0, frame, size) != uint32_t(loadBytes(frame + size, 4))) {
+		error("Block " + integerToString(int(blockNumber)) + " fails its checksum.");
+	}
+	return size;
+}
+
+/* Constant: MAX_TABLE_SIZE
+ * The most bytes writeCodeLengths can take: the three-bit
+ * width and a flag and eight-bit length for every symbol.
+ */
+static const size_t MAX_TABLE_SIZE = (3 + 9 * NUM_SYMBOLS + 7) / 8;
+
+/* Function: maxPayloadSize
+ * --------------------------------------------------------
+ * The largest payload a frame holding a block of length bytes
+ * can have.  A coded block is only chosen when it beats
+ * storing the block, give or take the stream headers that
+ * maxBlocksSize allows for.  Containers written before blocks
+ * could be stored may also spend a length table and, with a
+ * ninth bit on the rarest characters, a 256th more.  A frame
+ * claiming more than this is damaged, and is reported before
+ * any memory is set aside for it.
+ */
+static uint64_t maxPayloadSize(uint64_t length) {
+	return length + length / 256 + MAX_TABLE_SIZE + 2 + 5 * MAX_STREAMS;
+}
+
+/* Constant: REUSE_COST
+ * The bits a block that reuses a table spends saying so: the
+ * distance back to the block whose table it uses.
+ */
+static const uint64_t REUSE_COST = 32;
+
+/* Type: BlockCode
+ * What compressBlocks learns about a block before choosing
+ * its table: the block's character weights, the canonical
+ * code built for it alone, and how many bits that code's
+ * length table and data would take, as well as the size of
+ * its runs.  A block that some other type is sure to beat
+ * (see countBlock) gets no table at all.
+ */
+struct BlockCode {
+	uint64_t weights[NUM_SYMBOLS];
+	EncodeTable table;
+	uint64_t cost;
+	bool untabled;
+	size_t runBytes;
+};
+
+/* Function: varintSize
+ * --------------------------------------------------------
+ * The bytes writeVarint takes for value.
+ */
+static size_t varintSize(uint64_t value) {
+	size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+/* Function: writeVarint
+ * --------------------------------------------------------
+ * Appends value seven bits at a time, low bits first, with
+ * the top bit of each byte set if more follow.
+ */
+static void writeVarint(std::string& out, uint64_t value) {
+	while (value >= 0x80) {
+		out += char(0x80 | (value & 0x7F));
+		value >>= 7;
+	}
+	out += char(value);
+}
+
+/* Function: runsSize
+ * --------------------------------------------------------
+ * The size of the BLOCK_RUNS payload for data.  Runs that
+ * don't at least halve the block are not worth sending, so
+ * scanning stops once the payload reaches half the length,
+ * and length itself is returned.
+ */
+static size_t runsSize(const char* data, size_t length) {
+	size_t size = 0;
+	for (size_t i = 0; i < length; ) {
+		if (size >= length / 2) return length;
+		size_t start = i;
+		while (i < length && data[i] == data[start]) i++;
+		size += 1 + varintSize(i - start);
+	}
+	return size;
+}
+
+/* Function: encodeRuns
+ * --------------------------------------------------------
+ * Writes data as a BLOCK_RUNS payload.
+ */
+static void encodeRuns(const char* data, size_t length, std::string& payload) {
+	payload.clear();
+	for (size_t i = 0; i < length; ) {
+		size_t start = i;
+		while (i < length && data[i] == data[start]) i++;
+		payload += data[start];
+		writeVarint(payload, i - start);
+	}
+}
+
+/* Function: decodeRuns
+ * --------------------------------------------------------
+ * Expands a BLOCK_RUNS payload into buffer with memset.
+ * Reports an error unless the runs fill exactly length bytes.
+ */
+static void decodeRuns(const char* payload, size_t payloadSize, char* buffer, size_t length) {
+	size_t filled = 0, i = 0;
+	while (i < payloadSize) {
+		char ch = payload[i++];
+		uint64_t run = 0;
+		for (int shift = 0; ; shift += 7) {
+			if (i == payloadSize || shift > 63) error("Run-length block is damaged.");
+			unsigned char byte = (unsigned char)payload[i++];
+			run |= uint64_t(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) break;
+		}
+		if (run == 0 || run > length - filled) error("Run-length block overflows its frame.");
+		memset(buffer + filled, ch, size_t(run));
+		filled += size_t(run);
+	}
+	if (filled != length) error("Run-length block decodes to fewer characters than its frame says.");
+}
+
+/* Function: codeCost
+ * --------------------------------------------------------
+ * The bits the given weights cost under table, summed the way
+ * treeCost sums a tree, or UINT64_MAX if a character that
+ * occurs has no code.
+ */
+static uint64_t codeCost(const uint64_t weights[NUM_SYMBOLS], const EncodeTable& table) {
+	uint64_t cost = 0;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		if (weights[ch] == 0) continue;
+		if (table.lengths[ch] == 0) return UINT64_MAX;
+		cost += weights[ch] * table.lengths[ch];
+	}
+	return cost;
+}
+
+/* Functions: countBlock, tableBlock
+ * --------------------------------------------------------
+ * Count one block, then build its own canonical code.
+ * PSEUDO_EOF gets a code even in interleaved blocks, which
+ * never use it, so that a block of one repeated byte still
+ * has a complete code.  They touch nothing but their
+ * arguments, so blocks can be planned concurrently.
+ *
+ * Building a tree is skipped when it could never win.  No
+ * prefix code beats the entropy of the histogram, so once
+ * that reaches 8 bits a byte storing is at least as good.
+ * And with PSEUDO_EOF every code is at least a bit long, so
+ * runs that take up to a bit per byte are at least as good
+ * too; a block of one repeated byte always ends up as runs.
+ */
+static void countBlock(const char* data, size_t length, BlockCode& code) {
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) code.weights[ch] = 0;
+	countFrequencies((const unsigned char*)data, length, code.weights);
+
+	int distinct = 0;
+	double entropy = 0;
+	for (int ch = 0; ch < 256; ch++) {
+		if (code.weights[ch] == 0) continue;
+		distinct++;
+		entropy += code.weights[ch] * std::log2(double(length) / code.weights[ch]);
+	}
+	code.runBytes = (distinct == 1)? 1 + varintSize(length) : runsSize(data, length);
+	code.untabled = entropy >= 8.0 * length || 8 * code.runBytes <= length;
+}
+static void tableBlock(const HuffmanOptions& options, BlockCode& code) {
+	if (code.untabled) return;
+	code.weights[PSEUDO_EOF] = 1;
+	buildCanonicalTable(code.weights, options.maxCodeLength, code.table);
+
+	ostringbstream header;
+	writeCodeLengths(header, code.table);
+	header.flushBits();
+	code.cost = 8 * header.str().size() + codeCost(code.weights, code.table);
+}
+
+/* Function: encodeBlock
+ * --------------------------------------------------------
+ * Encodes one block with table, producing a payload of the
+ * returned type.  If distance is zero the payload starts with
+ * the table's lengths; otherwise the table is the one sent
+ * distance blocks back, and the payload starts with distance.
+ * Blocks can be encoded concurrently.
+ */
+static int encodeBlock(const char* data, size_t length, const EncodeTable& table, uint32_t distance,
+                       const HuffmanOptions& options, std::string& payload) {
+	ostringbstream out;
+	if (distance == 0) {
+		writeCodeLengths(out, table);
+	} else {
+		out.writeBits(distance, 32);
+	}
+
+	int type = BLOCK_HUFFMAN;
+	if (options.numStreams > 1) {
+		encodeInterleaved(data, length, table, options.numStreams, out);
+		type = BLOCK_INTERLEAVED;
+	} else {
+		encodeBytes(data, length, table, out);
+		out.writeBits(table.codes[PSEUDO_EOF], table.lengths[PSEUDO_EOF]);
+	}
+	payload = out.str();
+	return (distance == 0)? type : type | BLOCK_REUSED_TABLE;
+}
+
+/* Function: loadTables
+ * --------------------------------------------------------
+ * Reads a length table from source and returns its tables,
+ * from cache if there is one.
+ */
+static std::shared_ptr<const CachedTables> loadTables(ibstream& source, TableCache* cache) {
+	EncodeTable codes;
+	readCodeLengths(source, codes);
+	if (cache != NULL) return cache->lookup(codes);
+
+	std::shared_ptr<CachedTables> built = std::make_shared<CachedTables>();
+	built->encodeTable = codes;
+	buildDecodeTable(codes, built->decodeTable);
+	return built;
+}
+
+/* Function: decodeFrame
+ * --------------------------------------------------------
+ * Decodes the frame of frameSize bytes starting at frame into
+ * buffer with the given tables, which are NULL for stored
+ * blocks and runs.  The frame's header must agree that it takes that
+ * many bytes and holds a block of exactly length bytes.  The
+ * payload is read in place.
+ */
+static void decodeFrame(const char* frame, size_t frameSize, char* buffer, size_t length,
+                        const CachedTables* tables) {
+	size_t payloadSize = size_t(loadBytes(frame + 4, 4));
+	if (frameSize < FRAME_HEADER_SIZE || size_t(loadBytes(frame, 4)) != length ||
+	    payloadSize != frameSize - FRAME_HEADER_SIZE) {
+		error("Block index disagrees with its frame.");
+	}
+
+	int type = (unsigned char)frame[8];
+	if (type == BLOCK_STORED) {
+		if (payloadSize != length) error("Stored block is not the size its frame says.");
+		memcpy(buffer, frame + FRAME_HEADER_SIZE, length);
+		return;
+	}
+	if (type == BLOCK_RUNS) {
+		decodeRuns(frame + FRAME_HEADER_SIZE, payloadSize, buffer, length);
+		return;
+	}
+	int coding = type & ~BLOCK_REUSED_TABLE;
+	if (coding != BLOCK_HUFFMAN && coding != BLOCK_INTERLEAVED) {
+		error("Unknown block type " + integerToString(type) + ".");
+	}
+
+	imembstream source(frame + FRAME_HEADER_SIZE, payloadSize);
+	if (type & BLOCK_REUSED_TABLE) {
+		source.readBits(32);
+	} else {
+		EncodeTable skipped;
+		readCodeLengths(source, skipped);
+	}
+
+	if (coding == BLOCK_INTERLEAVED) {
+		decodeInterleaved(source, tables->decodeTable, buffer, length);
+	} else if (decodeBytes(source, tables->decodeTable, buffer, length) != length) {
+		error("Block decodes to fewer characters than its frame says.");
+	}
+}
+
+/* Function: blocksInFlight
+ * --------------------------------------------------------
+ * How many blocks of blockSize bytes to put in each of the
+ * depth batches in flight: one per thread, cut down to what
+ * fits in maxMemory, but never fewer than one.
+ */
+static int blocksInFlight(const ThreadPool& pool, size_t blockSize, size_t maxMemory, int depth) {
+	size_t count = size_t(pool.size());
+	if (maxMemory != 0) count = std::min(count, std::max(size_t(1), maxMemory / (2 * blockSize * depth)));
+	return int(count);
+}
+
+/* Type: CompressBatch
+ * The blocks compressBlocks works on at once, and what it
+ * works out about each of them.
+ */
+struct CompressBatch {
+	int count;
+	std::vector<std::string> inputs, payloads;
+	std::vector<const char*> blocks;
+	std::vector<size_t> lengths;
+	std::vector<int> types;
+	std::vector<BlockCode> plans;
+	std::vector<const EncodeTable*> tables;
+	std::vector<uint32_t> distances, checksums;
+};
+
+/* Function: compressBlocks
+ * Usage: compressBlocks(infile, outfile, options);
+ * --------------------------------------------------------
+ * Reads a batch of blocks, encodes the batch on the thread
+ * pool, and writes its frames, in the three stages of a
+ * pipeline (see runPipeline) as deep as options asks.  Blocks
+ * of a memory-mapped input are encoded in place.  Tables are
+ * chosen in the encoding stage, which sees the batches in
+ * order, and offsets for the index are counted as the frames
+ * go out, so the output never needs to seek.  The reading
+ * and writing stages keep their times apart until the end,
+ * since they may run on threads of their own.
+ */
+void compressBlocks(istream& infile, obstream& outfile, const HuffmanOptions& options) {
+	if (options.blockSize <= 0) error("Block size must be positive.");
+	if (options.numStreams < 1 || options.numStreams > MAX_STREAMS) {
+		error("Stream count must be between 1 and " + integerToString(MAX_STREAMS) + ".");
+	}
+	const size_t blockSize = size_t(options.blockSize);
+	const int depth = std::max(1, options.pipelineDepth);
+	ThreadPool pool(options.numThreads);
+	const int batchSize = blocksInFlight(pool, blockSize, options.maxMemory, depth);
+	HuffmanStats* stats = options.stats;
+	HuffmanStats readTimes, writeTimes;
+
+	StageTimer header(stats, &HuffmanStats::headerSeconds);
+	outfile.writeBits(BLOCKS_TAG, 8);
+	outfile.writeBits(BLOCKS_VERSION, 8);
+	outfile.writeBits(blockSize, 32);
+	header.stop();
+
+	std::vector<BlockIndexEntry> index;
+	uint64_t frameOffset = HEADER_SIZE, outputOffset = 0;
+
+	const char* mapped;
+	size_t mappedLength;
+	bool inMemory = mappedBytes(infile, mapped, mappedLength);
+
+	std::vector<CompressBatch> batches(depth);
+	for (int slot = 0; slot < depth; slot++) {
+		CompressBatch& batch = batches[slot];
+		batch.count = 0;
+		batch.inputs.resize(batchSize);
+		batch.payloads.resize(batchSize);
+		batch.blocks.resize(batchSize);
+		batch.lengths.resize(batchSize);
+		batch.types.resize(batchSize);
+		batch.plans.resize(batchSize);
+		batch.tables.resize(batchSize);
+		batch.distances.resize(batchSize);
+		batch.checksums.resize(batchSize);
+	}
+
+	/* The table most recently sent, and the block that sent it. */
+	EncodeTable carried;
+	const EncodeTable* active = NULL;
+	size_t activeBlock = 0, blocksPlanned = 0;
+	bool exhausted = false;
+
+	auto read = [&](int slot) {
+		CompressBatch& batch = batches[slot];
+		StageTimer reading((stats != NULL)? &readTimes : NULL, &HuffmanStats::countSeconds);
+		batch.count = 0;
+		while (batch.count < batchSize && !exhausted) {
+			int i = batch.count;
+			if (inMemory) {
+				batch.blocks[i] = mapped;
+				batch.lengths[i] = std::min(blockSize, mappedLength);
+				mapped += batch.lengths[i];
+				mappedLength -= batch.lengths[i];
+			} else {
+				std::string& block = batch.inputs[i];
+				block.resize(blockSize);
+				infile.read(&block[0], blockSize);
+				block.resize(size_t(infile.gcount()));
+				batch.blocks[i] = block.data();
+				batch.lengths[i] = block.size();
+			}
+
+			exhausted = batch.lengths[i] < blockSize;
+			if (batch.lengths[i] != 0) batch.count++;
+		}
+		return !exhausted;
+	};
+
+	auto process = [&](int slot) {
+		CompressBatch& batch = batches[slot];
+		const int count = batch.count;
+		StageTimer counting(stats, &HuffmanStats::countSeconds);
+		pool.run(count, [&](int i) {
+			countBlock(batch.blocks[i], batch.lengths[i], batch.plans[i]);
+		});
+		counting.stop();
+
+		StageTimer building(stats, &HuffmanStats::treeSeconds);
+		pool.run(count, [&](int i) {
+			tableBlock(options, batch.plans[i]);
+		});
+
+		/* Each block takes the cheapest of storing, runs, its own
+		 * table and the last table sent.  Blocks without a table
+		 * have a NULL entry in tables.
+		 */
+		for (int i = 0; i < count; i++) {
+			size_t blockNumber = blocksPlanned++;
+			BlockCode& plan = batch.plans[i];
+			uint64_t best = 8 * uint64_t(batch.lengths[i]);
+			batch.types[i] = BLOCK_STORED;
+			if (8 * uint64_t(plan.runBytes) < best) {
+				best = 8 * uint64_t(plan.runBytes);
+				batch.types[i] = BLOCK_RUNS;
+			}
+			batch.distances[i] = 0;
+			batch.tables[i] = NULL;
+			if (plan.untabled) continue;
+
+			const EncodeTable* table = &plan.table;
+			uint64_t cost = plan.cost;
+			if (options.reuseTables && active != NULL) {
+				uint64_t reuseCost = codeCost(plan.weights, *active);
+				if (reuseCost != UINT64_MAX && reuseCost + REUSE_COST <= cost) {
+					table = active;
+					cost = reuseCost + REUSE_COST;
+					batch.distances[i] = uint32_t(blockNumber - activeBlock);
+				}
+			}
+			if (cost >= best) {
+				batch.distances[i] = 0;
+				continue;
+			}
+			if (batch.distances[i] == 0) {
+				active = table;
+				activeBlock = blockNumber;
+			}
+			batch.tables[i] = table;
+		}
+		building.stop();
+
+		StageTimer encoding(stats, &HuffmanStats::encodeSeconds);
+		pool.run(count, [&](int i) {
+			if (batch.tables[i] != NULL) {
+				batch.types[i] = encodeBlock(batch.blocks[i], batch.lengths[i], *batch.tables[i],
+				                             batch.distances[i], options, batch.payloads[i]);
+			} else if (batch.types[i] == BLOCK_RUNS) {
+				encodeRuns(batch.blocks[i], batch.lengths[i], batch.payloads[i]);
+			}
+			bool stored = batch.types[i] == BLOCK_STORED;
+			batch.checksums[i] = frameChecksum(batch.lengths[i], stored? batch.lengths[i] : batch.payloads[i].size(),
+			                                   batch.types[i], stored? batch.blocks[i] : batch.payloads[i].data());
+		});
+		if (stats != NULL) {
+			for (int i = 0; i < count; i++) {
+				stats->bytesIn += batch.lengths[i];
+				if (batch.tables[i] == NULL) continue;
+				batch.plans[i].weights[PSEUDO_EOF] = (options.numStreams > 1)? 0 : 1;
+				stats->addCodes(batch.plans[i].weights, *batch.tables[i]);
+			}
+		}
+		if (active != NULL && active != &carried) {
+			carried = *active;
+			active = &carried;
+		}
+	};
+
+	auto write = [&](int slot) {
+		CompressBatch& batch = batches[slot];
+		StageTimer writing((stats != NULL)? &writeTimes : NULL, &HuffmanStats::encodeSeconds);
+		for (int i = 0; i < batch.count; i++) {
+			bool stored = batch.types[i] == BLOCK_STORED;
+			const char* payload = stored? batch.blocks[i] : batch.payloads[i].data();
+			size_t payloadSize = stored? batch.lengths[i] : batch.payloads[i].size();
+			BlockIndexEntry entry = {frameOffset, outputOffset, uint32_t(batch.lengths[i]),
+			                         uint32_t(FRAME_HEADER_SIZE + payloadSize + CHECKSUM_SIZE)};
+			index.push_back(entry);
+			frameOffset += entry.frameSize;
+			outputOffset += batch.lengths[i];
+
+			outfile.writeBits(batch.lengths[i], 32);
+			outfile.writeBits(payloadSize, 32);
+			outfile.writeBits(batch.types[i], 8);
+			outfile.writeBytes(payload, payloadSize);
+			outfile.writeBits(batch.checksums[i], 32);
+		}
+	};
+
+	runPipeline(depth, read, process, write);
+	if (stats != NULL) {
+		stats->countSeconds += readTimes.countSeconds;
+		stats->encodeSeconds += writeTimes.encodeSeconds;
+	}
+
+	StageTimer trailer(stats, &HuffmanStats::headerSeconds);
+	outfile.writeBits(0, 32);
+
+	for (size_t i = 0; i < index.size(); i++) {
+		outfile.writeBits(index[i].frameOffset, 64);
+		outfile.writeBits(index[i].outputOffset, 64);
+		outfile.writeBits(index[i].length, 32);
+	}
+	outfile.writeBits(index.size(), 32);
+	outfile.writeBits(frameOffset + 4, 64);
+	outfile.writeBits(INDEX_MAGIC, 32);
+	outfile.flushBits();
+}
+
+/* Function: readBlockIndex
+ * Usage: if (readBlockIndex(infile, index)) { ... }
+ * --------------------------------------------------------
+ * Uses only the ordinary istream functions, so the bit
+ * buffers are never involved.  The index is trusted only
+ * if it sits exactly where the trailer says, ends the stream,
+ * and its entries tile both the frames and the output.
+ */
+bool readBlockIndex(ibstream& infile, std::vector<BlockIndexEntry>& index) {
+	if (infile.rdbuf() == NULL) return false;
+	streampos start = infile.tellg();
+	if (start == streampos(-1)) return false;
+	infile.seekg(0, ios::end);
+	streampos end = infile.tellg();
+
+	bool found = false;
+	char header[HEADER_SIZE], trailer[TRAILER_SIZE];
+	uint64_t total = uint64_t(end - start);
+	if (end != streampos(-1) && total >= HEADER_SIZE + 4 + TRAILER_SIZE &&
+	    infile.seekg(start).read(header, HEADER_SIZE) &&
+	    header[0] == BLOCKS_TAG && (unsigned char)header[1] >= 2 &&
+	    infile.seekg(end - streamoff(TRAILER_SIZE)).read(trailer, TRAILER_SIZE) &&
+	    loadBytes(trailer + 12, 4) == INDEX_MAGIC) {
+		uint64_t count = loadBytes(trailer, 4);
+		uint64_t indexOffset = loadBytes(trailer + 4, 8);
+		std::string entries;
+		found = indexOffset >= HEADER_SIZE + 4 &&
+		        indexOffset + count * INDEX_ENTRY_SIZE + TRAILER_SIZE == total;
+		if (found) {
+			entries.resize(size_t(count * INDEX_ENTRY_SIZE));
+			found = bool(infile.seekg(start + streamoff(indexOffset)).read(&entries[0], streamsize(entries.size())));
+		}
+
+		index.clear();
+		uint64_t outputOffset = 0;
+		for (size_t i = 0; found && i < size_t(count); i++) {
+			const char* data = entries.data() + i * INDEX_ENTRY_SIZE;
+			BlockIndexEntry entry = {loadBytes(data, 8), loadBytes(data + 8, 8), uint32_t(loadBytes(data + 16, 4)), 0};
+			uint64_t expected = (i == 0)? HEADER_SIZE : index.back().frameOffset + FRAME_HEADER_SIZE;
+			found = entry.frameOffset >= expected && entry.outputOffset == outputOffset && entry.length != 0;
+			if (i > 0) index.back().frameSize = uint32_t(entry.frameOffset - index.back().frameOffset);
+			outputOffset += entry.length;
+			index.push_back(entry);
+		}
+		if (found && !index.empty()) {
+			uint64_t terminator = indexOffset - 4;
+			found = terminator >= index.back().frameOffset + FRAME_HEADER_SIZE;
+			index.back().frameSize = uint32_t(terminator - index.back().frameOffset);
+		}
+	}
+
+	infile.clear();
+	infile.seekg(start);
+	return found;
+}
+
+/* Function: readFrame
+ * --------------------------------------------------------
+ * Reads the whole frame of the given block, whose container
+ * starts at start, into frame.
+ */
+static void readFrame(ibstream& infile, streampos start, const BlockIndexEntry& entry, std::string& frame) {
+	frame.resize(entry.frameSize);
+	infile.seekg(start + streamoff(entry.frameOffset));
+	if (infile.readBytes(&frame[0], frame.size()) != frame.size()) {
+		error("Block container is truncated.");
+	}
+}
+
+/* Function: sendsTable
+ * --------------------------------------------------------
+ * Whether the frame of the given block, whose container
+ * starts at start, sends a table of its own.  Only the type
+ * in its header is read.
+ */
+static bool sendsTable(ibstream& infile, streampos start, const BlockIndexEntry& entry) {
+	char type;
+	infile.seekg(start + streamoff(entry.frameOffset + 8));
+	if (infile.readBytes(&type, 1) != 1) error("Block container is truncated.");
+	return (unsigned char)type != BLOCK_STORED && (unsigned char)type != BLOCK_RUNS &&
+	       ((unsigned char)type & BLOCK_REUSED_TABLE) == 0;
+}
+
+/* Function: decompressBlockRange
+ * Usage: if (decompressBlockRange(infile, offset, length, outfile, options, written)) { ... }
+ * --------------------------------------------------------
+ * The first block is found by a binary search of the index.
+ * A block that reuses a table needs the frame that sent it
+ * as well, which is read only for its length table; blocks
+ * reusing the same table share one load of it.  As in
+ * decompressBlocks, that must be the last table sent, which
+ * for the blocks before the range is checked by reading just
+ * the types in their headers.
+ */
+bool decompressBlockRange(ibstream& infile, uint64_t offset, uint64_t length, ostream& outfile,
+                          const HuffmanOptions& options, uint64_t& written) {
+	HuffmanStats* stats = options.stats;
+	written = 0;
+	StageTimer header(stats, &HuffmanStats::headerSeconds);
+	std::vector<BlockIndexEntry> index;
+	if (!readBlockIndex(infile, index)) return false;
+
+	streampos start = infile.tellg();
+	char fields[HEADER_SIZE];
+	if (infile.readBytes(fields, HEADER_SIZE) != HEADER_SIZE) error("Block container header is truncated.");
+	if (fields[0] != BLOCKS_TAG) error("Not a block container.");
+	int version = (unsigned char)fields[1];
+	if (version < 2 || version > BLOCKS_VERSION) {
+		error("Unsupported block container version " + integerToString(version) + ".");
+	}
+	uint64_t blockSize = loadBytes(fields + 2, 4);
+	if (blockSize == 0) error("Block container has a block size of zero.");
+	header.stop();
+
+	uint64_t total = index.empty()? 0 : index.back().outputOffset + index.back().length;
+	if (offset >= total || length == 0) return true;
+	uint64_t end = offset + std::min(length, total - offset);
+
+	size_t first = std::upper_bound(index.begin(), index.end(), offset,
+	                                [](uint64_t value, const BlockIndexEntry& entry) {
+	                                	return value < entry.outputOffset;
+	                                }) - index.begin() - 1;
+	std::string frame, owner, block;
+	std::shared_ptr<const CachedTables> tables;
+	size_t tablesBlock = index.size();
+
+	/* The last block known to have sent a table, if any. */
+	size_t lastSender = index.size();
+	for (size_t b = first; b < index.size() && index[b].outputOffset < end; b++) {
+		const BlockIndexEntry& entry = index[b];
+		if (entry.length > blockSize) error("Block is larger than the container's block size.");
+		readFrame(infile, start, entry, frame);
+		frame.resize(checkFrame(frame.data(), frame.size(), version, b));
+
+		int type = (unsigned char)frame[8];
+		if (type != BLOCK_STORED && type != BLOCK_RUNS) {
+			StageTimer building(stats, &HuffmanStats::treeSeconds);
+			size_t source = b;
+			if (type & BLOCK_REUSED_TABLE) {
+				uint64_t distance = (frame.size() < FRAME_HEADER_SIZE + 4)? 0 : loadBytes(&frame[FRAME_HEADER_SIZE], 4);
+				if (distance == 0 || distance > b) error("Block reuses a table that was never sent.");
+				source = b - size_t(distance);
+				if (lastSender == index.size()) {
+					if (source >= first) error("Block reuses a table that was never sent.");
+					for (size_t between = source + 1; between < first; between++) {
+						if (sendsTable(infile, start, index[between])) error("Block reuses a table that was never sent.");
+					}
+					lastSender = source;
+				} else if (source != lastSender) {
+					error("Block reuses a table that was never sent.");
+				}
+			} else {
+				lastSender = b;
+			}
+			if (source != tablesBlock) {
+				const std::string* sender = &frame;
+				if (source != b) {
+					readFrame(infile, start, index[source], owner);
+					owner.resize(checkFrame(owner.data(), owner.size(), version, source));
+					sender = &owner;
+				}
+				int senderType = (unsigned char)(*sender)[8];
+				if (senderType == BLOCK_STORED || senderType == BLOCK_RUNS || (senderType & BLOCK_REUSED_TABLE)) {
+					error("Block reuses a table that was never sent.");
+				}
+				imembstream payload(sender->data() + FRAME_HEADER_SIZE, sender->size() - FRAME_HEADER_SIZE);
+				tables = loadTables(payload, options.tableCache);
+				tablesBlock = source;
+			}
+		}
+
+		StageTimer decoding(stats, &HuffmanStats::decodeSeconds);
+		block.resize(entry.length);
+		decodeFrame(frame.data(), frame.size(), &block[0], block.size(),
+		            (type == BLOCK_STORED || type == BLOCK_RUNS)? NULL : tables.get());
+		size_t from = size_t(std::max(offset, entry.outputOffset) - entry.outputOffset);
+		size_t to = size_t(std::min(end, entry.outputOffset + entry.length) - entry.outputOffset);
+		outfile.write(block.data() + from, to - from);
+		written += to - from;
+	}
+	return true;
+}
+
+/* Function: maxBlocksSize
+ * Usage: size_t bound = maxBlocksSize(length, options);
+ * --------------------------------------------------------
+ * Every block pays for its frame header, its checksum and its
+ * index entry.  A coded block is only chosen when its
+ * estimated bits come to less than storing it; the estimate
+ * leaves out the final partial byte and, when interleaved,
+ * the stream count, a size and a padding byte per stream.  So
+ * no block takes more than its own length plus those.
+ */
+size_t maxBlocksSize(size_t length, const HuffmanOptions& options) {
+	const size_t blockSize = size_t(std::max(options.blockSize, 1));
+	const size_t numBlocks = (length + blockSize - 1) / blockSize;
+	const size_t perBlock = FRAME_HEADER_SIZE + CHECKSUM_SIZE + INDEX_ENTRY_SIZE + 2 + 5 * MAX_STREAMS;
+	return HEADER_SIZE + 4 + TRAILER_SIZE + numBlocks * perBlock + length;
+}
+
+/* Type: DecompressBatch
+ * The frames decompressBlocks works on at once: where each
+ * starts in frames, its size once its checksum is checked,
+ * where its block goes in output, and the tables it is
+ * decoded with.
+ */
+struct DecompressBatch {
+	int count;
+	std::string frames, output;
+	std::vector<size_t> frameStarts, frameSizes, outputStarts;
+	std::vector<std::shared_ptr<const CachedTables> > tables;
+};
+
+/* Function: decompressBlocks
+ * Usage: decompressBlocks(infile, outfile, options);
+ * --------------------------------------------------------
+ * Both paths gather a batch of whole frames into one buffer,
+ * noting where each frame starts and where its block goes in
+ * the batch's output buffer, then decode the frames on the
+ * pool.  With an index the batch is fetched by one read;
+ * without one the frames are read a header at a time.  The
+ * frames' checksums are checked on the pool too, before
+ * anything is read from them.  As in compressBlocks, reading,
+ * decoding and writing the batches are the stages of a
+ * pipeline.
+ */
+void decompressBlocks(ibstream& infile, ostream& outfile, const HuffmanOptions& options) {
+	HuffmanStats* stats = options.stats;
+	StageTimer header(stats, &HuffmanStats::headerSeconds);
+	std::vector<BlockIndexEntry> index;
+	bool indexed = readBlockIndex(infile, index);
+
+	if (infile.readBits(8) != (unsigned char)BLOCKS_TAG) error("Not a block container.");
+	int version = int(infile.readBits(8));
+	if (version < 1 || version > BLOCKS_VERSION) {
+		error("Unsupported block container version " + integerToString(version) + ".");
+	}
+	size_t blockSize = size_t(infile.readBits(32));
+	if (infile.fail()) error("Block container header is truncated.");
+
+	if (blockSize == 0) error("Block container has a block size of zero.");
+	header.stop();
+
+	const int depth = std::max(1, options.pipelineDepth);
+	ThreadPool pool(options.numThreads);
+	const int batchSize = blocksInFlight(pool, blockSize, options.maxMemory, depth);
+	std::vector<DecompressBatch> batches(depth);
+	HuffmanStats readTimes, writeTimes;
+	size_t nextBlock = 0, blockNumber = 0;
+
+	/* The tables most recently sent, and the block that sent them. */
+	std::shared_ptr<const CachedTables> active;
+	size_t activeBlock = 0;
+	bool finished = false;
+
+	auto read = [&](int slot) {
+		DecompressBatch& batch = batches[slot];
+		std::string& frames = batch.frames;
+		std::vector<size_t>& frameStarts = batch.frameStarts;
+		std::vector<size_t>& outputStarts = batch.outputStarts;
+		StageTimer reading((stats != NULL)? &readTimes : NULL, &HuffmanStats::decodeSeconds);
+		frameStarts.assign(1, 0);
+		outputStarts.assign(1, 0);
+
+		if (indexed) {
+			size_t last = std::min(index.size(), nextBlock + size_t(batchSize));
+			for (; nextBlock < last; nextBlock++) {
+				frameStarts.push_back(frameStarts.back() + index[nextBlock].frameSize);
+				outputStarts.push_back(outputStarts.back() + index[nextBlock].length);
+			}
+			frames.resize(frameStarts.back());
+			if (infile.readBytes(&frames[0], frames.size()) != frames.size()) error("Block container is truncated.");
+			finished = nextBlock == index.size();
+			if (finished && infile.readBits(32) != 0) error("Block container is missing its terminator.");
+		} else {
+			frames.clear();
+			while (frameStarts.size() <= size_t(batchSize)) {
+				size_t start = frames.size();
+				frames.resize(start + FRAME_HEADER_SIZE);
+				if (infile.readBytes(&frames[start], 4) != 4) error("Block container is truncated.");
+				size_t length = size_t(loadBytes(&frames[start], 4));
+				if (length == 0) {
+					frames.resize(start);
+					finished = true;
+					break;
+				}
+				if (length > blockSize) error("Block is larger than the container's block size.");
+
+				if (infile.readBytes(&frames[start + 4], 5) != 5) error("Block container is truncated.");
+				uint64_t payloadSize = loadBytes(&frames[start + 4], 4);
+				if (payloadSize > maxPayloadSize(length)) error("Block frame is damaged: its payload is too large.");
+				size_t rest = size_t(payloadSize) + ((version >= 3)? CHECKSUM_SIZE : 0);
+				frames.resize(start + FRAME_HEADER_SIZE + rest);
+				if (infile.readBytes(&frames[start + FRAME_HEADER_SIZE], rest) != rest) {
+					error("Block container is truncated.");
+				}
+				frameStarts.push_back(frames.size());
+				outputStarts.push_back(outputStarts.back() + length);
+			}
+		}
+
+		batch.count = int(frameStarts.size()) - 1;
+		for (int i = 0; i < batch.count; i++) {
+			if (outputStarts[i + 1] - outputStarts[i] > blockSize) error("Block is larger than the container's block size.");
+		}
+		return !finished;
+	};
+
+	auto process = [&](int slot) {
+		DecompressBatch& batch = batches[slot];
+		const std::vector<size_t>& frameStarts = batch.frameStarts;
+		std::vector<size_t>& frameSizes = batch.frameSizes;
+		const std::vector<size_t>& outputStarts = batch.outputStarts;
+
+		StageTimer checking(stats, &HuffmanStats::decodeSeconds);
+		frameSizes.resize(batch.count);
+		pool.run(batch.count, [&](int i) {
+			frameSizes[i] = checkFrame(batch.frames.data() + frameStarts[i], frameStarts[i + 1] - frameStarts[i],
+			                           version, blockNumber + i);
+		});
+		checking.stop();
+
+		/* Tables are resolved in order, since a block may reuse the
+		 * table of any block before it.
+		 */
+		StageTimer building(stats, &HuffmanStats::treeSeconds);
+		batch.tables.resize(batch.count);
+		for (int i = 0; i < batch.count; i++, blockNumber++) {
+			const char* frame = batch.frames.data() + frameStarts[i];
+			if (frameSizes[i] < FRAME_HEADER_SIZE) error("Block index disagrees with its frame.");
+			size_t payloadSize = frameSizes[i] - FRAME_HEADER_SIZE;
+			if ((unsigned char)frame[8] == BLOCK_STORED || (unsigned char)frame[8] == BLOCK_RUNS) {
+				batch.tables[i] = NULL;
+				continue;
+			}
+			if ((unsigned char)frame[8] & BLOCK_REUSED_TABLE) {
+				if (payloadSize < 4 || active == NULL ||
+				    loadBytes(frame + FRAME_HEADER_SIZE, 4) != blockNumber - activeBlock) {
+					error("Block reuses a table that was never sent.");
+				}
+			} else {
+				imembstream payload(frame + FRAME_HEADER_SIZE, payloadSize);
+				active = loadTables(payload, options.tableCache);
+				activeBlock = blockNumber;
+			}
+			batch.tables[i] = active;
+		}
+
+		building.stop();
+
+		StageTimer decoding(stats, &HuffmanStats::decodeSeconds);
+		batch.output.resize(outputStarts.back());
+		pool.run(batch.count, [&](int i) {
+			decodeFrame(batch.frames.data() + frameStarts[i], frameSizes[i],
+			            &batch.output[0] + outputStarts[i], outputStarts[i + 1] - outputStarts[i],
+			            batch.tables[i].get());
+		});
+	};
+
+	auto write = [&](int slot) {
+		StageTimer writing((stats != NULL)? &writeTimes : NULL, &HuffmanStats::decodeSeconds);
+		outfile.write(batches[slot].output.data(), batches[slot].output.size());
+	};
+
+	runPipeline(depth, read, process, write);
+	if (stats != NULL) stats->decodeSeconds += readTimes.decodeSeconds + writeTimes.decodeSeconds;
+
+	/* Step over an index that was found, so that the whole
+	 * container has been read and the stream is left just past
+	 * it.  One that wasn't found may be damaged or missing, and
+	 * the frames alone were enough.
+	 */
+	if (indexed) {
+		std::string trailer(index.size() * INDEX_ENTRY_SIZE + TRAILER_SIZE, '\0');
+		if (infile.readBytes(&trailer[0], trailer.size()) != trailer.size()) error("Block container is truncated.");
+	}
+	infile.alignBits();
+}
+
+/* Function: verifyBlocks
+ * Usage: uint64_t length = verifyBlocks(infile);
+ * --------------------------------------------------------
+ * Steps through the frames one at a time, as decompressBlocks
+ * does without an index, building the index they ought to
+ * have, and compares it with the index at the end.  In
+ * version 3 a block's checksum, its type, and its table or
+ * the block it takes one from are all checked without
+ * decoding anything, and the payload is read in chunks, of
+ * which only the first is kept.  Earlier frames carry no
+ * checksum, so their blocks are decoded instead, into a
+ * buffer that is thrown away.  Either way a payload too large
+ * for its block is reported before it is read.
+ */
+uint64_t verifyBlocks(ibstream& infile) {
+	if (infile.readBits(8) != (unsigned char)BLOCKS_TAG) error("Not a block container.");
+	int version = int(infile.readBits(8));
+	if (version < 1 || version > BLOCKS_VERSION) {
+		error("Unsupported block container version " + integerToString(version) + ".");
+	}
+	size_t blockSize = size_t(infile.readBits(32));
+	if (infile.fail()) error("Block container header is truncated.");
+	if (blockSize == 0) error("Block container has a block size of zero.");
+
+	std::vector<BlockIndexEntry> expected;
+	uint64_t frameOffset = HEADER_SIZE, outputOffset = 0;
+	std::string frame, block, chunk(VERIFY_CHUNK_SIZE, '\0');
+	std::shared_ptr<const CachedTables> active;
+	bool sent = false;
+	size_t activeBlock = 0;
+	for (size_t blockNumber = 0; ; blockNumber++) {
+		frame.resize(FRAME_HEADER_SIZE);
+		if (infile.readBytes(&frame[0], 4) != 4) error("Block container is truncated.");
+		size_t length = size_t(loadBytes(&frame[0], 4));
+		if (length == 0) break;
+		if (length > blockSize) error("Block is larger than the container's block size.");
+
+		if (infile.readBytes(&frame[4], 5) != 5) error("Block container is truncated.");
+		uint64_t payloadSize = loadBytes(&frame[4], 4);
+		if (payloadSize > maxPayloadSize(length)) error("Block frame is damaged: its payload is too large.");
+		size_t frameSize = FRAME_HEADER_SIZE + size_t(payloadSize) + ((version >= 3)? CHECKSUM_SIZE : 0);
+
+		/* A checksummed payload is hashed a chunk at a time, and
+		 * only the first chunk, which holds any table, is kept.
+		 */
+		size_t kept = (version >= 3)? std::min(size_t(payloadSize), VERIFY_CHUNK_SIZE) : size_t(payloadSize);
+		frame.resize(FRAME_HEADER_SIZE + kept);
+		if (kept != 0 && infile.readBytes(&frame[FRAME_HEADER_SIZE], kept) != kept) error("Block container is truncated.");
+		if (version >= 3) {
+			uint32_t checksum = crc32c(0, frame.data(), frame.size());
+			for (size_t done = kept; done < payloadSize; ) {
+				size_t count = std::min(size_t(payloadSize) - done, VERIFY_CHUNK_SIZE);
+				if (infile.readBytes(&chunk[0], count) != count) error("Block container is truncated.");
+				checksum = crc32c(checksum, chunk.data(), count);
+				done += count;
+			}
+			char stored[CHECKSUM_SIZE];
+			if (infile.readBytes(stored, CHECKSUM_SIZE) != CHECKSUM_SIZE) error("Block container is truncated.");
+			if (checksum != uint32_t(loadBytes(stored, 4))) {
+				error("Block " + integerToString(int(blockNumber)) + " fails its checksum.");
+			}
+		}
+
+		int type = (unsigned char)frame[8];
+		int coding = type & ~BLOCK_REUSED_TABLE;
+		if (type == BLOCK_STORED) {
+			if (payloadSize != length) error("Stored block is not the size its frame says.");
+		} else if (type != BLOCK_RUNS) {
+			if (coding != BLOCK_HUFFMAN && coding != BLOCK_INTERLEAVED) {
+				error("Unknown block type " + integerToString(type) + ".");
+			}
+			if (type & BLOCK_REUSED_TABLE) {
+				if (payloadSize < 4 || !sent || loadBytes(&frame[FRAME_HEADER_SIZE], 4) != blockNumber - activeBlock) {
+					error("Block reuses a table that was never sent.");
+				}
+			} else {
+				imembstream payload(frame.data() + FRAME_HEADER_SIZE, kept);
+				if (version >= 3) {
+					EncodeTable codes;
+					readCodeLengths(payload, codes);
+				} else {
+					active = loadTables(payload, NULL);
+				}
+				sent = true;
+				activeBlock = blockNumber;
+			}
+		}
+		if (version < 3) {
+			block.resize(length);
+			decodeFrame(frame.data(), frame.size(), &block[0], length,
+			            (type == BLOCK_STORED || type == BLOCK_RUNS)? NULL : active.get());
+		}
+
+		BlockIndexEntry entry = {frameOffset, outputOffset, uint32_t(length), uint32_t(frameSize)};
+		expected.push_back(entry);
+		frameOffset += frameSize;
+		outputOffset += length;
+	}
+
+	if (version >= 2) {
+		std::string trailer(expected.size() * INDEX_ENTRY_SIZE + TRAILER_SIZE, '\0');
+		if (infile.readBytes(&trailer[0], trailer.size()) != trailer.size()) error("Block container is truncated.");
+		for (size_t i = 0; i < expected.size(); i++) {
+			const char* data = trailer.data() + i * INDEX_ENTRY_SIZE;
+			if (loadBytes(data, 8) != expected[i].frameOffset || loadBytes(data + 8, 8) != expected[i].outputOffset ||
+			    loadBytes(data + 16, 4) != expected[i].length) {
+				error("Block index disagrees with the frames.");
+			}
+		}
+		const char* tail = trailer.data() + expected.size() * INDEX_ENTRY_SIZE;
+		if (loadBytes(tail, 4) != expected.size() || loadBytes(tail + 4, 8) != frameOffset + 4 ||
+		    loadBytes(tail + 12, 4) != INDEX_MAGIC) {
+			error("Block index trailer is damaged.");
+		}
+	}
+	infile.alignBits();
+	return outputOffset;
+}
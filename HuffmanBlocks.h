@@ -0,0 +1,175 @@
+/**********************************************************
+ * File: HuffmanBlocks.h
+ *
+ * The block container format (FORMAT_BLOCKS).  The input is
+ * cut into fixed-size blocks, and each block is counted,
+ * given its own canonical code and encoded independently,
+ * which lets blocks be handled on separate threads.
+ *
+ * Layout (multi-byte fields are little-endian):
+ *
+ *   BLOCKS_TAG          1 byte
+ *   version             1 byte
+ *   block size          4 bytes
+ *   frames, one per block:
+ *     uncompressed size 4 bytes   (0 ends the list of frames)
+ *     payload size      4 bytes
+ *     block type        1 byte    (a BlockType)
+ *     payload           payload size bytes
+ *     checksum          4 bytes   (from version 3 on: the
+ *                                 CRC-32C of the fields
+ *                                 above; see Crc32c.h)
+ *   index, one entry per block (from version 2 on):
+ *     frame offset      8 bytes
+ *     output offset     8 bytes
+ *     uncompressed size 4 bytes
+ *   block count         4 bytes
+ *   index offset        8 bytes
+ *   index magic         4 bytes   ("HIDX")
+ *
+ * Offsets are measured from the BLOCKS_TAG byte.  The frame
+ * sizes let a reader step from block to block without
+ * decoding any of them, and the fixed-size trailer lets a
+ * reader that can seek find the index without reading the
+ * frames at all.  The checksums let every frame be checked
+ * before it is decoded, so damage is reported as such rather
+ * than decoded into garbage.
+ */
+
+#ifndef HuffmanBlocks_Included
+#define HuffmanBlocks_Included
+
+#include <vector>
+#include "HuffmanEncoding.h"
+
+/* Type: BlockIndexEntry
+ * Where one block lives in the container and in the output.
+ */
+struct BlockIndexEntry {
+	/* Offset of the block's frame from the BLOCKS_TAG byte. */
+	uint64_t frameOffset;
+
+	/* Offset of the block's first byte in the decompressed data. */
+	uint64_t outputOffset;
+
+	/* The block's uncompressed size. */
+	uint32_t length;
+
+	/* The size of the whole frame, header and checksum
+	 * included.  This is not stored in the index; readers work
+	 * it out from where the next frame starts.
+	 */
+	uint32_t frameSize;
+};
+
+/* Type: BlockType
+ * How the payload of a frame is coded.
+ */
+enum BlockType {
+	/* A code length table (see writeCodeLengths) followed by the
+	 * block's codes and the code for PSEUDO_EOF.
+	 */
+	BLOCK_HUFFMAN = 0,
+
+	/* A code length table, padded to a byte, followed by the
+	 * block split into sub-streams by encodeInterleaved.
+	 */
+	BLOCK_INTERLEAVED = 1,
+
+	/* The block's bytes as they are, for data no code would
+	 * shrink.
+	 */
+	BLOCK_STORED = 2,
+
+	/* The block as runs of equal bytes, each the byte followed
+	 * by the run's length in 7-bit groups, low group first, the
+	 * top bit of each byte set if another group follows.  A
+	 * block of one repeated byte takes a few bytes and decodes
+	 * with a memset.
+	 */
+	BLOCK_RUNS = 3,
+
+	/* A flag added to the types above.  Instead of a code length
+	 * table, the payload starts with a 4-byte distance d, and
+	 * the block is coded with the table of the block d places
+	 * before it, which is always the last block that sent one.
+	 */
+	BLOCK_REUSED_TABLE = 0x80
+};
+
+/* Function: compressBlocks
+ * Usage: compressBlocks(infile, outfile, options);
+ * --------------------------------------------------------
+ * Writes infile to outfile in FORMAT_BLOCKS, reading the
+ * input exactly once and never seeking either stream.
+ * Blocks are read in batches of one per thread (fewer if
+ * options.maxMemory says so) and encoded in parallel; frames
+ * are written in input order.  If options.reuseTables is set,
+ * a block whose data costs fewer bits under the last table
+ * sent than under its own table plus that table's header
+ * reuses the last table instead of sending one.  A block
+ * that no table would make smaller is stored as it is, and
+ * one made of long runs of equal bytes is sent as the runs.
+ */
+void compressBlocks(istream& infile, obstream& outfile, const HuffmanOptions& options);
+
+/* Function: decompressBlocks
+ * Usage: decompressBlocks(infile, outfile, options);
+ * --------------------------------------------------------
+ * Decodes a FORMAT_BLOCKS file written by compressBlocks,
+ * decoding batches of blocks in parallel on the threads and
+ * within the memory options allow.  When infile can seek,
+ * the index is loaded up front and each batch is fetched
+ * with a single read and decoded straight to its output
+ * offsets, and the index is stepped over at the end;
+ * otherwise frames are discovered one at a time.  Reports an
+ * error if the file is damaged or truncated.
+ */
+void decompressBlocks(ibstream& infile, ostream& outfile, const HuffmanOptions& options);
+
+/* Function: verifyBlocks
+ * Usage: uint64_t length = verifyBlocks(infile);
+ * --------------------------------------------------------
+ * Checks a FORMAT_BLOCKS file without writing its data
+ * anywhere: every frame's checksum and fields, the tables
+ * blocks send or reuse, the terminator and the index.
+ * Returns the length the file decompresses to, leaving
+ * infile just past the container.  Reports an error for the
+ * first problem found.  Reads the stream front to back, so
+ * infile need not be able to seek.
+ */
+uint64_t verifyBlocks(ibstream& infile);
+
+/* Function: readBlockIndex
+ * Usage: if (readBlockIndex(infile, index)) { ... }
+ * --------------------------------------------------------
+ * Loads the index of the block container starting at the
+ * current position of infile, leaving the stream where it
+ * was.  Returns false if the stream can't seek or the
+ * container has no index.  Must be called before any bits
+ * are read from the container.
+ */
+bool readBlockIndex(ibstream& infile, std::vector<BlockIndexEntry>& index);
+
+/* Function: decompressBlockRange
+ * Usage: if (decompressBlockRange(infile, offset, length, outfile, options, written)) { ... }
+ * --------------------------------------------------------
+ * Writes the length bytes starting at offset of what
+ * decompressBlocks would write, decoding only the blocks that
+ * hold them, and sets written to how many there were, fewer
+ * if the data ends first.  Returns false without reading
+ * anything if infile can't seek or the container has no
+ * index.  Leaves infile at an unspecified position.
+ */
+bool decompressBlockRange(ibstream& infile, uint64_t offset, uint64_t length, ostream& outfile,
+                          const HuffmanOptions& options, uint64_t& written);
+
+/* Function: maxBlocksSize
+ * Usage: size_t bound = maxBlocksSize(length, options);
+ * --------------------------------------------------------
+ * An upper bound on the size of the container compressBlocks
+ * writes for length bytes of input.
+ */
+size_t maxBlocksSize(size_t length, const HuffmanOptions& options);
+
+#endif
@@ -0,0 +1,579 @@
+/**********************************************************
+ * File: HuffmanCli.cpp
+ *
+ * A command-line front end for the Huffman encoder:
+ *
+ *   huff c [options] [FILE...]          compress each FILE to FILE.huf
+ *   huff d [options] [FILE...]          decompress each FILE.huf to FILE
+ *   huff verify [options] FILE.huf...   check each FILE.huf without
+ *                                       writing (t for short)
+ *   huff bench [options] FILE...        compress and decompress each
+ *                                       FILE in memory, check that it
+ *                                       round-trips, and time both
+ *
+ * With no FILE, or a FILE of "-", c and d read standard input
+ * and write standard output, so the tool can sit in a pipe;
+ * standard input is always compressed in the block format,
+ * the only one that needs no second pass over the input.
+ * Patterns such as "*.txt" are expanded even when the
+ * shell didn't.  Files are processed several at once on a
+ * thread pool, and a summary of the total bytes and
+ * throughput is printed at the end.
+ *
+ * Options:
+ *
+ *   -f FORMAT  frequencies, canonical, counted, context or blocks
+ *              (default blocks)
+ *   -j N       how many files to work on at once (default one
+ *              per core)
+ *   -t N       threads per file for the block format (default
+ *              one per core for a single file, otherwise 1)
+ *   -p N       batches of blocks in flight per file, so that
+ *              reading and writing overlap the coding (default
+ *              3 for a single file, otherwise 1)
+ *   -o FILE    where to write, for c and d with one input
+ *   -F         overwrite output files that already exist
+ *   -q         print only the summary and any failures
+ *
+ * This is a program of its own: build it from the other
+ * sources in place of HuffmanEncodingTest.cpp.  The exit
+ * status is 0 if every file succeeded, 1 if any failed and
+ * 2 for a bad command line.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <glob.h>
+#include <unistd.h>
+#endif
+#include "bstream.h"
+#include "error.h"
+#include "strlib.h"
+#include "HuffmanEncoding.h"
+#include "HuffmanStats.h"
+#include "ThreadPool.h"
+using namespace std;
+
+/* Constant: SUFFIX
+ * What c adds to a file name and d takes away.
+ */
+static const string SUFFIX = ".huf";
+
+/* Type: Command
+ * What the tool was asked to do.
+ */
+enum Command {
+	COMPRESS_FILES,
+	DECOMPRESS_FILES,
+	VERIFY_FILES,
+	BENCH_FILES
+};
+
+/* Type: Settings
+ * The parsed command line.
+ */
+struct Settings {
+	Command command;
+	HuffmanOptions options;
+	int jobs, threads, depth;
+	string output;
+	bool force, quiet;
+	vector<string> files;
+};
+
+/* Type: FileResult
+ * How one file went.  Only the worker handling the file
+ * touches it, so results need no locking.
+ */
+struct FileResult {
+	uint64_t bytesIn, bytesOut;
+	double compressSeconds, decompressSeconds;
+	string failure;
+
+	FileResult() : bytesIn(0), bytesOut(0), compressSeconds(0), decompressSeconds(0) {}
+};
+
+/* Function: usage
+ * --------------------------------------------------------
+ * Prints how to call the tool and exits with status 2.
+ */
+static void usage(const char* program) {
+	cerr << "Usage: " << program << " c|d|verify|t|bench [-f FORMAT] [-j N] [-t N] [-p N] [-o FILE] [-F] [-q] [FILE...]" << endl;
+	exit(2);
+}
+
+/* Function: secondsSince
+ * --------------------------------------------------------
+ * Wall-clock seconds from start until now.
+ */
+static double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/* Function: hasWildcards
+ * --------------------------------------------------------
+ * Whether name is a pattern for expandPattern.
+ */
+static bool hasWildcards(const string& name) {
+	return name.find_first_of("*?[") != string::npos;
+}
+
+/* Function: expandPattern
+ * --------------------------------------------------------
+ * Adds the files matching pattern to files, or the pattern
+ * itself if nothing matches, so that it is reported as a file
+ * that can't be opened.
+ */
+static void expandPattern(const string& pattern, vector<string>& files) {
+#if !defined(_WIN32)
+	if (hasWildcards(pattern)) {
+		glob_t matches;
+		if (glob(pattern.c_str(), 0, NULL, &matches) == 0) {
+			for (size_t i = 0; i < matches.gl_pathc; i++) {
+				files.push_back(matches.gl_pathv[i]);
+			}
+			globfree(&matches);
+			return;
+		}
+		globfree(&matches);
+	}
+#endif
+	files.push_back(pattern);
+}
+
+/* Function: parseFormat
+ * --------------------------------------------------------
+ * Turns the argument of -f into a format, or returns false.
+ */
+static bool parseFormat(const string& name, HuffmanFormat& format) {
+	if (name == "frequencies") format = FORMAT_FREQUENCIES;
+	else if (name == "canonical") format = FORMAT_CANONICAL;
+	else if (name == "counted") format = FORMAT_COUNTED;
+	else if (name == "context") format = FORMAT_CONTEXT;
+	else if (name == "blocks") format = FORMAT_BLOCKS;
+	else return false;
+	return true;
+}
+
+/* Function: parseSettings
+ * --------------------------------------------------------
+ * Reads the command line, exiting through usage on anything
+ * it doesn't understand.
+ */
+static Settings parseSettings(int argc, char** argv) {
+	if (argc < 2) usage(argv[0]);
+	Settings settings;
+	string command = argv[1];
+	if (command == "c") settings.command = COMPRESS_FILES;
+	else if (command == "d") settings.command = DECOMPRESS_FILES;
+	else if (command == "verify" || command == "t") settings.command = VERIFY_FILES;
+	else if (command == "bench") settings.command = BENCH_FILES;
+	else usage(argv[0]);
+
+	settings.options.format = FORMAT_BLOCKS;
+	settings.jobs = 0;
+	settings.threads = settings.depth = -1;
+	settings.force = settings.quiet = false;
+	for (int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		bool takesValue = arg == "-f" || arg == "-j" || arg == "-t" || arg == "-p" || arg == "-o";
+		if (takesValue && i + 1 == argc) usage(argv[0]);
+		if (arg == "-f") {
+			if (!parseFormat(argv[++i], settings.options.format)) usage(argv[0]);
+		} else if (arg == "-j") {
+			settings.jobs = atoi(argv[++i]);
+		} else if (arg == "-t") {
+			settings.threads = atoi(argv[++i]);
+		} else if (arg == "-p") {
+			settings.depth = atoi(argv[++i]);
+		} else if (arg == "-o") {
+			settings.output = argv[++i];
+		} else if (arg == "-F") {
+			settings.force = true;
+		} else if (arg == "-q") {
+			settings.quiet = true;
+		} else if (arg.size() > 1 && arg[0] == '-') {
+			usage(argv[0]);
+		} else {
+			expandPattern(arg, settings.files);
+		}
+	}
+
+	bool filters = settings.command == COMPRESS_FILES || settings.command == DECOMPRESS_FILES;
+	if (settings.files.empty()) {
+		if (!filters) usage(argv[0]);
+		settings.files.push_back("-");
+	}
+	if (!settings.output.empty() && (!filters || settings.files.size() != 1)) usage(argv[0]);
+	if (settings.jobs < 0 || settings.threads < -1) usage(argv[0]);
+	return settings;
+}
+
+/* Function: outputName
+ * --------------------------------------------------------
+ * Where c or d writes the given input: the -o file if there
+ * is one, "-" for standard output if the input is standard
+ * input, and otherwise the input's name with SUFFIX added or
+ * taken off.  A file d is given without the suffix gets
+ * ".out" added instead.
+ */
+static string outputName(const Settings& settings, const string& input) {
+	if (!settings.output.empty()) return settings.output;
+	if (input == "-") return "-";
+	if (settings.command == COMPRESS_FILES) return input + SUFFIX;
+	if (input.size() > SUFFIX.size() && input.compare(input.size() - SUFFIX.size(), SUFFIX.size(), SUFFIX) == 0) {
+		return input.substr(0, input.size() - SUFFIX.size());
+	}
+	return input + ".out";
+}
+
+/* Function: fileExists
+ * --------------------------------------------------------
+ * Whether name can be opened for reading.
+ */
+static bool fileExists(const string& name) {
+	ifstream probe(name.c_str());
+	return probe.is_open();
+}
+
+/* Function: temporaryName
+ * --------------------------------------------------------
+ * Creates an empty file beside output, under a name no other
+ * file has, and returns the name.  Being in the same directory
+ * lets it be renamed over output once it is complete.
+ */
+static string temporaryName(const string& output) {
+	static atomic<int> counter(0);
+	while (true) {
+		string name = output + ".tmp" + integerToString(counter++);
+#if !defined(_WIN32)
+		int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if (fd >= 0) {
+			close(fd);
+			return name;
+		}
+		if (errno != EEXIST) error("Can't write " + output + ".");
+#else
+		if (!fileExists(name)) return name;
+#endif
+	}
+}
+
+/* Function: replaceFile
+ * --------------------------------------------------------
+ * Renames from to to, replacing any file already there.
+ */
+static bool replaceFile(const string& from, const string& to) {
+#if defined(_WIN32)
+	remove(to.c_str());
+#endif
+	return rename(from.c_str(), to.c_str()) == 0;
+}
+
+/* Class: CountingInput
+ * ---------------------------------------------------------
+ * Reads another buffer, such as that of cin, through a block
+ * of its own and reports how far it has read, so HuffmanStats
+ * can measure a pipe.  Seeks within the block it holds also
+ * work, which is all alignBits needs.
+ */
+class CountingInput: public streambuf {
+public:
+	explicit CountingInput(streambuf* source) : source(source), consumed(0) {
+		setg(block, block, block);
+	}
+
+protected:
+	virtual int_type underflow() {
+		consumed += egptr() - eback();
+		streamsize count = source->sgetn(block, sizeof block);
+		setg(block, block, block + max(count, streamsize(0)));
+		return (count <= 0)? traits_type::eof() : traits_type::to_int_type(block[0]);
+	}
+
+	virtual pos_type seekoff(off_type offset, ios::seekdir dir, ios::openmode which) {
+		if (dir != ios::cur) return pos_type(off_type(-1));
+		return seekpos(pos_type(off_type(consumed + (gptr() - eback()) + offset)), which);
+	}
+
+	virtual pos_type seekpos(pos_type pos, ios::openmode) {
+		off_type target = off_type(pos) - off_type(consumed);
+		if (target < 0 || target > egptr() - eback()) return pos_type(off_type(-1));
+		setg(eback(), eback() + target, egptr());
+		return pos;
+	}
+
+private:
+	streambuf* source;
+	uint64_t consumed;
+	char block[1 << 16];
+};
+
+/* Class: CountingOutput
+ * ---------------------------------------------------------
+ * Passes everything written to another buffer, such as that
+ * of cout, and reports how much has gone through it.
+ */
+class CountingOutput: public streambuf {
+public:
+	explicit CountingOutput(streambuf* sink) : sink(sink), written(0) {}
+
+protected:
+	virtual int_type overflow(int_type ch) {
+		if (traits_type::eq_int_type(ch, traits_type::eof())) return traits_type::not_eof(ch);
+		if (traits_type::eq_int_type(sink->sputc(traits_type::to_char_type(ch)), traits_type::eof())) {
+			return traits_type::eof();
+		}
+		written++;
+		return ch;
+	}
+
+	virtual streamsize xsputn(const char* data, streamsize count) {
+		streamsize done = sink->sputn(data, count);
+		written += max(done, streamsize(0));
+		return done;
+	}
+
+	virtual int sync() {
+		return sink->pubsync();
+	}
+
+	virtual pos_type seekoff(off_type offset, ios::seekdir dir, ios::openmode which) {
+		if (offset != 0 || dir != ios::cur || !(which & ios::out)) return pos_type(off_type(-1));
+		return pos_type(off_type(written));
+	}
+
+private:
+	streambuf* sink;
+	uint64_t written;
+};
+
+/* Function: convertFile
+ * --------------------------------------------------------
+ * Compresses or decompresses one file (or standard input),
+ * counting its bytes with HuffmanStats.  Only the block
+ * format can be written without seeking back over the input,
+ * so standard input is always compressed in that format.  The
+ * input is opened before anything is written, and a file is
+ * written under a temporary name that replaces the output
+ * only once it is complete, so a failure leaves no partial
+ * output and never touches a file already there, even when
+ * it is the input itself.
+ */
+static void convertFile(const Settings& settings, const HuffmanOptions& options,
+                        const string& input, FileResult& result) {
+	string output = outputName(settings, input);
+	if (output != "-" && !settings.force && fileExists(output)) {
+		error(output + " already exists (use -F to overwrite it).");
+	}
+
+	imapbstream mapped;
+	if (input != "-") {
+		mapped.open(input.c_str());
+		if (!mapped.is_open()) error("Can't read " + input + ".");
+	}
+
+	HuffmanStats stats;
+	HuffmanOptions measured = options;
+	measured.stats = &stats;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	CountingOutput counted(cout.rdbuf());
+	ostream screen(&counted);
+	ofstream file;
+	string temporary;
+	if (output != "-") {
+		temporary = temporaryName(output);
+		file.open(temporary.c_str(), ios::out | ios::binary | ios::trunc);
+		if (!file.is_open()) {
+			remove(temporary.c_str());
+			error("Can't write " + output + ".");
+		}
+	}
+	ostream& sink = (output == "-")? screen : file;
+
+	try {
+		if (settings.command == COMPRESS_FILES) {
+			ostreambstream packed(sink);
+			if (input == "-") {
+				compressStream(cin, packed, measured);
+			} else {
+				compress(mapped, packed, measured);
+			}
+			packed.flushBits();
+			if (!packed) error("Can't write " + output + ".");
+		} else {
+			CountingInput counting(cin.rdbuf());
+			istream keyboard(&counting);
+			istreambstream piped(keyboard);
+			decompress((input == "-")? (ibstream&)piped : (ibstream&)mapped, sink, measured);
+		}
+		sink.flush();
+		if (!sink) error("Can't write " + output + ".");
+		if (!temporary.empty()) {
+			file.close();
+			if (file.fail() || !replaceFile(temporary, output)) error("Can't write " + output + ".");
+		}
+	} catch (...) {
+		if (!temporary.empty()) {
+			file.close();
+			remove(temporary.c_str());
+		}
+		throw;
+	}
+
+	double seconds = secondsSince(start);
+	result.bytesIn = stats.bytesIn;
+	result.bytesOut = stats.bytesOut;
+	if (settings.command == COMPRESS_FILES) result.compressSeconds = seconds;
+	else result.decompressSeconds = seconds;
+}
+
+/* Function: roundTripFile
+ * --------------------------------------------------------
+ * Compresses one file into memory, decompresses it again,
+ * and checks that the result is the file, timing each half
+ * for bench.
+ */
+static void roundTripFile(const HuffmanOptions& options, const string& input, FileResult& result) {
+	imapbstream mapped(input.c_str());
+	if (!mapped.is_open()) error("Can't read " + input + ".");
+	const char* data = mapped.data();
+	size_t length = mapped.length();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<char> packed(maxCompressedSize(length, options));
+	size_t packedSize = compressBuffer(data, length, &packed[0], packed.size(), options);
+	result.compressSeconds = secondsSince(start);
+
+	start = chrono::steady_clock::now();
+	vector<char> unpacked(length + 1);
+	size_t unpackedSize = decompressBuffer(&packed[0], packedSize, &unpacked[0], unpacked.size(), options);
+	result.decompressSeconds = secondsSince(start);
+
+	result.bytesIn = length;
+	result.bytesOut = packedSize;
+	if (unpackedSize != length || (length != 0 && memcmp(&unpacked[0], data, length) != 0)) {
+		error("Decompressed data doesn't match the file.");
+	}
+}
+
+/* Function: verifyFile
+ * --------------------------------------------------------
+ * Checks one compressed file with verify, which for the block
+ * format reads the checksums rather than decoding the blocks.
+ */
+static void verifyFile(const HuffmanOptions& options, const string& input, FileResult& result) {
+	imapbstream mapped(input.c_str());
+	if (!mapped.is_open()) error("Can't read " + input + ".");
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	result.bytesOut = verify(mapped, options);
+	result.decompressSeconds = secondsSince(start);
+	result.bytesIn = mapped.length();
+}
+
+/* Function: rate
+ * --------------------------------------------------------
+ * Bytes over seconds in MB/s, or 0 if no time was measured.
+ */
+static double rate(uint64_t bytes, double seconds) {
+	return (seconds > 0)? bytes / seconds / 1e6 : 0;
+}
+
+/* Function: main
+ * --------------------------------------------------------
+ * Works through the files on a pool of settings.jobs threads,
+ * then prints a line per file and a summary.  When data goes
+ * to standard output the report goes to standard error.
+ */
+int main(int argc, char** argv) {
+	Settings settings = parseSettings(argc, argv);
+
+	bool piped = false;
+	for (size_t i = 0; i < settings.files.size(); i++) {
+		if (outputName(settings, settings.files[i]) == "-") piped = true;
+	}
+	ostream& report = (piped && settings.command != VERIFY_FILES && settings.command != BENCH_FILES)? cerr : cout;
+
+	/* Standard input and output can't be shared, and files
+	 * already run in parallel get one thread each, and no
+	 * pipeline, unless -t and -p say otherwise.
+	 */
+	int jobs = piped? 1 : settings.jobs;
+	ThreadPool pool(jobs);
+	HuffmanOptions options = settings.options;
+	bool shared = pool.size() > 1 && settings.files.size() > 1;
+	options.numThreads = (settings.threads >= 0)? settings.threads : shared? 1 : 0;
+	options.pipelineDepth = (settings.depth >= 0)? settings.depth : shared? 1 : 3;
+
+	vector<FileResult> results(settings.files.size());
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	pool.run(int(settings.files.size()), [&](int i) {
+		try {
+			if (settings.command == COMPRESS_FILES || settings.command == DECOMPRESS_FILES) {
+				convertFile(settings, options, settings.files[i], results[i]);
+			} else if (settings.command == VERIFY_FILES) {
+				verifyFile(options, settings.files[i], results[i]);
+			} else {
+				roundTripFile(options, settings.files[i], results[i]);
+			}
+		} catch (ErrorException& e) {
+			results[i].failure = e.what();
+		} catch (exception& e) {
+			results[i].failure = e.what();
+		}
+	});
+	double elapsed = secondsSince(start);
+
+	uint64_t totalIn = 0, totalOut = 0;
+	double compressSeconds = 0, decompressSeconds = 0;
+	int failures = 0;
+	for (size_t i = 0; i < settings.files.size(); i++) {
+		const FileResult& result = results[i];
+		const string& name = (settings.files[i] == "-")? string("(stdin)") : settings.files[i];
+		if (!result.failure.empty()) {
+			cerr << name << ": " << result.failure << endl;
+			failures++;
+			continue;
+		}
+		totalIn += result.bytesIn;
+		totalOut += result.bytesOut;
+		compressSeconds += result.compressSeconds;
+		decompressSeconds += result.decompressSeconds;
+		if (settings.quiet) continue;
+
+		report << name << ": " << result.bytesIn << " -> " << result.bytesOut << " bytes";
+		if (settings.command == BENCH_FILES) {
+			report << ", compress " << rate(result.bytesIn, result.compressSeconds) << " MB/s, decompress "
+			       << rate(result.bytesIn, result.decompressSeconds) << " MB/s";
+		} else if (settings.command == VERIFY_FILES) {
+			report << ", ok";
+		}
+		report << endl;
+	}
+
+	/* Throughput is always measured in uncompressed bytes. */
+	bool unpacking = settings.command == DECOMPRESS_FILES || settings.command == VERIFY_FILES;
+	uint64_t original = unpacking? totalOut : totalIn;
+	int succeeded = int(settings.files.size()) - failures;
+	report << succeeded << " of " << settings.files.size() << " files, " << totalIn << " -> " << totalOut
+	       << " bytes in " << elapsed << " s (" << rate(original, elapsed) << " MB/s overall";
+	if (settings.command == BENCH_FILES) {
+		report << "; compress " << rate(original, compressSeconds) << " MB/s, decompress "
+		       << rate(original, decompressSeconds) << " MB/s per thread";
+	}
+	report << ")" << endl;
+	return (failures == 0)? 0 : 1;
+}
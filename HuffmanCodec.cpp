@@ -0,0 +1,195 @@
+/**********************************************************
+ * File: HuffmanCodec.cpp
+ *
+ * Implementation of Encoder and Decoder.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include "HuffmanCodec.h"
+#include "HuffmanStats.h"
+#include "error.h"
+using namespace std;
+
+/* Class: VectorSink
+ * --------------------------------------------------------
+ * A stream buffer that appends to a vector<char>, so that a
+ * vector that is cleared and reused keeps its capacity.  It
+ * reports its position (but can't move) so that stats can see
+ * how much was written.
+ */
+class VectorSink: public streambuf {
+public:
+	explicit VectorSink(vector<char>& target) : target(target) {}
+
+protected:
+	virtual int_type overflow(int_type ch) {
+		if (ch != traits_type::eof()) target.push_back(char(ch));
+		return traits_type::not_eof(ch);
+	}
+
+	virtual streamsize xsputn(const char* data, streamsize count) {
+		target.insert(target.end(), data, data + count);
+		return count;
+	}
+
+	virtual pos_type seekoff(off_type offset, ios_base::seekdir way, ios_base::openmode) {
+		if (offset != 0 || way != ios_base::cur) return pos_type(off_type(-1));
+		return pos_type(off_type(target.size()));
+	}
+
+private:
+	vector<char>& target;
+};
+
+/* Function: longestCodeIn
+ * --------------------------------------------------------
+ * Returns the longest code in table, reporting an error if
+ * any symbol has none.
+ */
+static size_t longestCodeIn(const EncodeTable& table) {
+	size_t longest = 0;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		if (table.lengths[ch] == 0) error("Encoder tables must give every byte a code.");
+		longest = max(longest, size_t(table.lengths[ch]));
+	}
+	return longest;
+}
+
+/* Constructor: Encoder
+ * --------------------------------------------------------
+ * The streams start out empty and are pointed at each call's
+ * spans in turn.
+ */
+Encoder::Encoder(const HuffmanOptions& options)
+	: settings(options), longestCode(0), input(NULL, 0), output(NULL, 0) {
+}
+
+Encoder::Encoder(const HuffmanOptions& options, const shared_ptr<const CachedTables>& tables)
+	: settings(options), fixed(tables), longestCode(0), input(NULL, 0), output(NULL, 0) {
+	if (fixed) longestCode = longestCodeIn(fixed->encodeTable);
+}
+
+/* Function: train
+ * Usage: shared_ptr<const CachedTables> tables = Encoder::train(sample, length, 0);
+ * --------------------------------------------------------
+ * Counts as trainDictionary does, adding one to every count.
+ */
+shared_ptr<const CachedTables> Encoder::train(const char* sample, size_t length, int maxCodeLength) {
+	uint64_t counts[256] = {0};
+	countFrequencies((const unsigned char*)sample, length, counts);
+	uint64_t weights[NUM_SYMBOLS];
+	for (int ch = 0; ch < 256; ch++) {
+		weights[ch] = counts[ch] + 1;
+	}
+	weights[PSEUDO_EOF] = 1;
+
+	shared_ptr<CachedTables> tables = make_shared<CachedTables>();
+	buildCanonicalTable(weights, maxCodeLength, tables->encodeTable);
+	buildDecodeTable(tables->encodeTable, tables->decodeTable);
+	return tables;
+}
+
+const HuffmanOptions& Encoder::options() const {
+	return settings;
+}
+
+shared_ptr<const CachedTables> Encoder::tables() const {
+	return fixed;
+}
+
+/* Member function: maxCompressedSize
+ * --------------------------------------------------------
+ * With fixed tables the file is a canonical header and at
+ * most the longest code per byte, PSEUDO_EOF included.
+ */
+size_t Encoder::maxCompressedSize(size_t length) const {
+	if (!fixed) return ::maxCompressedSize(length, settings);
+	return 1 + NUM_SYMBOLS + 1 + (longestCode * (length + 1) + 7) / 8;
+}
+
+/* Member function: compress
+ * Usage: size_t used = encoder.compress(data, length, buffer, capacity);
+ * --------------------------------------------------------
+ * Without fixed tables this is compressBuffer on the kept
+ * streams.  With them it writes what compress would in
+ * FORMAT_CANONICAL, had it built the same tables.
+ */
+size_t Encoder::compress(const char* source, size_t length, char* dest, size_t capacity) {
+	input.reset(source, length);
+	output.reset(dest, capacity);
+	if (!fixed) {
+		::compress(input, output, settings);
+	} else {
+		StageTimer header(settings.stats, &HuffmanStats::headerSeconds);
+		output.writeBits(CANONICAL_TAG, 8);
+		writeCodeLengths(output, fixed->encodeTable);
+		header.stop();
+
+		StageTimer encoding(settings.stats, &HuffmanStats::encodeSeconds);
+		encodeBytes(source, length, fixed->encodeTable, output);
+		output.writeBits(fixed->encodeTable.codes[PSEUDO_EOF], fixed->encodeTable.lengths[PSEUDO_EOF]);
+		output.flushBits();
+		encoding.stop();
+	}
+	size_t used = output.length();
+	if (!output) error("Output buffer is too small for the compressed data.");
+	if (fixed && settings.stats != NULL) {
+		settings.stats->bytesIn += length;
+		settings.stats->bytesOut += used;
+	}
+	return used;
+}
+
+/* Member function: compress
+ * Usage: encoder.compress(data, length, output);
+ * --------------------------------------------------------
+ * Sizes the vector for the worst case, then trims it; neither
+ * step gives up capacity the vector already has.
+ */
+void Encoder::compress(const char* source, size_t length, vector<char>& dest) {
+	dest.resize(maxCompressedSize(length));
+	dest.resize(compress(source, length, &dest[0], dest.size()));
+}
+
+/* Constructor: Decoder
+ * --------------------------------------------------------
+ * Points the options at the decoder's own cache unless they
+ * already name one.
+ */
+Decoder::Decoder(const HuffmanOptions& options)
+	: settings(options), ownCache(OWN_CACHE_CAPACITY), input(NULL, 0), output(NULL, 0) {
+	if (settings.tableCache == NULL) settings.tableCache = &ownCache;
+}
+
+const HuffmanOptions& Decoder::options() const {
+	return settings;
+}
+
+/* Member function: decompress
+ * Usage: size_t used = decoder.decompress(data, length, buffer, capacity);
+ * --------------------------------------------------------
+ * decompressBuffer on the kept streams.
+ */
+size_t Decoder::decompress(const char* source, size_t length, char* dest, size_t capacity) {
+	input.reset(source, length);
+	output.reset(dest, capacity);
+	::decompress(input, output, settings);
+	size_t used = output.length();
+	if (!output) error("Output buffer is too small for the decompressed data.");
+	return used;
+}
+
+/* Member function: decompress
+ * Usage: decoder.decompress(data, length, output);
+ * --------------------------------------------------------
+ * The decompressed size isn't known in advance, so the output
+ * is appended to the cleared vector as it is decoded.
+ */
+void Decoder::decompress(const char* source, size_t length, vector<char>& dest) {
+	dest.clear();
+	VectorSink sink(dest);
+	ostream sinkStream(&sink);
+	input.reset(source, length);
+	::decompress(input, sinkStream, settings);
+}
@@ -0,0 +1,153 @@
+/**********************************************************
+ * File: HuffmanCodec.h
+ *
+ * Reusable compressor and decompressor objects.  The free
+ * functions in HuffmanEncoding.h set up their streams and
+ * tables from scratch on every call; an Encoder or Decoder
+ * keeps them between calls, so a worker that handles many
+ * small requests pays for them once.
+ *
+ * An Encoder or Decoder is used by one thread at a time, so
+ * give each worker its own.  What they share is immutable:
+ * the CachedTables an Encoder may be built with, and the
+ * tables a TableCache hands out, can be used by any number
+ * of threads at once.
+ */
+
+#ifndef HuffmanCodec_Included
+#define HuffmanCodec_Included
+
+#include <memory>
+#include <vector>
+#include "HuffmanEncoding.h"
+#include "TableCache.h"
+
+/* Class: Encoder
+ * ---------------------------------------------------------
+ * Compresses buffers in the format its options choose.  Its
+ * memory streams are made once and pointed at each new
+ * buffer.  An Encoder built with tables skips counting and
+ * tree building altogether and codes every buffer with those
+ * tables, writing FORMAT_CANONICAL files any decompressor
+ * can read.
+ */
+class Encoder {
+public:
+	/* Constructor: Encoder
+	 * Usage: Encoder encoder(options);
+	 *        Encoder encoder(options, Encoder::train(sample, length, 0));
+	 * -------------------------------------
+	 * Creates an encoder for the given options, which are
+	 * copied, and optionally for a fixed set of tables covering
+	 * every byte.  Reports an error if the tables leave a byte
+	 * without a code.
+	 */
+	explicit Encoder(const HuffmanOptions& options = HuffmanOptions());
+	Encoder(const HuffmanOptions& options, const std::shared_ptr<const CachedTables>& tables);
+
+	/* Function: train
+	 * Usage: std::shared_ptr<const CachedTables> tables = Encoder::train(sample, length, 0);
+	 * -------------------------------------
+	 * Builds tables for an Encoder from a sample of the data it
+	 * will see.  As with trainDictionary, every byte gets a code,
+	 * so any data can be encoded with them; maxCodeLength limits
+	 * the codes as in HuffmanOptions.
+	 */
+	static std::shared_ptr<const CachedTables> train(const char* sample, size_t length, int maxCodeLength);
+
+	/* Member functions: options, tables
+	 * Usage: const HuffmanOptions& options = encoder.options();
+	 * -------------------------------------
+	 * Return what the encoder was built with.  tables is NULL
+	 * for an encoder that builds a table for each buffer.
+	 */
+	const HuffmanOptions& options() const;
+	std::shared_ptr<const CachedTables> tables() const;
+
+	/* Member function: maxCompressedSize
+	 * Usage: vector<char> buffer(encoder.maxCompressedSize(length));
+	 * -------------------------------------
+	 * As the free maxCompressedSize, for this encoder.
+	 */
+	size_t maxCompressedSize(size_t length) const;
+
+	/* Member function: compress
+	 * Usage: size_t used = encoder.compress(data, length, buffer, capacity);
+	 *        encoder.compress(data, length, output);
+	 * -------------------------------------
+	 * Compresses the length bytes at source into the span at
+	 * dest, returning how many bytes were used, or into a
+	 * vector, which ends up exactly the compressed size.  A
+	 * vector that is reused keeps its capacity, so it stops
+	 * allocating once it has held the largest output.  Reports
+	 * an error, as compressBuffer does, if the span is too small.
+	 */
+	size_t compress(const char* source, size_t length, char* dest, size_t capacity);
+	void compress(const char* source, size_t length, std::vector<char>& dest);
+
+private:
+	HuffmanOptions settings;
+	std::shared_ptr<const CachedTables> fixed;
+	size_t longestCode;
+	imembstream input;
+	omembstream output;
+
+	/* Copying an encoder makes no sense. */
+	Encoder(const Encoder&);
+	Encoder& operator=(const Encoder&);
+};
+
+/* Class: Decoder
+ * ---------------------------------------------------------
+ * Decompresses buffers in any format compress can write.
+ * Unless its options name a shared TableCache, it keeps a
+ * small one of its own, so buffers with the same header as
+ * one it decoded recently reuse that header's tables.
+ */
+class Decoder {
+public:
+	/* Constant: OWN_CACHE_CAPACITY
+	 * How many tables a decoder's own cache holds.
+	 */
+	static const int OWN_CACHE_CAPACITY = 8;
+
+	/* Constructor: Decoder
+	 * Usage: Decoder decoder(options);
+	 * -------------------------------------
+	 * Creates a decoder for the given options, which are copied.
+	 */
+	explicit Decoder(const HuffmanOptions& options = HuffmanOptions());
+
+	/* Member function: options
+	 * Usage: const HuffmanOptions& options = decoder.options();
+	 * -------------------------------------
+	 * Returns the options, with tableCache pointing at whichever
+	 * cache the decoder uses.
+	 */
+	const HuffmanOptions& options() const;
+
+	/* Member function: decompress
+	 * Usage: size_t used = decoder.decompress(data, length, buffer, capacity);
+	 *        decoder.decompress(data, length, output);
+	 * -------------------------------------
+	 * Decompresses the length bytes at source into the span at
+	 * dest, returning how many bytes were used, or into a
+	 * vector, which grows as needed and ends up exactly the
+	 * decompressed size.  Reports an error if the data is
+	 * damaged or the span is too small.
+	 */
+	size_t decompress(const char* source, size_t length, char* dest, size_t capacity);
+	void decompress(const char* source, size_t length, std::vector<char>& dest);
+
+private:
+	HuffmanOptions settings;
+	TableCache ownCache;
+	imembstream input;
+	omembstream output;
+
+	/* Copying a decoder makes no sense. */
+	Decoder(const Decoder&);
+	Decoder& operator=(const Decoder&);
+};
+
+#endif
@@ -0,0 +1,424 @@
+/**********************************************************
+ * File: HuffmanContext.cpp
+ *
+ * Implementation of the order-1 context model from
+ * HuffmanContext.h.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "HuffmanContext.h"
+#include "HuffmanStats.h"
+#include "TableCache.h"
+
+/* Constant: CONTEXT_BUFFER_SIZE
+ * How many bytes are counted or encoded at once when the
+ * input isn't in memory.
+ */
+static const int CONTEXT_BUFFER_SIZE = 1 << 16;
+
+/* Constant: DECODE_BUFFER_SIZE
+ * How many decoded characters are collected before they are
+ * written, as in decodeFile.
+ */
+static const int DECODE_BUFFER_SIZE = 4096;
+
+/* Constant: MAP_BITS
+ * The width of the table count and of each context map entry.
+ */
+static const int MAP_BITS = 4;
+
+/* Constant: REFINE_ROUNDS
+ * The most passes buildContextModel makes over the contexts,
+ * for each number of tables, moving each to the cluster that
+ * suits it best.
+ */
+static const int REFINE_ROUNDS = 8;
+
+/* Function: readPieces
+ * --------------------------------------------------------
+ * Hands the rest of infile to use, all at once if it is in
+ * memory and in large reads if not.
+ */
+static void readPieces(istream& infile, const std::function<void(const char*, size_t)>& use) {
+	const char* mapped;
+	size_t mappedLength;
+	if (mappedBytes(infile, mapped, mappedLength)) {
+		use(mapped, mappedLength);
+	} else {
+		std::vector<char> buffer(CONTEXT_BUFFER_SIZE);
+		while (true) {
+			infile.read(&buffer[0], CONTEXT_BUFFER_SIZE);
+			streamsize count = infile.gcount();
+			if (count == 0) break;
+			use(&buffer[0], size_t(count));
+		}
+	}
+}
+
+/* Function: countContexts
+ * Usage: countContexts(data, length, previous, counts);
+ * --------------------------------------------------------
+ * Counts each byte in the row of the byte before it.
+ */
+void countContexts(const char* data, size_t length, unsigned char& previous, ContextCounts& counts) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned char last = previous;
+	for (size_t i = 0; i < length; i++) {
+		counts.weights[last][bytes[i]]++;
+		last = bytes[i];
+	}
+	previous = last;
+}
+
+/* Type: Cluster
+ * --------------------------------------------------------
+ * The summed weights of the contexts sharing a table, and
+ * the entropyTerm of each, which costOfJoining would
+ * otherwise recompute for every context it tries.
+ */
+struct Cluster {
+	uint64_t weights[NUM_SYMBOLS];
+	double terms[NUM_SYMBOLS];
+	uint64_t total;
+};
+
+/* Type: Context
+ * --------------------------------------------------------
+ * A byte value that something follows: its row of the
+ * counts, the characters that follow it, what coding them
+ * with a table of its own would cost, and its cluster.
+ */
+struct Context {
+	int byte;
+	const uint64_t* weights;
+	uint64_t total;
+	std::vector<int> followers;
+	double cost;
+	int cluster;
+};
+
+/* Constant: TERM_TABLE_SIZE
+ * The counts small enough for entropyTerm to look up rather
+ * than compute.  Most counts in the rows of a modest input
+ * are.
+ */
+static const int TERM_TABLE_SIZE = 1 << 12;
+
+/* Type: TermTable
+ * --------------------------------------------------------
+ * entropyTerm of every count below TERM_TABLE_SIZE.
+ */
+struct TermTable {
+	double terms[TERM_TABLE_SIZE];
+
+	TermTable() {
+		terms[0] = 0;
+		for (int count = 1; count < TERM_TABLE_SIZE; count++) terms[count] = count * std::log2(double(count));
+	}
+};
+
+/* Function: entropyTerm
+ * --------------------------------------------------------
+ * x log2 x.  A histogram with total T costs T log2 T minus
+ * the sum of this over its counts, in bits, under an ideal
+ * code.
+ */
+static double entropyTerm(uint64_t count) {
+	static const TermTable table;
+	return (count < TERM_TABLE_SIZE)? table.terms[count] : double(count) * std::log2(double(count));
+}
+
+/* Function: costOfJoining
+ * --------------------------------------------------------
+ * How many bits the ideal cost of cluster would rise by if
+ * context joined it.  Only the characters that follow the
+ * context change their terms.
+ */
+static double costOfJoining(const Cluster& cluster, const Context& context) {
+	double cost = entropyTerm(cluster.total + context.total) - entropyTerm(cluster.total);
+	for (size_t i = 0; i < context.followers.size(); i++) {
+		int ch = context.followers[i];
+		cost -= entropyTerm(cluster.weights[ch] + context.weights[ch]) - cluster.terms[ch];
+	}
+	return cost;
+}
+
+/* Functions: joinCluster, leaveCluster
+ * --------------------------------------------------------
+ * Add the context's weights to its cluster or take them away.
+ */
+static void joinCluster(std::vector<Cluster>& clusters, Context& context, int cluster) {
+	Cluster& target = clusters[cluster];
+	for (size_t i = 0; i < context.followers.size(); i++) {
+		int ch = context.followers[i];
+		target.weights[ch] += context.weights[ch];
+		target.terms[ch] = entropyTerm(target.weights[ch]);
+	}
+	target.total += context.total;
+	context.cluster = cluster;
+}
+static void leaveCluster(std::vector<Cluster>& clusters, const Context& context) {
+	Cluster& source = clusters[context.cluster];
+	for (size_t i = 0; i < context.followers.size(); i++) {
+		int ch = context.followers[i];
+		source.weights[ch] -= context.weights[ch];
+		source.terms[ch] = entropyTerm(source.weights[ch]);
+	}
+	source.total -= context.total;
+}
+
+/* Function: refineClusters
+ * --------------------------------------------------------
+ * Moves each context to the cluster it adds least cost to,
+ * its own included, until no context moves.
+ */
+static void refineClusters(std::vector<Context>& contexts, std::vector<Cluster>& clusters) {
+	for (int round = 0; round < REFINE_ROUNDS; round++) {
+		bool moved = false;
+		for (size_t c = 0; c < contexts.size(); c++) {
+			Context& context = contexts[c];
+			int old = context.cluster;
+			leaveCluster(clusters, context);
+
+			int best = old;
+			double bestCost = costOfJoining(clusters[old], context);
+			for (size_t k = 0; k < clusters.size(); k++) {
+				double cost = costOfJoining(clusters[k], context);
+				if (cost < bestCost) {
+					best = int(k);
+					bestCost = cost;
+				}
+			}
+			joinCluster(clusters, context, best);
+			moved = moved || best != old;
+		}
+		if (!moved) break;
+	}
+}
+
+/* Function: modelFor
+ * --------------------------------------------------------
+ * Builds the tables for the current clusters into model,
+ * skipping clusters left empty, and returns the exact size
+ * in bits of the file they would give, near enough: headers
+ * are counted in whole bytes.  A table needs two characters
+ * to be a complete code, so a cluster with only one gets
+ * PSEUDO_EOF as a placeholder.
+ */
+static uint64_t modelFor(const std::vector<Context>& contexts, const std::vector<Cluster>& clusters,
+                         int maxCodeLength, ContextModel& model) {
+	std::vector<int> numbers(clusters.size(), -1);
+	model.numTables = 0;
+	for (size_t k = 0; k < clusters.size(); k++) {
+		if (clusters[k].total != 0 || clusters.size() == 1) numbers[k] = model.numTables++;
+	}
+	memset(model.tableFor, 0, sizeof(model.tableFor));
+	for (size_t c = 0; c < contexts.size(); c++) {
+		model.tableFor[contexts[c].byte] = (unsigned char)numbers[contexts[c].cluster];
+	}
+
+	uint64_t bits = 8 + MAP_BITS + ((model.numTables > 1)? 256 * MAP_BITS : 0);
+	for (size_t k = 0; k < clusters.size(); k++) {
+		if (numbers[k] < 0) continue;
+		uint64_t weights[NUM_SYMBOLS];
+		int distinct = 0;
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+			weights[ch] = clusters[k].weights[ch];
+			if (weights[ch] != 0) distinct++;
+		}
+		if (distinct < 2) weights[PSEUDO_EOF]++;
+
+		EncodeTable& table = model.tables[numbers[k]];
+		buildCanonicalTable(weights, maxCodeLength, table);
+		ostringbstream header;
+		writeCodeLengths(header, table);
+		header.flushBits();
+		bits += 8 * header.str().size();
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+			bits += clusters[k].weights[ch] * table.lengths[ch];
+		}
+	}
+	return bits;
+}
+
+/* Function: buildContextModel
+ * Usage: buildContextModel(counts, 16, 0, model);
+ * --------------------------------------------------------
+ * Tables are added one at a time.  Each new cluster starts
+ * with the context that pays most for sharing its table, the
+ * bits it costs there beyond what it would cost alone, and
+ * the clusters are then refined.  To keep a degenerate input
+ * from costing maxTables rounds of refinement, building stops
+ * as soon as another table doesn't make the file smaller.
+ */
+void buildContextModel(const ContextCounts& counts, int maxTables, int maxCodeLength, ContextModel& model) {
+	maxTables = std::max(1, std::min(maxTables, MAX_CONTEXT_TABLES));
+	std::vector<Context> contexts;
+	for (int byte = 0; byte < 256; byte++) {
+		Context context;
+		context.byte = byte;
+		context.weights = counts.weights[byte];
+		context.total = 0;
+		context.cost = 0;
+		context.cluster = 0;
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+			if (context.weights[ch] == 0) continue;
+			context.followers.push_back(ch);
+			context.total += context.weights[ch];
+			context.cost -= entropyTerm(context.weights[ch]);
+		}
+		if (context.total == 0) continue;
+		context.cost += entropyTerm(context.total);
+		contexts.push_back(context);
+	}
+
+	std::vector<Cluster> clusters(1);
+	memset(&clusters[0], 0, sizeof(Cluster));
+	for (size_t c = 0; c < contexts.size(); c++) joinCluster(clusters, contexts[c], 0);
+
+	std::unique_ptr<ContextModel> candidate(new ContextModel);
+	uint64_t bestBits = modelFor(contexts, clusters, maxCodeLength, model);
+	while (int(clusters.size()) < std::min(maxTables, int(contexts.size()))) {
+		int seed = -1;
+		double worst = 0;
+		for (size_t c = 0; c < contexts.size(); c++) {
+			leaveCluster(clusters, contexts[c]);
+			double misfit = costOfJoining(clusters[contexts[c].cluster], contexts[c]) - contexts[c].cost;
+			joinCluster(clusters, contexts[c], contexts[c].cluster);
+			if (misfit > worst) {
+				seed = int(c);
+				worst = misfit;
+			}
+		}
+		if (seed < 0) break;
+
+		clusters.push_back(Cluster());
+		memset(&clusters.back(), 0, sizeof(Cluster));
+		leaveCluster(clusters, contexts[seed]);
+		joinCluster(clusters, contexts[seed], int(clusters.size()) - 1);
+		refineClusters(contexts, clusters);
+
+		uint64_t bits = modelFor(contexts, clusters, maxCodeLength, *candidate);
+		if (bits >= bestBits) break;
+		bestBits = bits;
+		model = *candidate;
+	}
+}
+
+/* Function: compressWithContexts
+ * Usage: compressWithContexts(infile, outfile, options);
+ * --------------------------------------------------------
+ * The first pass counts pairs of bytes and the second codes
+ * each byte with the table its predecessor maps to.
+ */
+void compressWithContexts(ibstream& infile, obstream& outfile, const HuffmanOptions& options) {
+	StageTimer counting(options.stats, &HuffmanStats::countSeconds);
+	std::unique_ptr<ContextCounts> counts(new ContextCounts());
+	unsigned char previous = 0;
+	readPieces(infile, [&](const char* data, size_t length) {
+		countContexts(data, length, previous, *counts);
+	});
+	counts->weights[previous][PSEUDO_EOF]++;
+	infile.rewind();
+	counting.stop();
+
+	StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+	std::unique_ptr<ContextModel> model(new ContextModel);
+	buildContextModel(*counts, options.contextTables, options.maxCodeLength, *model);
+	building.stop();
+
+	StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+	outfile.writeBits(CONTEXT_TAG, 8);
+	outfile.writeBits(model->numTables - 1, MAP_BITS);
+	if (model->numTables > 1) {
+		for (int byte = 0; byte < 256; byte++) outfile.writeBits(model->tableFor[byte], MAP_BITS);
+	}
+	for (int t = 0; t < model->numTables; t++) writeCodeLengths(outfile, model->tables[t]);
+	header.stop();
+
+	StageTimer encoding(options.stats, &HuffmanStats::encodeSeconds);
+	const EncodeTable* tableAfter[256];
+	for (int byte = 0; byte < 256; byte++) tableAfter[byte] = &model->tables[model->tableFor[byte]];
+	previous = 0;
+	readPieces(infile, [&](const char* data, size_t length) {
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < length; i++) {
+			const EncodeTable& table = *tableAfter[previous];
+			outfile.writeBits(table.codes[bytes[i]], table.lengths[bytes[i]]);
+			previous = bytes[i];
+		}
+	});
+	outfile.writeBits(tableAfter[previous]->codes[PSEUDO_EOF], tableAfter[previous]->lengths[PSEUDO_EOF]);
+	outfile.flushBits();
+	encoding.stop();
+
+	if (options.stats != NULL) {
+		for (int byte = 0; byte < 256; byte++) {
+			for (int ch = 0; ch < 256; ch++) options.stats->bytesIn += counts->weights[byte][ch];
+			options.stats->addCodes(counts->weights[byte], *tableAfter[byte]);
+		}
+	}
+}
+
+/* Function: decompressWithContexts
+ * Usage: decompressWithContexts(infile, outfile, options);
+ * --------------------------------------------------------
+ * The decoding loop is decodeFile's, with the decode table
+ * looked up by the last character decoded.
+ */
+void decompressWithContexts(ibstream& infile, ostream& outfile, const HuffmanOptions& options) {
+	StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+	if (infile.readBits(8) != (unsigned char)CONTEXT_TAG) error("Not a context-modelled file.");
+	int numTables = int(infile.readBits(MAP_BITS)) + 1;
+	unsigned char tableFor[256] = {0};
+	if (numTables > 1) {
+		for (int byte = 0; byte < 256; byte++) {
+			tableFor[byte] = (unsigned char)infile.readBits(MAP_BITS);
+			if (tableFor[byte] >= numTables) error("Context map names a table the file doesn't have.");
+		}
+	}
+	std::vector<EncodeTable> codes(numTables);
+	for (int t = 0; t < numTables; t++) readCodeLengths(infile, codes[t]);
+	if (infile.fail()) error("FORMAT_CONTEXT header is truncated.");
+	header.stop();
+
+	StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+	std::vector<std::shared_ptr<const CachedTables> > cached(numTables);
+	std::vector<DecodeTable> built(numTables);
+	std::vector<const DecodeTable*> tables(numTables);
+	for (int t = 0; t < numTables; t++) {
+		if (options.tableCache != NULL) {
+			cached[t] = options.tableCache->lookup(codes[t]);
+			tables[t] = &cached[t]->decodeTable;
+		} else {
+			buildDecodeTable(codes[t], built[t]);
+			tables[t] = &built[t];
+		}
+	}
+	const DecodeTable* tableAfter[256];
+	for (int byte = 0; byte < 256; byte++) tableAfter[byte] = tables[tableFor[byte]];
+	building.stop();
+
+	StageTimer decoding(options.stats, &HuffmanStats::decodeSeconds);
+	char buffer[DECODE_BUFFER_SIZE];
+	int used = 0;
+	unsigned char previous = 0;
+	while (true) {
+		ext_char ch = decodeSymbol(infile, *tableAfter[previous]);
+		if (infile.fail()) error("Encoded data ended before PSEUDO_EOF was found.");
+		if (ch == PSEUDO_EOF) break;
+
+		previous = (unsigned char)ch;
+		buffer[used++] = char(ch);
+		if (used == DECODE_BUFFER_SIZE) {
+			outfile.write(buffer, used);
+			used = 0;
+		}
+	}
+	outfile.write(buffer, used);
+	infile.alignBits();
+}
@@ -0,0 +1,93 @@
+/**********************************************************
+ * File: HuffmanContext.h
+ *
+ * Order-1 context modelling (FORMAT_CONTEXT).  Each byte is
+ * coded with a table chosen by the byte before it, so text
+ * where 'q' is nearly always followed by 'u' pays almost
+ * nothing for the 'u'.  A table for every possible previous
+ * byte would cost more header than it saves, so previous
+ * bytes whose successors look alike are clustered to share a
+ * table, and only as many tables are sent as pay for
+ * themselves.  Decoding is one table lookup per byte, the
+ * same as order-0.
+ *
+ * A FORMAT_CONTEXT file is:
+ *
+ *   CONTEXT_TAG         1 byte
+ *   table count - 1     4 bits
+ *   context map         256 x 4 bits, the table used after
+ *                       each byte value; absent for one table
+ *   code lengths        for each table, as written by
+ *                       writeCodeLengths
+ *   the codes of the data and of PSEUDO_EOF, each from the
+ *   table of the byte before it, padded to a byte
+ *
+ * The first byte is coded as if it followed a zero byte.
+ */
+
+#ifndef HuffmanContext_Included
+#define HuffmanContext_Included
+
+#include "HuffmanEncoding.h"
+
+/* Type: ContextCounts
+ * How often each character follows each byte value: weights[p][ch]
+ * counts ch coming straight after p.  PSEUDO_EOF is counted
+ * once, after the last byte.  At half a megabyte it belongs
+ * on the heap.
+ */
+struct ContextCounts {
+	uint64_t weights[256][NUM_SYMBOLS];
+};
+
+/* Type: ContextModel
+ * The tables of a FORMAT_CONTEXT file: numTables code tables,
+ * and for each byte value the table used for the character
+ * after it.
+ */
+struct ContextModel {
+	int numTables;
+	unsigned char tableFor[256];
+	EncodeTable tables[MAX_CONTEXT_TABLES];
+};
+
+/* Function: countContexts
+ * Usage: countContexts(data, length, previous, counts);
+ * --------------------------------------------------------
+ * Adds the pairs of adjacent bytes in data to counts, the
+ * first taken to follow previous, and sets previous to the
+ * last byte so that a large input can be counted in pieces.
+ * PSEUDO_EOF is left for the caller to count.
+ */
+void countContexts(const char* data, size_t length, unsigned char& previous, ContextCounts& counts);
+
+/* Function: buildContextModel
+ * Usage: buildContextModel(counts, 16, 0, model);
+ * --------------------------------------------------------
+ * Clusters the byte values that occur before something into
+ * at most maxTables groups and builds a canonical table for
+ * each, limited to maxCodeLength as in HuffmanOptions.  The
+ * number of tables is the one whose file, headers included,
+ * comes out smallest, so a single table, which is plain
+ * order-0 coding, is chosen when contexts don't help.
+ */
+void buildContextModel(const ContextCounts& counts, int maxTables, int maxCodeLength, ContextModel& model);
+
+/* Function: compressWithContexts
+ * Usage: compressWithContexts(infile, outfile, options);
+ * --------------------------------------------------------
+ * Writes infile to outfile in FORMAT_CONTEXT, with at most
+ * options.contextTables tables.  Reads the input twice.
+ */
+void compressWithContexts(ibstream& infile, obstream& outfile, const HuffmanOptions& options);
+
+/* Function: decompressWithContexts
+ * Usage: decompressWithContexts(infile, outfile, options);
+ * --------------------------------------------------------
+ * Decodes a FORMAT_CONTEXT file, taking its tables from
+ * options.tableCache if there is one.  Reports an error if
+ * the header is damaged.
+ */
+void decompressWithContexts(ibstream& infile, ostream& outfile, const HuffmanOptions& options);
+
+#endif
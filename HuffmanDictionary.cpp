@@ -0,0 +1,141 @@
+/**********************************************************
+ * File: HuffmanDictionary.cpp
+ *
+ * Implementation of the pre-trained code tables from
+ * HuffmanDictionary.h.
+ */
+
+#include <vector>
+#include "HuffmanDictionary.h"
+
+/* Constant: DICTIONARY_MAGIC
+ * The first four bytes of a saved dictionary, "HDCT" read as a
+ * little-endian integer.
+ */
+static const uint32_t DICTIONARY_MAGIC = 0x54434448;
+
+/* Constant: CORPUS_BUFFER_SIZE
+ * How many bytes of a corpus are counted at once.
+ */
+static const int CORPUS_BUFFER_SIZE = 1 << 16;
+
+/* Function: hashLengths
+ * --------------------------------------------------------
+ * The 32-bit FNV-1a hash of every code length in table.
+ * Canonical codes follow from the lengths, so equal hashes
+ * mean (barring collisions) equal codes.
+ */
+static uint32_t hashLengths(const EncodeTable& table) {
+	uint32_t hash = 2166136261u;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		hash = (hash ^ table.lengths[ch]) * 16777619u;
+	}
+	return hash;
+}
+
+/* Function: finishDictionary
+ * --------------------------------------------------------
+ * Derives the decode table and the id from the canonical
+ * codes already in the dictionary's encode table.
+ */
+static void finishDictionary(HuffmanDictionary& dictionary) {
+	buildDecodeTable(dictionary.encodeTable, dictionary.decodeTable);
+	dictionary.id = hashLengths(dictionary.encodeTable);
+}
+
+/* Function: trainDictionary
+ * Usage: trainDictionary(counts, 0, dictionary);
+ * --------------------------------------------------------
+ * Adds one to every count so that no byte is left without a
+ * code; for a corpus of any size this barely moves the codes
+ * of the bytes it does use.
+ */
+void trainDictionary(const uint64_t counts[256], int maxCodeLength, HuffmanDictionary& dictionary) {
+	uint64_t weights[NUM_SYMBOLS];
+	for (int ch = 0; ch < 256; ch++) {
+		weights[ch] = counts[ch] + 1;
+	}
+	weights[PSEUDO_EOF] = 1;
+	buildCanonicalTable(weights, maxCodeLength, dictionary.encodeTable);
+	finishDictionary(dictionary);
+}
+
+/* Function: trainDictionary
+ * Usage: trainDictionary(corpus, 0, dictionary);
+ * --------------------------------------------------------
+ * Counts the corpus in place if it is held in memory, and in
+ * large reads otherwise.
+ */
+void trainDictionary(istream& corpus, int maxCodeLength, HuffmanDictionary& dictionary) {
+	uint64_t counts[256] = {0};
+	const char* mapped;
+	size_t mappedLength;
+	if (mappedBytes(corpus, mapped, mappedLength)) {
+		countFrequencies((const unsigned char*)mapped, mappedLength, counts);
+	} else {
+		std::vector<char> buffer(CORPUS_BUFFER_SIZE);
+		while (true) {
+			corpus.read(&buffer[0], CORPUS_BUFFER_SIZE);
+			streamsize count = corpus.gcount();
+			if (count == 0) break;
+			countFrequencies((const unsigned char*)&buffer[0], size_t(count), counts);
+		}
+	}
+	trainDictionary(counts, maxCodeLength, dictionary);
+}
+
+/* Function: writeDictionary
+ * Usage: writeDictionary(outfile, dictionary);
+ * --------------------------------------------------------
+ * The id is stored as well as the lengths so that a damaged
+ * dictionary is caught when it is loaded, not when messages
+ * start decoding to garbage.
+ */
+void writeDictionary(obstream& outfile, const HuffmanDictionary& dictionary) {
+	outfile.writeBits(DICTIONARY_MAGIC, 32);
+	outfile.writeBits(dictionary.id, 32);
+	writeCodeLengths(outfile, dictionary.encodeTable);
+	outfile.flushBits();
+}
+
+/* Function: readDictionary
+ * Usage: readDictionary(infile, dictionary);
+ * --------------------------------------------------------
+ * readCodeLengths already rejects lengths that don't form a
+ * complete code; the id check catches the rest.
+ */
+void readDictionary(ibstream& infile, HuffmanDictionary& dictionary) {
+	if (infile.readBits(32) != DICTIONARY_MAGIC) error("Not a Huffman dictionary.");
+	uint32_t id = uint32_t(infile.readBits(32));
+	readCodeLengths(infile, dictionary.encodeTable);
+	infile.alignBits();
+	if (infile.fail()) error("Huffman dictionary is truncated.");
+
+	finishDictionary(dictionary);
+	if (dictionary.id != id) error("Huffman dictionary is damaged.");
+}
+
+/* Function: compressWithDictionary
+ * Usage: compressWithDictionary(infile, outfile, dictionary);
+ * --------------------------------------------------------
+ * The dictionary covers every byte, so the input needs only
+ * one pass and no counting.
+ */
+void compressWithDictionary(istream& infile, obstream& outfile, const HuffmanDictionary& dictionary) {
+	outfile.writeBits(DICTIONARY_TAG, 8);
+	outfile.writeBits(dictionary.id, 32);
+	encodeFile(infile, dictionary.encodeTable, outfile);
+}
+
+/* Function: decompressWithDictionary
+ * Usage: decompressWithDictionary(infile, outfile, dictionary);
+ * --------------------------------------------------------
+ * Decodes with the dictionary's prebuilt decode table.
+ */
+void decompressWithDictionary(ibstream& infile, ostream& outfile, const HuffmanDictionary& dictionary) {
+	if (infile.readBits(8) != (unsigned char)DICTIONARY_TAG) error("Not a dictionary-compressed file.");
+	uint32_t id = uint32_t(infile.readBits(32));
+	if (infile.fail()) error("Dictionary-compressed file is truncated.");
+	if (id != dictionary.id) error("File was compressed with a different dictionary.");
+	decodeFile(infile, dictionary.decodeTable, outfile);
+}
@@ -0,0 +1,84 @@
+/**********************************************************
+ * File: HuffmanDictionary.h
+ *
+ * Pre-trained code tables (FORMAT_DICTIONARY).  A dictionary
+ * is trained once from a sample corpus, saved, and then
+ * shared by both ends, so each message carries only the
+ * dictionary's id instead of a table of its own and neither
+ * side counts characters or builds a tree per message.
+ *
+ * A FORMAT_DICTIONARY file is:
+ *
+ *   DICTIONARY_TAG      1 byte
+ *   dictionary id       4 bytes, little-endian
+ *   the codes of the data and of PSEUDO_EOF, padded to a byte
+ *
+ * A saved dictionary is:
+ *
+ *   DICTIONARY_MAGIC    4 bytes ("HDCT")
+ *   dictionary id       4 bytes
+ *   code lengths        as written by writeCodeLengths
+ */
+
+#ifndef HuffmanDictionary_Included
+#define HuffmanDictionary_Included
+
+#include "HuffmanEncoding.h"
+
+/* Type: HuffmanDictionary
+ * A code table ready for use in both directions.  The id is
+ * a hash of the code lengths, so two dictionaries with the
+ * same id encode identically.
+ */
+struct HuffmanDictionary {
+	uint32_t id;
+	EncodeTable encodeTable;
+	DecodeTable decodeTable;
+};
+
+/* Function: trainDictionary
+ * Usage: trainDictionary(counts, 0, dictionary);
+ *        trainDictionary(corpus, 0, dictionary);
+ * --------------------------------------------------------
+ * Builds the dictionary for the byte counts of a sample
+ * corpus (accumulated with countFrequencies) or for the
+ * whole of the given stream.  Every byte value gets a code,
+ * even those the corpus never uses, so any message can be
+ * encoded; rare bytes just get long codes.  maxCodeLength
+ * limits them as in HuffmanOptions.
+ */
+void trainDictionary(const uint64_t counts[256], int maxCodeLength, HuffmanDictionary& dictionary);
+void trainDictionary(istream& corpus, int maxCodeLength, HuffmanDictionary& dictionary);
+
+/* Function: writeDictionary
+ * Usage: writeDictionary(outfile, dictionary);
+ * --------------------------------------------------------
+ * Saves the dictionary so readDictionary can load it.
+ */
+void writeDictionary(obstream& outfile, const HuffmanDictionary& dictionary);
+
+/* Function: readDictionary
+ * Usage: readDictionary(infile, dictionary);
+ * --------------------------------------------------------
+ * Loads a dictionary saved by writeDictionary, rebuilding
+ * its codes and decode table.  Reports an error if the data
+ * is not a dictionary or its lengths don't match its id.
+ */
+void readDictionary(ibstream& infile, HuffmanDictionary& dictionary);
+
+/* Function: compressWithDictionary
+ * Usage: compressWithDictionary(infile, outfile, dictionary);
+ * --------------------------------------------------------
+ * Writes infile to outfile in FORMAT_DICTIONARY.
+ */
+void compressWithDictionary(istream& infile, obstream& outfile, const HuffmanDictionary& dictionary);
+
+/* Function: decompressWithDictionary
+ * Usage: decompressWithDictionary(infile, outfile, dictionary);
+ * --------------------------------------------------------
+ * Decodes a FORMAT_DICTIONARY file.  Reports an error if it
+ * was written with a different dictionary.
+ */
+void decompressWithDictionary(ibstream& infile, ostream& outfile, const HuffmanDictionary& dictionary);
+
+#endif
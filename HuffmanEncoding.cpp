@@ -6,8 +6,89 @@
  * assignment will go into this file.
  */
 
+#include <algorithm>
+#include <climits>
+#include <stdint.h>
+#include <vector>
 #include "HuffmanEncoding.h"
-#include "pqueue.h"
+#include "HuffmanBlocks.h"
+#include "HuffmanContext.h"
+#include "HuffmanDictionary.h"
+#include "HuffmanSimd.h"
+#include "HuffmanStats.h"
+#include "MemoryDiagnostics.h"
+#include "TableCache.h"
+
+/* Constant: FREQUENCY_BUFFER_SIZE
+ * How many bytes getFrequencyTable reads from the stream at once.
+ */
+static const int FREQUENCY_BUFFER_SIZE = 1 << 16;
+
+/* Constant: DECODE_BUFFER_SIZE
+ * How many decoded characters are collected before they are
+ * handed to the output stream in a single write.
+ */
+static const int DECODE_BUFFER_SIZE = 4096;
+
+/* Constant: ENCODE_BUFFER_SIZE
+ * How many bytes of input encodeFile reads per block.
+ */
+static const int ENCODE_BUFFER_SIZE = 4096;
+
+/* Constant: COUNTED_BUFFER_SIZE
+ * The most output a FORMAT_COUNTED file is decoded into at
+ * once; shorter files get a buffer of exactly their size.
+ */
+static const size_t COUNTED_BUFFER_SIZE = 1 << 16;
+
+/* Constant: INTERLEAVED_CHUNK_SIZE
+ * How much more of a stream decodeInterleaved reads at a time
+ * when the streams aren't already in memory.
+ */
+static const size_t INTERLEAVED_CHUNK_SIZE = 1 << 16;
+
+/* Function: countStream
+ * --------------------------------------------------------
+ * Adds the byte counts of the rest of file to counts, in
+ * place if the file is in memory and in large reads if not.
+ */
+static void countStream(istream& file, uint64_t counts[256]) {
+	const char* mapped;
+	size_t mappedLength;
+	if (mappedBytes(file, mapped, mappedLength)) {
+		countFrequencies((const unsigned char*)mapped, mappedLength, counts);
+	} else {
+		std::vector<char> buffer(FREQUENCY_BUFFER_SIZE);
+		while (true) {
+			file.read(&buffer[0], FREQUENCY_BUFFER_SIZE);
+			streamsize count = file.gcount();
+			if (count == 0) break;
+			countFrequencies((const unsigned char*)&buffer[0], size_t(count), counts);
+		}
+	}
+}
+
+/* Function: encodeStream
+ * --------------------------------------------------------
+ * Writes the codes of the rest of infile, reading it in
+ * blocks or straight from memory if it is mapped.
+ */
+static void encodeStream(istream& infile, const EncodeTable& table, obstream& outfile) {
+	const char* mapped;
+	size_t mappedLength;
+	if (mappedBytes(infile, mapped, mappedLength)) {
+		encodeBytes(mapped, mappedLength, table, outfile);
+	} else {
+		char buffer[ENCODE_BUFFER_SIZE];
+		while (true) {
+			infile.read(buffer, ENCODE_BUFFER_SIZE);
+			streamsize count = infile.gcount();
+			if (count == 0) break;
+
+			encodeBytes(buffer, size_t(count), table, outfile);
+		}
+	}
+}
 
 /* Function: getFrequencyTable
  * Usage: Map<ext_char, int> freq = getFrequencyTable(file);
@@ -21,16 +102,91 @@
  * character to be 1, which ensures that any future encoding
  * tree built from these frequencies will have an encoding for
  * the PSEUDO_EOF character.
+ *
+ * The stream is read in large blocks and tallied by the flat
+ * countFrequencies kernel; the Map is only built at the end.
+ * Bytes are counted as unsigned values, so bytes 0x80 and up
+ * become the characters 128 through 255 whatever the signedness
+ * of char.  A memory-mapped file is counted in place.
  */
 Map<ext_char, int> getFrequencyTable(istream& file) {
+	uint64_t counts[256] = {0};
+	countStream(file, counts);
+	return getFrequencyTable(counts);
+}
+
+/* Function: getFrequencyTable
+ * Usage: Map<ext_char, int> freq = getFrequencyTable(counts);
+ * --------------------------------------------------------
+ * Dividing by the rounded-up ratio of the total to what is
+ * left of INT_MAX after a weight of one for every character
+ * keeps the total in range even after the rounding up of
+ * rare characters.
+ */
+Map<ext_char, int> getFrequencyTable(const uint64_t counts[256]) {
+	uint64_t total = 1;
+	for (int ch = 0; ch < 256; ch++) {
+		total += counts[ch];
+	}
+	const uint64_t room = uint64_t(INT_MAX) - NUM_SYMBOLS;
+	uint64_t divisor = (total <= uint64_t(INT_MAX))? 1 : total / room + 1;
+
 	Map<ext_char, int> charCount;
-	char tmpChar;
-	while(file.get(tmpChar)){
-		if(!charCount.containsKey(tmpChar)) charCount.put(tmpChar, 0);
-		charCount.put(tmpChar, charCount.get(tmpChar) + 1);
+	for (int ch = 0; ch < 256; ch++) {
+		if (counts[ch] == 0) continue;
+		charCount.put(ch, int(std::max(uint64_t(1), counts[ch] / divisor)));
 	}
 	charCount.put(PSEUDO_EOF, 1);
-	return charCount;	
+	return charCount;
+}
+
+/* Function: newNode
+ * --------------------------------------------------------
+ * Allocates a node from arena, or from the heap if arena is
+ * NULL.
+ */
+static Node* newNode(NodeArena* arena) {
+	return (arena == NULL)? new Node : arena->allocate();
+}
+
+/* Function: mergeNodes
+ * --------------------------------------------------------
+ * Huffman's algorithm, shared by both versions of
+ * buildEncodingTree.  buildTreeShape decides how the nodes
+ * merge; this just creates them in slot order and links them
+ * up.  Every character in the map gets a leaf, even one with
+ * a count of zero.
+ */
+static Node* mergeNodes(Map<ext_char, int>& frequencies, NodeArena* arena) {
+	uint64_t weights[NUM_SYMBOLS] = {0};
+	ext_char symbols[NUM_SYMBOLS];
+	int count = 0;
+	foreach (ext_char ch in frequencies) {
+		weights[ch] = frequencies.get(ch);
+		symbols[count++] = ch;
+	}
+	if (count == 0) error("Cannot build an encoding tree without any characters.");
+	TreeShape shape;
+	buildTreeShape(weights, symbols, count, shape);
+
+	Node* slots[2 * NUM_SYMBOLS];
+	for (int i = 0; i < count; i++) {
+		Node* leaf = newNode(arena);
+		leaf->character = shape.leaves[i];
+		leaf->weight = frequencies.get(shape.leaves[i]);
+		leaf->zero = NULL;
+		leaf->one = NULL;
+		slots[i] = leaf;
+	}
+	for (int i = 0; i + 1 < count; i++) {
+		Node* parent = newNode(arena);
+		parent->zero = slots[shape.zero[i]];
+		parent->one = slots[shape.one[i]];
+		parent->weight = parent->zero->weight + parent->one->weight;
+		parent->character = NOT_A_CHAR;
+		slots[count + i] = parent;
+	}
+	return slots[2 * count - 2];
 }
 
 /* Function: buildEncodingTree
@@ -45,30 +201,77 @@ Map<ext_char, int> getFrequencyTable(istream& file) {
  * be present.
  */
 Node* buildEncodingTree(Map<ext_char, int>& frequencies) {
-	PriorityQueue<Node*> pq;
-	// Create all Nodes and put them into the priority queue
-	foreach(ext_char ch in frequencies){
-		Node* newNode = new Node;
-		newNode->character = ch;
-		newNode->weight = frequencies.get(ch);
-		newNode->zero = NULL;
-		newNode->one = NULL;
-		pq.enqueue(newNode, frequencies.get(ch));
-	}
-	// Merge all Nodes using Huffman algorithm, until only 1 node is left
-	while(pq.size() > 1){
-		Node* zeroNode = pq.dequeue();
-		Node* oneNode = pq.dequeue();
-		Node* parent = new Node;
-		int weight = zeroNode->weight + oneNode->weight;
-		parent->weight = weight;
-		parent->zero = zeroNode;
-		parent->one = oneNode;
-		parent->character = NOT_A_CHAR;
-		pq.enqueue(parent, weight);
+	return mergeNodes(frequencies, NULL);
+}
+
+/* Function: buildEncodingTree
+ * Usage: Node* tree = buildEncodingTree(frequency, arena);
+ * --------------------------------------------------------
+ * The same tree as above, with its nodes taken from arena.
+ */
+Node* buildEncodingTree(Map<ext_char, int>& frequencies, NodeArena& arena) {
+	return mergeNodes(frequencies, &arena);
+}
+
+/* Function: buildLimitedEncodingTree
+ * Usage: Node* tree = buildLimitedEncodingTree(frequency, 12);
+ * --------------------------------------------------------
+ * Computes length-limited canonical codes, then grows a tree
+ * along each code's path.  Internal weights are summed on
+ * the way down so the tree looks like any other.
+ */
+Node* buildLimitedEncodingTree(Map<ext_char, int>& frequencies, int maxLength) {
+	uint64_t weights[NUM_SYMBOLS] = {0};
+	foreach (ext_char ch in frequencies) {
+		weights[ch] = frequencies.get(ch);
+	}
+	EncodeTable table;
+	buildLimitedCodeLengths(weights, maxLength, table);
+	assignCanonicalCodes(table);
+
+	Node* root = new Node;
+	root->character = NOT_A_CHAR;
+	root->zero = root->one = NULL;
+	root->weight = 0;
+
+	foreach (ext_char ch in frequencies) {
+		Node* curr = root;
+		curr->weight += frequencies.get(ch);
+		for (int bit = 0; bit < table.lengths[ch]; bit++) {
+			Node*& child = ((table.codes[ch] >> bit) & 1)? curr->one : curr->zero;
+			if (child == NULL) {
+				child = new Node;
+				child->character = NOT_A_CHAR;
+				child->zero = child->one = NULL;
+				child->weight = 0;
+			}
+			curr = child;
+			curr->weight += frequencies.get(ch);
+		}
+		curr->character = ch;
 	}
-	// Return one and only root node that left in queue
-	return pq.dequeue();
+	return root;
+}
+
+/* Function: buildCanonicalTable
+ * Usage: buildCanonicalTable(weights, maxCodeLength, table);
+ * --------------------------------------------------------
+ * Chooses code lengths for the weights, then assigns their
+ * canonical codes.
+ */
+void buildCanonicalTable(const uint64_t weights[NUM_SYMBOLS], int maxCodeLength, EncodeTable& table) {
+	uint64_t total = 0;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		total += weights[ch];
+	}
+	if (maxCodeLength == 0 && total > UINT32_MAX) maxCodeLength = MAX_CODE_LENGTH;
+
+	if (maxCodeLength > 0) {
+		buildLimitedCodeLengths(weights, maxCodeLength, table);
+	} else {
+		buildCodeLengths(weights, table);
+	}
+	assignCanonicalCodes(table);
 }
 
 /* Function: freeTree
@@ -89,8 +292,8 @@ void freeTree(Node* root) {
  * Usage: encodeFile(source, encodingTree, output);
  * --------------------------------------------------------
  * Encodes the given file using the encoding specified by the
- * given encoding tree, then writes the result one bit at a
- * time to the specified output file.
+ * given encoding tree, then writes the resulting bits to the
+ * specified output file.
  *
  * This function can assume the following:
  *
@@ -104,23 +307,63 @@ void freeTree(Node* root) {
  *     without seeking the file anywhere.
  */ 
 void encodeFile(istream& infile, Node* encodingTree, obstream& outfile) {
-	Map<ext_char, string> encodedChars;
-	getEncodedMap(encodingTree, encodedChars, "");
-
-	char tmpChar;
-	while(infile.get(tmpChar)){
-		string code = encodedChars.get(tmpChar);
-		for (int i = 0; i < code.size(); i++){
-			int bit = code[i] - '0';
-			outfile.writeBit(bit);
-		}
+	EncodeTable table;
+	buildEncodeTable(encodingTree, table);
+	encodeFile(infile, table, outfile);
+}
+
+/* Function: encodeFile
+ * Usage: encodeFile(source, encodeTable, output);
+ * --------------------------------------------------------
+ * Encodes the given file with a prebuilt code table, reading
+ * it in blocks (or straight from memory, if it is mapped) and
+ * packing each code with one writeBits call.
+ */
+void encodeFile(istream& infile, const EncodeTable& table, obstream& outfile) {
+	encodeStream(infile, table, outfile);
+	outfile.writeBits(table.codes[PSEUDO_EOF], table.lengths[PSEUDO_EOF]);
+	outfile.flushBits();
+}
+
+/* Function: encodeBytes
+ * Usage: encodeBytes(data, length, table, output);
+ * --------------------------------------------------------
+ * Packs the codes with the fastest kernel this machine has
+ * (see HuffmanSimd.h).
+ */
+void encodeBytes(const char* data, size_t length, const EncodeTable& table, obstream& outfile) {
+	packCodes(data, length, table, outfile, bestEncodeKernel());
+}
+
+/* Function: encodeInterleaved
+ * Usage: encodeInterleaved(data, length, table, 4, output);
+ * --------------------------------------------------------
+ * Encodes each stream in its own pass over the data, then
+ * writes the sizes and the streams.
+ */
+void encodeInterleaved(const char* data, size_t length, const EncodeTable& table,
+                       int numStreams, obstream& outfile) {
+	if (numStreams < 1 || numStreams > MAX_STREAMS) {
+		error("Stream count must be between 1 and " + integerToString(MAX_STREAMS) + ".");
 	}
-	string code = encodedChars.get(PSEUDO_EOF);
-	for (int i = 0; i < code.size(); i++){
-		int bit = code[i] - '0';
-		outfile.writeBit(bit);
+	string streams[MAX_STREAMS];
+	for (int j = 0; j < numStreams; j++) {
+		ostringbstream stream;
+		for (size_t i = j; i < length; i += numStreams) {
+			unsigned char ch = (unsigned char)data[i];
+			stream.writeBits(table.codes[ch], table.lengths[ch]);
+		}
+		streams[j] = stream.str();
 	}
 
+	outfile.flushBits();
+	outfile.writeBits(numStreams, 8);
+	for (int j = 0; j < numStreams; j++) {
+		outfile.writeBits(streams[j].size(), 32);
+	}
+	for (int j = 0; j < numStreams; j++) {
+		outfile.writeBytes(streams[j].data(), streams[j].size());
+	}
 }
 
 void getEncodedMap(Node* tree, Map<ext_char, string> & mp, string code){
@@ -145,25 +388,158 @@ void getEncodedMap(Node* tree, Map<ext_char, string> & mp, string code){
  *   - The output file is open and ready for writing.
  */
 void decodeFile(ibstream& infile, Node* encodingTree, ostream& file) {
-	Map<string, ext_char> decodedBits;
-	getDecodedMap(encodingTree, decodedBits, "");
-		
-	string currCode = "";
+	DecodeTable table;
+	buildDecodeTable(encodingTree, table);
+	decodeFile(infile, table, file);
+}
 
-	while(true){
-		int bit = infile.readBit();
-	
-		currCode+= integerToString(bit);
-		if(decodedBits.containsKey(currCode)){
-			if(decodedBits.get(currCode) == PSEUDO_EOF) {
-				return;	
+/* Function: decodeFile
+ * Usage: decodeFile(encodedFile, decodeTable, resultFile);
+ * --------------------------------------------------------
+ * Decodes with a prebuilt decode table until PSEUDO_EOF.
+ */
+void decodeFile(ibstream& infile, const DecodeTable& table, ostream& file) {
+	char buffer[DECODE_BUFFER_SIZE];
+	int used = 0;
+
+	while (true) {
+		ext_char ch = decodeSymbol(infile, table);
+		if (infile.fail()) error("Encoded data ended before PSEUDO_EOF was found.");
+		if (ch == PSEUDO_EOF) break;
+
+		buffer[used++] = char(ch);
+		if (used == DECODE_BUFFER_SIZE) {
+			file.write(buffer, used);
+			used = 0;
+		}
+	}
+	file.write(buffer, used);
+	infile.alignBits();
+}
+/* Function: decodeBytes
+ * Usage: size_t n = decodeBytes(encodedFile, decodeTable, buffer, capacity);
+ * --------------------------------------------------------
+ * Decodes characters straight into buffer until PSEUDO_EOF,
+ * refusing to write more than capacity of them.
+ */
+size_t decodeBytes(ibstream& infile, const DecodeTable& table, char* buffer, size_t capacity) {
+	size_t used = 0;
+	while (true) {
+		ext_char ch = decodeSymbol(infile, table);
+		if (infile.fail()) error("Encoded data ended before PSEUDO_EOF was found.");
+		if (ch == PSEUDO_EOF) return used;
+		if (used == capacity) error("Encoded data decodes to more characters than expected.");
+		buffer[used++] = char(ch);
+	}
+}
+
+/* Function: decodeCounted
+ * Usage: decodeCounted(encodedFile, decodeTable, buffer, length);
+ * --------------------------------------------------------
+ * Characters are OR-ed together, as in decodeInterleaved, so
+ * the only test inside the loop is the count.
+ */
+void decodeCounted(ibstream& infile, const DecodeTable& table, char* buffer, size_t length) {
+	ext_char seen = 0;
+	for (size_t i = 0; i < length; i++) {
+		ext_char ch = decodeSymbol(infile, table);
+		buffer[i] = char(ch);
+		seen |= ch;
+	}
+	if (seen > 255) error("Encoded data holds a character that is not a byte.");
+	if (infile.fail()) error("Encoded data ended before all of its characters were found.");
+}
+
+/* Function: decodeInterleaved
+ * Usage: decodeInterleaved(encodedFile, table, buffer, length);
+ * --------------------------------------------------------
+ * Gives every stream its own imembstream, and so its own bit
+ * buffer.  The four-stream case is spelled out so that the
+ * compiler sees four independent lookups per iteration.
+ * Characters are OR-ed together so PSEUDO_EOF (or anything
+ * else past 255) can be caught once, after the loop.
+ */
+void decodeInterleaved(ibstream& infile, const DecodeTable& table, char* buffer, size_t length) {
+	infile.alignBits();
+	int numStreams = int(infile.readBits(8));
+	if (infile.fail() || numStreams < 1 || numStreams > MAX_STREAMS) error("Interleaved data has a bad stream count.");
+
+	size_t sizes[MAX_STREAMS];
+	uint64_t total = 0;
+	for (int j = 0; j < numStreams; j++) {
+		sizes[j] = size_t(infile.readBits(32));
+		total += sizes[j];
+	}
+	if (infile.fail()) error("Interleaved data is truncated.");
+
+	/* The sizes are only trusted as far as the data backs them
+	 * up.  In memory the streams are read in place; otherwise
+	 * they are gathered into one buffer a piece at a time, so a
+	 * damaged size runs out of data before it runs out of memory.
+	 */
+	const char* data;
+	string bytes;
+	imembstream* memory = dynamic_cast<imembstream*>(&infile);
+	if (memory != NULL && memory->is_open()) {
+		infile.alignBits();
+		streampos position = infile.tellg();
+		if (position == streampos(-1) || total > memory->length() - size_t(position)) {
+			error("Interleaved data is truncated.");
+		}
+		data = memory->data() + size_t(position);
+		infile.seekg(position + streamoff(total));
+	} else {
+		while (bytes.size() < total) {
+			size_t start = bytes.size();
+			bytes.resize(start + size_t(min(total - start, uint64_t(INTERLEAVED_CHUNK_SIZE))));
+			if (infile.readBytes(&bytes[start], bytes.size() - start) != bytes.size() - start) {
+				error("Interleaved data is truncated.");
 			}
+		}
+		data = bytes.data();
+	}
 
-			file.put(decodedBits.get(currCode));
-			currCode = "";
+	imembstream streams[MAX_STREAMS];
+	for (int j = 0; j < numStreams; j++) {
+		streams[j].reset(data, sizes[j]);
+		data += sizes[j];
+	}
+
+	ext_char seen = 0;
+	size_t i = 0, rounds = length / numStreams;
+	if (numStreams == 4) {
+		for (size_t r = 0; r < rounds; r++, i += 4) {
+			ext_char a = decodeSymbol(streams[0], table);
+			ext_char b = decodeSymbol(streams[1], table);
+			ext_char c = decodeSymbol(streams[2], table);
+			ext_char d = decodeSymbol(streams[3], table);
+			buffer[i] = char(a);
+			buffer[i + 1] = char(b);
+			buffer[i + 2] = char(c);
+			buffer[i + 3] = char(d);
+			seen |= a | b | c | d;
+		}
+	} else {
+		for (size_t r = 0; r < rounds; r++) {
+			for (int j = 0; j < numStreams; j++, i++) {
+				ext_char ch = decodeSymbol(streams[j], table);
+				buffer[i] = char(ch);
+				seen |= ch;
+			}
 		}
 	}
+	for (int j = 0; i < length; j++, i++) {
+		ext_char ch = decodeSymbol(streams[j], table);
+		buffer[i] = char(ch);
+		seen |= ch;
+	}
+
+	if (seen > 255) error("Interleaved data holds a character that is not a byte.");
+	for (int j = 0; j < numStreams; j++) {
+		if (streams[j].fail()) error("Interleaved stream " + integerToString(j) + " is truncated.");
+	}
 }
+
 void getDecodedMap(Node* tree, Map<string, ext_char> & mp, string code){
 	if(tree == NULL) return;
 	if(tree->character!=NOT_A_CHAR){
@@ -280,15 +656,225 @@ Map<ext_char, int> readFileHeader(ibstream& infile) {
  * primarily be glue code.
  */
 void compress(ibstream& infile, obstream& outfile) {
-	Map<ext_char, int> charCount = getFrequencyTable(infile);
+	compress(infile, outfile, HuffmanOptions());
+}
+
+/* Function: addCounts
+ * --------------------------------------------------------
+ * Adds input whose character counts are weights, coded with
+ * table, to stats if there are any.
+ */
+static void addCounts(HuffmanStats* stats, const uint64_t weights[NUM_SYMBOLS], const EncodeTable& table) {
+	if (stats == NULL) return;
+	for (int ch = 0; ch < 256; ch++) {
+		stats->bytesIn += weights[ch];
+	}
+	stats->addCodes(weights, table);
+}
+
+/* Function: compressCounted
+ * --------------------------------------------------------
+ * Writes infile in FORMAT_COUNTED.  A complete code needs at
+ * least two characters, so input with fewer distinct bytes
+ * keeps PSEUDO_EOF in its table as a placeholder; it is never
+ * written.
+ */
+static void compressCounted(ibstream& infile, obstream& outfile, const HuffmanOptions& options) {
+	StageTimer counting(options.stats, &HuffmanStats::countSeconds);
+	uint64_t weights[NUM_SYMBOLS] = {0};
+	countStream(infile, weights);
+	infile.rewind();
+
+	uint64_t length = 0;
+	int distinct = 0;
+	for (int ch = 0; ch < 256; ch++) {
+		length += weights[ch];
+		if (weights[ch] != 0) distinct++;
+	}
+	if (distinct < 2) weights[PSEUDO_EOF] = 1;
+	counting.stop();
+
+	StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+	EncodeTable table;
+	buildCanonicalTable(weights, options.maxCodeLength, table);
+	building.stop();
+
+	StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+	outfile.writeBits(COUNTED_TAG, 8);
+	outfile.writeBits(length, 64);
+	writeCodeLengths(outfile, table);
+	header.stop();
+
+	StageTimer encoding(options.stats, &HuffmanStats::encodeSeconds);
+	encodeStream(infile, table, outfile);
+	outfile.flushBits();
+	encoding.stop();
+
+	weights[PSEUDO_EOF] = 0;
+	addCounts(options.stats, weights, table);
+}
+
+/* Function: decompressCounted
+ * --------------------------------------------------------
+ * Decodes a FORMAT_COUNTED file through one buffer, sized
+ * for the whole file unless it is larger than
+ * COUNTED_BUFFER_SIZE.
+ */
+static void decompressCounted(ibstream& infile, ostream& outfile, const HuffmanOptions& options) {
+	StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+	infile.readBits(8);
+	uint64_t length = infile.readBits(64);
+	EncodeTable codes;
+	readCodeLengths(infile, codes);
+	if (infile.fail()) error("FORMAT_COUNTED header is truncated.");
+	header.stop();
+
+	StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+	std::shared_ptr<const CachedTables> cached;
+	DecodeTable built;
+	if (options.tableCache != NULL) {
+		cached = options.tableCache->lookup(codes);
+	} else {
+		buildDecodeTable(codes, built);
+	}
+	const DecodeTable& table = cached ? cached->decodeTable : built;
+	building.stop();
+
+	StageTimer decoding(options.stats, &HuffmanStats::decodeSeconds);
+	std::vector<char> buffer(size_t(std::min(length, uint64_t(COUNTED_BUFFER_SIZE))));
+	while (length > 0) {
+		size_t count = size_t(std::min(length, uint64_t(buffer.size())));
+		decodeCounted(infile, table, &buffer[0], count);
+		outfile.write(&buffer[0], count);
+		length -= count;
+	}
+	infile.alignBits();
+}
+
+/* Function: compressFormat
+ * --------------------------------------------------------
+ * Compresses infile in the format chosen by options.  The
+ * canonical format keeps only the code lengths of the tree
+ * and writes them, together with the data, as one bitstream.
+ * It counts with 64-bit weights throughout; only the
+ * frequency header, whose counts are ints, has to scale
+ * them (see getFrequencyTable).
+ */
+static void compressFormat(ibstream& infile, obstream& outfile, const HuffmanOptions& options) {
+	if (options.format == FORMAT_BLOCKS) {
+		compressBlocks(infile, outfile, options);
+		return;
+	}
+	if (options.format == FORMAT_DICTIONARY) {
+		if (options.dictionary == NULL) error("FORMAT_DICTIONARY needs a dictionary.");
+		const char* mapped;
+		size_t mappedLength = 0;
+		bool inMemory = options.stats != NULL && mappedBytes(infile, mapped, mappedLength);
+		long long start = (options.stats != NULL && !inMemory)? infile.tellBits() : -1;
+
+		StageTimer encoding(options.stats, &HuffmanStats::encodeSeconds);
+		compressWithDictionary(infile, outfile, *options.dictionary);
+		encoding.stop();
 
-	Node* root =  buildEncodingTree(charCount);
-	writeFileHeader(outfile, charCount);
+		if (options.stats != NULL) {
+			long long end = inMemory? -1 : infile.tellBits();
+			options.stats->bytesIn += (start >= 0 && end >= 0)? uint64_t(end - start) / 8 : mappedLength;
+		}
+		return;
+	}
+	if (options.format == FORMAT_COUNTED) {
+		compressCounted(infile, outfile, options);
+		return;
+	}
+	if (options.format == FORMAT_CONTEXT) {
+		compressWithContexts(infile, outfile, options);
+		return;
+	}
+
+	StageTimer counting(options.stats, &HuffmanStats::countSeconds);
+	uint64_t weights[NUM_SYMBOLS] = {0};
+	countStream(infile, weights);
 	infile.rewind();
+	weights[PSEUDO_EOF] = 1;
+	counting.stop();
+
+	EncodeTable table;
+	if (options.format == FORMAT_CANONICAL) {
+		StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+		buildCanonicalTable(weights, options.maxCodeLength, table);
+		building.stop();
+
+		StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+		outfile.writeBits(CANONICAL_TAG, 8);
+		writeCodeLengths(outfile, table);
+		header.stop();
+
+		StageTimer encoding(options.stats, &HuffmanStats::encodeSeconds);
+		encodeFile(infile, table, outfile);
+	} else {
+		StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+		Map<ext_char, int> charCount = getFrequencyTable(weights);
+		NodeArena arena;
+		Node* root = buildEncodingTree(charCount, arena);
+		building.stop();
 
-	encodeFile(infile, root, outfile);
-	freeTree(root);
+		StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+		writeFileHeader(outfile, charCount);
+		header.stop();
 
+		StageTimer encoding(options.stats, &HuffmanStats::encodeSeconds);
+		encodeFile(infile, root, outfile);
+		encoding.stop();
+		if (options.stats != NULL) buildEncodeTable(root, table);
+	}
+	addCounts(options.stats, weights, table);
+}
+
+/* Function: addOutput
+ * --------------------------------------------------------
+ * Adds what a compressor wrote to outfile since its position
+ * was start, and the nodes allocated since there were
+ * allocated, to stats.
+ */
+static void addOutput(HuffmanStats* stats, obstream& outfile, long long start, long allocated) {
+	long long end = outfile.tellBits();
+	if (start >= 0 && end >= 0) stats->bytesOut += uint64_t(end - start + 7) / 8;
+	stats->allocations += numAllocations() - allocated;
+}
+
+/* Function: compress
+ * Usage: compress(infile, outfile, options);
+ * --------------------------------------------------------
+ * Takes the output position and the allocation count before
+ * and after, if there are stats, and leaves the rest to
+ * compressFormat.
+ */
+void compress(ibstream& infile, obstream& outfile, const HuffmanOptions& options) {
+	if (options.stats == NULL) {
+		compressFormat(infile, outfile, options);
+		return;
+	}
+	long long start = outfile.tellBits();
+	long allocated = numAllocations();
+	compressFormat(infile, outfile, options);
+	addOutput(options.stats, outfile, start, allocated);
+}
+
+/* Function: compressStream
+ * Usage: compressStream(cin, outfile, options);
+ * --------------------------------------------------------
+ * The block container only ever needs one block of input at
+ * a time, so it can be written straight from a stream.
+ */
+void compressStream(istream& infile, obstream& outfile, const HuffmanOptions& options) {
+	if (options.stats == NULL) {
+		compressBlocks(infile, outfile, options);
+		return;
+	}
+	long long start = outfile.tellBits();
+	long allocated = numAllocations();
+	compressBlocks(infile, outfile, options);
+	addOutput(options.stats, outfile, start, allocated);
 }
 
 /* Function: decompress
@@ -304,10 +890,257 @@ void compress(ibstream& infile, obstream& outfile) {
  * primarily be glue code.
  */
 void decompress(ibstream& infile, ostream& outfile) {
-	Map<ext_char, int> charCount = readFileHeader(infile);
-    Node* root = buildEncodingTree(charCount);
-    decodeFile(infile, root, outfile);
-
-    freeTree(root);
+	decompress(infile, outfile, HuffmanOptions());
 }
 
+/* Function: decompressFormat
+ * --------------------------------------------------------
+ * Tells the formats apart by their first byte: the tagged
+ * formats start with a tag, while a frequency header starts
+ * with the character count.  With a table cache the header
+ * is only read, and its tables are built at most once.
+ */
+static void decompressFormat(ibstream& infile, ostream& outfile, const HuffmanOptions& options) {
+	int tag = infile.peek();
+	if (tag == BLOCKS_TAG) {
+		decompressBlocks(infile, outfile, options);
+		return;
+	}
+	if (tag == COUNTED_TAG) {
+		decompressCounted(infile, outfile, options);
+		return;
+	}
+	if (tag == CONTEXT_TAG) {
+		decompressWithContexts(infile, outfile, options);
+		return;
+	}
+	if (tag == DICTIONARY_TAG) {
+		if (options.dictionary == NULL) error("File was compressed with a dictionary, but none was given.");
+		StageTimer decoding(options.stats, &HuffmanStats::decodeSeconds);
+		decompressWithDictionary(infile, outfile, *options.dictionary);
+		return;
+	}
+
+	std::shared_ptr<const CachedTables> cached;
+	DecodeTable built;
+	if (tag == CANONICAL_TAG) {
+		StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+		infile.readBits(8);
+		EncodeTable codes;
+		readCodeLengths(infile, codes);
+		header.stop();
+
+		StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+		if (options.tableCache != NULL) {
+			cached = options.tableCache->lookup(codes);
+		} else {
+			buildDecodeTable(codes, built);
+		}
+	} else {
+		StageTimer header(options.stats, &HuffmanStats::headerSeconds);
+		Map<ext_char, int> charCount = readFileHeader(infile);
+		header.stop();
+
+		StageTimer building(options.stats, &HuffmanStats::treeSeconds);
+		if (options.tableCache != NULL) {
+			cached = options.tableCache->lookup(charCount);
+		} else {
+			NodeArena arena;
+			buildDecodeTable(buildEncodingTree(charCount, arena), built);
+		}
+	}
+
+	StageTimer decoding(options.stats, &HuffmanStats::decodeSeconds);
+	decodeFile(infile, cached ? cached->decodeTable : built, outfile);
+}
+
+/* Function: decompress
+ * Usage: decompress(infile, outfile, options);
+ * --------------------------------------------------------
+ * As compress, measures the streams before and after for
+ * stats and leaves the rest to decompressFormat.  What was
+ * read comes from the input position, and what was written
+ * from the position of the output's buffer.
+ */
+void decompress(ibstream& infile, ostream& outfile, const HuffmanOptions& options) {
+	if (options.stats == NULL) {
+		decompressFormat(infile, outfile, options);
+		return;
+	}
+	long long start = infile.tellBits();
+	streampos written = (outfile.rdbuf() == NULL)? streampos(-1) : outfile.rdbuf()->pubseekoff(0, ios::cur, ios::out);
+	long allocated = numAllocations();
+	decompressFormat(infile, outfile, options);
+
+	long long end = infile.tellBits();
+	if (start >= 0 && end >= 0) options.stats->bytesIn += uint64_t(end - start + 7) / 8;
+	if (written != streampos(-1)) {
+		streampos now = outfile.rdbuf()->pubseekoff(0, ios::cur, ios::out);
+		if (now != streampos(-1)) options.stats->bytesOut += uint64_t(now - written);
+	}
+	options.stats->allocations += numAllocations() - allocated;
+}
+
+/* Class: CountingSink
+ * --------------------------------------------------------
+ * A stream buffer that throws away what it is written, and
+ * counts it.
+ */
+class CountingSink: public streambuf {
+public:
+	CountingSink() : count(0) {}
+
+	uint64_t written() const {
+		return count;
+	}
+
+protected:
+	virtual int_type overflow(int_type ch) {
+		if (ch != traits_type::eof()) count++;
+		return traits_type::not_eof(ch);
+	}
+
+	virtual streamsize xsputn(const char*, streamsize length) {
+		count += uint64_t(length);
+		return length;
+	}
+
+private:
+	uint64_t count;
+};
+
+/* Function: verify
+ * Usage: uint64_t length = verify(infile, options);
+ * --------------------------------------------------------
+ * Block containers go to verifyBlocks; everything else is
+ * decompressed into a CountingSink.
+ */
+uint64_t verify(ibstream& infile, const HuffmanOptions& options) {
+	if (infile.peek() == BLOCKS_TAG) return verifyBlocks(infile);
+	CountingSink sink;
+	ostream discard(&sink);
+	decompressFormat(infile, discard, options);
+	return sink.written();
+}
+
+/* Class: RangeSink
+ * --------------------------------------------------------
+ * A stream buffer that passes on only the bytes it is
+ * written between two positions, and counts them.
+ */
+class RangeSink: public streambuf {
+public:
+	RangeSink(ostream& target, uint64_t offset, uint64_t length)
+		: target(target), position(0), offset(offset), end(offset + std::min(length, UINT64_MAX - offset)),
+		  passed(0) {}
+
+	uint64_t written() const {
+		return passed;
+	}
+
+protected:
+	virtual int_type overflow(int_type ch) {
+		if (ch == traits_type::eof()) return traits_type::not_eof(ch);
+		char byte = char(ch);
+		xsputn(&byte, 1);
+		return ch;
+	}
+
+	virtual streamsize xsputn(const char* data, streamsize count) {
+		uint64_t from = std::max(position, offset), to = std::min(position + uint64_t(count), end);
+		if (from < to) {
+			target.write(data + (from - position), streamsize(to - from));
+			passed += to - from;
+		}
+		position += uint64_t(count);
+		return count;
+	}
+
+private:
+	ostream& target;
+	uint64_t position, offset, end, passed;
+};
+
+/* Function: decompressRange
+ * Usage: uint64_t n = decompressRange(infile, offset, length, outfile, options);
+ * --------------------------------------------------------
+ * Leaves indexed block containers to decompressBlockRange;
+ * everything else goes through decompress into a RangeSink.
+ */
+uint64_t decompressRange(ibstream& infile, uint64_t offset, uint64_t length, ostream& outfile,
+                         const HuffmanOptions& options) {
+	uint64_t written = 0;
+	if (infile.peek() == BLOCKS_TAG &&
+	    decompressBlockRange(infile, offset, length, outfile, options, written)) {
+		return written;
+	}
+	RangeSink sink(outfile, offset, length);
+	ostream window(&sink);
+	decompressFormat(infile, window, options);
+	return sink.written();
+}
+
+/* Function: maxCompressedSize
+ * Usage: vector<char> buffer(maxCompressedSize(length, options));
+ * --------------------------------------------------------
+ * No optimal code, length-limited or not, costs more than
+ * the 9 bits per character of a fixed-length code for the
+ * NUM_SYMBOLS characters.  The frequency header holds at most
+ * a count and, per byte value, the byte, up to ten digits and
+ * a space; the canonical header at most a byte per character.
+ * A dictionary was not built for this data, so its longest
+ * code is the only bound.  The tables of FORMAT_CONTEXT are
+ * each optimal for the characters they code, so together
+ * they cost no more than 9 bits per character either.
+ */
+size_t maxCompressedSize(size_t length, const HuffmanOptions& options) {
+	if (options.format == FORMAT_BLOCKS) return maxBlocksSize(length, options);
+	if (options.format == FORMAT_COUNTED) return 1 + 8 + NUM_SYMBOLS + 1 + (9 * length + 7) / 8;
+	if (options.format == FORMAT_CONTEXT) {
+		return 2 + 128 + MAX_CONTEXT_TABLES * (NUM_SYMBOLS + 1) + (9 * (length + 1) + 7) / 8;
+	}
+	if (options.format == FORMAT_DICTIONARY) {
+		size_t longest = MAX_CODE_LENGTH;
+		if (options.dictionary != NULL) {
+			longest = 0;
+			for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+				longest = std::max(longest, size_t(options.dictionary->encodeTable.lengths[ch]));
+			}
+		}
+		return 5 + (longest * (length + 1) + 7) / 8;
+	}
+	size_t header = (options.format == FORMAT_CANONICAL)? 1 + NUM_SYMBOLS + 1 : 4 + 256 * 12;
+	return header + (9 * (length + 1) + 7) / 8;
+}
+
+/* Function: compressBuffer
+ * Usage: size_t used = compressBuffer(data, length, buffer, capacity, options);
+ * --------------------------------------------------------
+ * Wraps both spans in memory streams.  An imembstream is
+ * counted and encoded in place (see mappedBytes), and an
+ * omembstream goes bad instead of writing past its end.
+ */
+size_t compressBuffer(const char* source, size_t length, char* dest, size_t capacity,
+                      const HuffmanOptions& options) {
+	imembstream input(source, length);
+	omembstream output(dest, capacity);
+	compress(input, output, options);
+	size_t used = output.length();
+	if (!output) error("Output buffer is too small for the compressed data.");
+	return used;
+}
+
+/* Function: decompressBuffer
+ * Usage: size_t used = decompressBuffer(data, length, buffer, capacity, options);
+ * --------------------------------------------------------
+ * As compressBuffer, in the other direction.
+ */
+size_t decompressBuffer(const char* source, size_t length, char* dest, size_t capacity,
+                        const HuffmanOptions& options) {
+	imembstream input(source, length);
+	omembstream output(dest, capacity);
+	decompress(input, output, options);
+	size_t used = output.length();
+	if (!output) error("Output buffer is too small for the decompressed data.");
+	return used;
+}
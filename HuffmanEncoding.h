@@ -11,9 +11,187 @@
 #define HuffmanEncoding_Included
 
 #include "HuffmanTypes.h"
+#include "HuffmanTables.h"
+#include "NodeArena.h"
 #include "map.h"
 #include "bstream.h"
 
+/* Type: HuffmanFormat
+ * The file layouts compress can produce.  decompress tells
+ * them apart by the first byte of the file, so it does not
+ * need to be told which one it is reading.
+ */
+enum HuffmanFormat {
+	/* The original header of ASCII character/frequency pairs,
+	 * from which the decoder rebuilds the encoding tree.
+	 */
+	FORMAT_FREQUENCIES,
+
+	/* CANONICAL_TAG followed by a packed table of code lengths
+	 * (see writeCodeLengths).  Both sides derive canonical codes
+	 * from the lengths, so no tree is rebuilt when decoding.
+	 */
+	FORMAT_CANONICAL,
+
+	/* BLOCKS_TAG followed by independently coded blocks, each
+	 * with its own code length table (see HuffmanBlocks.h).
+	 * Blocks are compressed in parallel and the input is only
+	 * read once.
+	 */
+	FORMAT_BLOCKS,
+
+	/* DICTIONARY_TAG and the id of a pre-trained code table
+	 * (see HuffmanDictionary.h) that both sides already have,
+	 * so the file carries no table at all.
+	 */
+	FORMAT_DICTIONARY,
+
+	/* COUNTED_TAG, the number of bytes encoded and a packed
+	 * table of code lengths for the bytes alone.  With the count
+	 * known there is no PSEUDO_EOF to find, so the decoder runs
+	 * a counted loop and can size its output up front.
+	 */
+	FORMAT_COUNTED,
+
+	/* CONTEXT_TAG and a few code tables, each byte coded with
+	 * the table its predecessor selects (see HuffmanContext.h),
+	 * which suits text with strong pairings such as logs.
+	 */
+	FORMAT_CONTEXT
+};
+
+/* Constant: CANONICAL_TAG
+ * The first byte of a FORMAT_CANONICAL file.  A frequency
+ * header always starts with a digit, so it can't be confused
+ * with this.
+ */
+const char CANONICAL_TAG = 'C';
+
+/* Constant: BLOCKS_TAG
+ * The first byte of a FORMAT_BLOCKS file.
+ */
+const char BLOCKS_TAG = 'B';
+
+/* Constant: DICTIONARY_TAG
+ * The first byte of a FORMAT_DICTIONARY file.
+ */
+const char DICTIONARY_TAG = 'D';
+
+/* Constant: COUNTED_TAG
+ * The first byte of a FORMAT_COUNTED file.
+ */
+const char COUNTED_TAG = 'L';
+
+/* Constant: CONTEXT_TAG
+ * The first byte of a FORMAT_CONTEXT file.
+ */
+const char CONTEXT_TAG = 'O';
+
+/* Constant: DEFAULT_BLOCK_SIZE
+ * How much input goes into each block of a FORMAT_BLOCKS
+ * file unless HuffmanOptions says otherwise (1MiB).
+ */
+const int DEFAULT_BLOCK_SIZE = 1 << 20;
+
+/* Constant: MAX_STREAMS
+ * The most sub-streams encodeInterleaved will split data into.
+ */
+const int MAX_STREAMS = 8;
+
+/* Constant: MAX_CONTEXT_TABLES
+ * The most code tables a FORMAT_CONTEXT file may have.
+ */
+const int MAX_CONTEXT_TABLES = 16;
+
+struct HuffmanDictionary;
+struct HuffmanStats;
+class TableCache;
+
+/* Type: HuffmanOptions
+ * Settings for compress.  The defaults reproduce the
+ * original file format.
+ */
+struct HuffmanOptions {
+	/* Which file layout to write. */
+	HuffmanFormat format;
+
+	/* The longest code FORMAT_CANONICAL may use, or 0 for no
+	 * limit.  With a limit the lengths come from package-merge
+	 * (see buildLimitedCodeLengths) instead of buildEncodingTree.
+	 */
+	int maxCodeLength;
+
+	/* The number of input bytes per block in FORMAT_BLOCKS. */
+	int blockSize;
+
+	/* How many threads FORMAT_BLOCKS may use, or 0 for one per
+	 * hardware core.
+	 */
+	int numThreads;
+
+	/* How many interleaved sub-streams each FORMAT_BLOCKS block
+	 * is split into (see encodeInterleaved), from 1 to
+	 * MAX_STREAMS.  With 1 a block is a single stream ending in
+	 * PSEUDO_EOF.
+	 */
+	int numStreams;
+
+	/* A ceiling, in bytes, on the block buffers FORMAT_BLOCKS
+	 * holds at once while compressing or decompressing, or 0
+	 * for no ceiling.  Each block in flight costs about twice
+	 * the block size (its input and its encoding), and one
+	 * block is always in flight; a ceiling below two blocks per
+	 * thread leaves some threads idle.
+	 */
+	size_t maxMemory;
+
+	/* How many batches of blocks FORMAT_BLOCKS keeps in flight
+	 * while compressing or decompressing.  With 1, reading,
+	 * coding and writing a batch take turns.  With more, a
+	 * thread of its own reads batches ahead and another writes
+	 * finished ones behind while the others are coded, so slow
+	 * input or output hides behind the coding; 3 is enough to
+	 * overlap all three.  maxMemory is shared among the
+	 * batches.  The file written is the same either way.
+	 */
+	int pipelineDepth;
+
+	/* Whether a FORMAT_BLOCKS block may reuse the code table of
+	 * an earlier block when that takes fewer bits than sending
+	 * its own.
+	 */
+	bool reuseTables;
+
+	/* The most tables FORMAT_CONTEXT may split the previous
+	 * bytes among, from 1 to MAX_CONTEXT_TABLES.  Fewer are
+	 * used when more would not pay for their headers.
+	 */
+	int contextTables;
+
+	/* The pre-trained table FORMAT_DICTIONARY files are written
+	 * and read with, or NULL for none.  It is not copied, so it
+	 * must outlive the options.
+	 */
+	const HuffmanDictionary* dictionary;
+
+	/* Where decompress keeps the tables it builds, so that files
+	 * and blocks with the same header share them (see
+	 * TableCache.h), or NULL to build them every time.
+	 */
+	TableCache* tableCache;
+
+	/* Where compress and decompress add the time each stage
+	 * took and what they read and wrote (see HuffmanStats.h),
+	 * or NULL to measure nothing.
+	 */
+	HuffmanStats* stats;
+
+	HuffmanOptions() : format(FORMAT_FREQUENCIES), maxCodeLength(0),
+		blockSize(DEFAULT_BLOCK_SIZE), numThreads(0), numStreams(4), maxMemory(0),
+		pipelineDepth(1), reuseTables(true), contextTables(MAX_CONTEXT_TABLES), dictionary(NULL), tableCache(NULL),
+		stats(NULL) {}
+};
+
 /* Function: getFrequencyTable
  * Usage: Map<ext_char, int> freq = getFrequencyTable(file);
  * --------------------------------------------------------
@@ -29,6 +207,20 @@
  */
 Map<ext_char, int> getFrequencyTable(istream& file);
 
+/* Function: getFrequencyTable
+ * Usage: Map<ext_char, int> freq = getFrequencyTable(counts);
+ * --------------------------------------------------------
+ * As above, but from byte counts already tallied with
+ * countFrequencies.  A Map holds ints and so do the weights
+ * of Nodes, so if the counts (with PSEUDO_EOF) add up to more
+ * than INT_MAX they are all divided by the same factor, with
+ * every character that occurs kept at a weight of at least
+ * one.  The tree built from the result is then slightly less
+ * than optimal, but valid, and since the scaled weights are
+ * what the header records, the decoder builds the same tree.
+ */
+Map<ext_char, int> getFrequencyTable(const uint64_t counts[256]);
+
 /* Function: buildEncodingTree
  * Usage: Node* tree = buildEncodingTree(frequency);
  * --------------------------------------------------------
@@ -42,6 +234,38 @@ Map<ext_char, int> getFrequencyTable(istream& file);
  */
 Node* buildEncodingTree(Map<ext_char, int>& frequencies);
 
+/* Function: buildEncodingTree
+ * Usage: Node* tree = buildEncodingTree(frequency, arena);
+ * --------------------------------------------------------
+ * As above, but the nodes come from arena.  The tree is freed
+ * by releasing the arena, not with freeTree.
+ */
+Node* buildEncodingTree(Map<ext_char, int>& frequencies, NodeArena& arena);
+
+/* Function: buildLimitedEncodingTree
+ * Usage: Node* tree = buildLimitedEncodingTree(frequency, 12);
+ * --------------------------------------------------------
+ * Like buildEncodingTree, but no leaf of the returned tree is
+ * deeper than maxLength.  Among all such trees this one has
+ * the lowest cost; its shape is the canonical code for the
+ * lengths chosen by buildLimitedCodeLengths.  Free it with
+ * freeTree as usual.
+ */
+Node* buildLimitedEncodingTree(Map<ext_char, int>& frequencies, int maxLength);
+
+/* Function: buildCanonicalTable
+ * Usage: buildCanonicalTable(weights, maxCodeLength, table);
+ * --------------------------------------------------------
+ * Fills table with canonical codes for the given character
+ * weights (zero meaning absent).  If maxCodeLength is zero
+ * the lengths come from buildCodeLengths, which matches the
+ * tree buildEncodingTree builds; otherwise they come from
+ * buildLimitedCodeLengths with that limit.  Weights past 32
+ * bits can make an unlimited tree deeper than MAX_CODE_LENGTH,
+ * so for those the limit is MAX_CODE_LENGTH.
+ */
+void buildCanonicalTable(const uint64_t weights[NUM_SYMBOLS], int maxCodeLength, EncodeTable& table);
+
 /* Function: freeTree
  * Usage: freeTree(encodingTree);
  * --------------------------------------------------------
@@ -54,8 +278,8 @@ void freeTree(Node* root);
  * Usage: encodeFile(source, encodingTree, output);
  * --------------------------------------------------------
  * Encodes the given file using the encoding specified by the
- * given encoding tree, then writes the result one bit at a
- * time to the specified output file.
+ * given encoding tree, then writes the resulting bits to the
+ * specified output file.
  *
  * This function can assume the following:
  *
@@ -69,6 +293,41 @@ void freeTree(Node* root);
  *     without seeking the file anywhere.
  */
 void encodeFile(istream& infile, Node* encodingTree, obstream& outfile);
+
+/* Function: encodeFile
+ * Usage: encodeFile(source, encodeTable, output);
+ * --------------------------------------------------------
+ * As above, but encodes with a code table that has already
+ * been built, such as a canonical one.
+ */
+void encodeFile(istream& infile, const EncodeTable& table, obstream& outfile);
+
+/* Function: encodeBytes
+ * Usage: encodeBytes(data, length, encodeTable, output);
+ * --------------------------------------------------------
+ * Writes the codes of the given bytes to outfile.  Unlike
+ * encodeFile, no PSEUDO_EOF is written and the bits are not
+ * flushed, so a caller can encode data in pieces.
+ */
+void encodeBytes(const char* data, size_t length, const EncodeTable& table, obstream& outfile);
+
+/* Function: encodeInterleaved
+ * Usage: encodeInterleaved(data, length, encodeTable, 4, output);
+ * --------------------------------------------------------
+ * Encodes data as numStreams separate bitstreams, byte i
+ * going to stream i % numStreams, so that a decoder can work
+ * on several streams at once instead of waiting for each code
+ * to be resolved before it knows where the next one starts.
+ * outfile is first padded to a byte boundary, then gets
+ *
+ *   stream count           1 byte
+ *   stream sizes           4 bytes each, little-endian
+ *   the streams, each padded to a whole byte
+ *
+ * No PSEUDO_EOF is written; the decoder must be told length.
+ */
+void encodeInterleaved(const char* data, size_t length, const EncodeTable& table,
+                       int numStreams, obstream& outfile);
 /*
 	Function: getEncodedMap
 	Usage: getEncodedMap(tree, map, code);
@@ -91,6 +350,44 @@ void getEncodedMap(Node* tree, Map<ext_char, string> & mp, string code);
  *   - The output file is open and ready for writing.
  */
 void decodeFile(ibstream& infile, Node* encodingTree, ostream& file);
+
+/* Function: decodeFile
+ * Usage: decodeFile(encodedFile, decodeTable, resultFile);
+ * --------------------------------------------------------
+ * As above, but decodes with a decode table that has already
+ * been built, such as one derived from canonical code lengths.
+ */
+void decodeFile(ibstream& infile, const DecodeTable& table, ostream& file);
+
+/* Function: decodeBytes
+ * Usage: size_t n = decodeBytes(encodedFile, decodeTable, buffer, capacity);
+ * --------------------------------------------------------
+ * Decodes into memory instead of a stream, stopping at
+ * PSEUDO_EOF, and returns the number of characters decoded.
+ * Reports an error if there are more than capacity of them.
+ */
+size_t decodeBytes(ibstream& infile, const DecodeTable& table, char* buffer, size_t capacity);
+
+/* Function: decodeCounted
+ * Usage: decodeCounted(encodedFile, decodeTable, buffer, length);
+ * --------------------------------------------------------
+ * Decodes exactly length characters into buffer without
+ * testing each one for PSEUDO_EOF.  Reports an error,
+ * once the loop is done, if the data ran out or held a
+ * character that is not a byte.
+ */
+void decodeCounted(ibstream& infile, const DecodeTable& table, char* buffer, size_t length);
+
+/* Function: decodeInterleaved
+ * Usage: decodeInterleaved(encodedFile, decodeTable, buffer, length);
+ * --------------------------------------------------------
+ * Decodes exactly length characters written by
+ * encodeInterleaved into buffer, resolving one code from
+ * each stream per step.  Bits left in a partially read byte
+ * of infile are skipped first.  Reports an error if a stream
+ * runs short or holds PSEUDO_EOF.
+ */
+void decodeInterleaved(ibstream& infile, const DecodeTable& table, char* buffer, size_t length);
 void getDecodedMap(Node* tree, Map<string, ext_char> & mp, string code);
 
 /* Function: writeFileHeader
@@ -137,6 +434,25 @@ Map<ext_char, int> readFileHeader(ibstream& infile);
  */
 void compress(ibstream& infile, obstream& outfile);
 
+/* Function: compress
+ * Usage: compress(infile, outfile, options);
+ * --------------------------------------------------------
+ * As above, but writes the file layout chosen in options.
+ */
+void compress(ibstream& infile, obstream& outfile, const HuffmanOptions& options);
+
+/* Function: compressStream
+ * Usage: compressStream(cin, outfile, options);
+ * --------------------------------------------------------
+ * Compresses infile in FORMAT_BLOCKS, whatever options.format
+ * says, reading it exactly once and never seeking, so infile
+ * may be a pipe, a socket or standard input.  Memory use is
+ * bounded by options.blockSize, numThreads and maxMemory and
+ * does not grow with the input, apart from the block index
+ * (24 bytes per block).
+ */
+void compressStream(istream& infile, obstream& outfile, const HuffmanOptions& options);
+
 /* Function: decompress
  * Usage: decompress(infile, outfile);
  * --------------------------------------------------------
@@ -148,7 +464,87 @@ void compress(ibstream& infile, obstream& outfile);
  * previous functions together to implement this function,
  * which should not require much logic of its own and should
  * primarily be glue code.
+ *
+ * Any format that compress can write is accepted.
  */
 void decompress(ibstream& infile, ostream& outfile);
 
+/* Function: decompress
+ * Usage: decompress(infile, outfile, options);
+ * --------------------------------------------------------
+ * As above, but FORMAT_BLOCKS files are decoded on up to
+ * options.numThreads threads within options.maxMemory,
+ * FORMAT_DICTIONARY files with options.dictionary, and code
+ * tables come from options.tableCache if there is one.  The
+ * other fields of options are ignored, since the file itself
+ * says how it was written.  A FORMAT_BLOCKS file is read
+ * front to back, so infile need not be able to seek.
+ */
+void decompress(ibstream& infile, ostream& outfile, const HuffmanOptions& options);
+
+/* Function: verify
+ * Usage: uint64_t length = verify(infile, options);
+ * --------------------------------------------------------
+ * Checks that infile holds a file decompress would accept,
+ * without writing its data anywhere, and returns the length
+ * it decompresses to.  Reports an error describing the first
+ * problem found.  A FORMAT_BLOCKS file is checked against the
+ * checksum of every frame and the structure of the container
+ * without decoding a single block (see verifyBlocks), so it
+ * goes about as fast as the file can be read.  The other
+ * formats carry no checksum and are decoded in full.
+ */
+uint64_t verify(ibstream& infile, const HuffmanOptions& options);
+
+/* Function: decompressRange
+ * Usage: uint64_t n = decompressRange(infile, offset, length, outfile, options);
+ * --------------------------------------------------------
+ * Writes the length bytes starting at offset of what
+ * decompress would write and returns how many there were,
+ * fewer if the data ends first.  A FORMAT_BLOCKS file whose
+ * index can be read is served by seeking straight to the
+ * blocks holding the range and decoding only those, so the
+ * cost depends on the range and not on the file.  Any other
+ * file is decoded from its start, keeping only the range.
+ * Leaves infile at an unspecified position.
+ */
+uint64_t decompressRange(ibstream& infile, uint64_t offset, uint64_t length, ostream& outfile,
+                         const HuffmanOptions& options);
+
+/* Function: maxCompressedSize
+ * Usage: vector<char> buffer(maxCompressedSize(length, options));
+ * --------------------------------------------------------
+ * Returns a size that compressBuffer's output is guaranteed
+ * not to exceed for length bytes of any input, in the format
+ * chosen by options, so a buffer this size never needs to
+ * grow.  FORMAT_BLOCKS stores blocks no code would shrink,
+ * so its bound is the length plus a small cost per block;
+ * the other formats may need a little over 9 bits per byte
+ * plus their headers.
+ */
+size_t maxCompressedSize(size_t length, const HuffmanOptions& options);
+
+/* Function: compressBuffer
+ * Usage: size_t used = compressBuffer(data, length, buffer, capacity, options);
+ * --------------------------------------------------------
+ * Compresses the length bytes at source into the capacity
+ * bytes at dest and returns how many were used.  Nothing is
+ * copied on the way in, and the output goes straight into
+ * dest.  Reports an error if dest is too small, which never
+ * happens when capacity is at least maxCompressedSize.
+ */
+size_t compressBuffer(const char* source, size_t length, char* dest, size_t capacity,
+                      const HuffmanOptions& options);
+
+/* Function: decompressBuffer
+ * Usage: size_t used = decompressBuffer(data, length, buffer, capacity, options);
+ * --------------------------------------------------------
+ * Decompresses the length bytes at source, in any format
+ * compress can write, into the capacity bytes at dest and
+ * returns how many were used.  Reports an error if the data
+ * is damaged or dest is too small.
+ */
+size_t decompressBuffer(const char* source, size_t length, char* dest, size_t capacity,
+                        const HuffmanOptions& options);
+
 #endif
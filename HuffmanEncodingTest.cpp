@@ -16,9 +16,18 @@
 #include "simpio.h"
 #include "strlib.h"
 #include "bstream.h"
+#include "Crc32c.h"
 #include "HuffmanEncoding.h"
+#include "HuffmanBlocks.h"
+#include "HuffmanCodec.h"
+#include "HuffmanDictionary.h"
+#include "HuffmanSimd.h"
+#include "HuffmanStats.h"
+#include "TableCache.h"
+#include "ThreadPool.h"
 #include "ReferenceHuffmanEncoding.h"
 #include "MemoryDiagnostics.h"
+#include "pqueue.h"
 using namespace std;
 
 /* Type: MenuEntry
@@ -35,6 +44,9 @@ enum MenuEntry {
 	COMPRESS,
 	DECOMPRESS,
 	COMPARE,
+	AUTOMATIC_BIT_IO_TESTS,
+	AUTOMATIC_TABLE_TESTS,
+	AUTOMATIC_BLOCK_TESTS,
 	QUIT,
 };
 
@@ -242,6 +254,16 @@ void testGetFrequencyTable() {
 	                             "Testing correct table with all of the letters");
 
 
+	/* Bytes with the high bit set must be counted as 128 - 255, never as negative keys. */
+	{
+		logInfo("Testing that bytes 0x80 and above are counted as unsigned values.");
+		istringstream source(string("\x80\xFF\xFF", 3));
+		Map<ext_char, int> table = getFrequencyTable(source);
+		checkCondition(table.get(0x80) == 1 && table.get(0xFF) == 2,
+		               "Bytes 0x80 and 0xFF are counted under 128 and 255.");
+		checkCondition(table.size() == 3, "No other keys are present.");
+	}
+	
 	/* Test the code on a file of 10,000 random characters. */
 	{
 		logInfo("Testing on a file of 10,000 random bytes.");
@@ -303,6 +325,15 @@ int treeCost(Node* root, int depth = 0) {
 	return treeCost(root->zero, depth + 1) + treeCost(root->one, depth + 1);
 }
 
+/* Function: treeDepth
+ * --------------------------------------------------------
+ * Returns the length of the longest code in the tree.
+ */
+int treeDepth(Node* root) {
+	if (root == NULL || (root->zero == NULL && root->one == NULL)) return 0;
+	return 1 + max(treeDepth(root->zero), treeDepth(root->one));
+}
+
 /* Function: recCheckTreeCorrectness
  * --------------------------------------------------------
  * Recursively checks the structure of an encoding tree to
@@ -553,6 +584,33 @@ void testBuildEncodingTree() {
 		checkCondition(recCheckTreesEqual(second, third), "Encoding trees should be the same.");
 		checkCondition(recCheckTreesEqual(third, first),  "Encoding trees should be the same.");
 	}
+	
+	/* Trees built in a NodeArena should match heap trees and be freed by releasing the arena. */
+	{
+		long disparity = numAllocations() - numDeallocations();
+		long arenaDisparity = numArenaAllocations() - numArenaDeallocations();
+		
+		ifbstream stream("test/input/random_10k.test");
+		Map<ext_char, int> frequencies = referenceGetFrequencyTable(stream);
+		Node* expected = buildEncodingTree(frequencies);
+		
+		NodeArena arena;
+		Node* tree = buildEncodingTree(frequencies, arena);
+		checkCondition(recCheckTreesEqual(expected, tree), "Arena and heap trees should be the same.");
+		checkCondition(arena.size() == 2 * frequencies.size() - 1, "The arena holds exactly the tree's nodes.");
+		checkCondition(numArenaAllocations() - numArenaDeallocations() == arenaDisparity + arena.size(),
+		               "Arena nodes are counted as arena allocations.");
+		checkCondition(arena.nodeAt(arena.indexOf(tree->zero)) == tree->zero, "Nodes can be found by index.");
+		checkCondition(arena.indexOf(expected) == -1, "Heap nodes are not in the arena.");
+		freeTree(expected);
+		
+		arena.release();
+		checkCondition(arena.size() == 0, "Releasing empties the arena.");
+		checkCondition(numAllocations() - numDeallocations() == disparity,
+		               "Releasing the arena frees the whole tree.");
+		tree = buildEncodingTree(frequencies, arena);
+		checkCondition(arena.indexOf(tree) == arena.size() - 1, "A released arena can be reused.");
+	}
 
 	endTest("buildEncodingTree tests");
 }
@@ -684,6 +742,71 @@ void testEncoding() {
 	endTest("encodeFile / decodeFile Tests");
 }
 
+/* Function: testFormats
+ * --------------------------------------------------------
+ * Returns options selecting every file format that compress
+ * can write, filling in names with a description of each.
+ */
+Vector<HuffmanOptions> testFormats(Vector<string>& names) {
+	Vector<HuffmanOptions> formats;
+	
+	HuffmanOptions frequencies;
+	frequencies.format = FORMAT_FREQUENCIES;
+	formats += frequencies;
+	names += "frequency header";
+	
+	HuffmanOptions canonical;
+	canonical.format = FORMAT_CANONICAL;
+	formats += canonical;
+	names += "canonical";
+	
+	HuffmanOptions limited;
+	limited.format = FORMAT_CANONICAL;
+	limited.maxCodeLength = DECODE_TABLE_BITS;
+	formats += limited;
+	names += "canonical, 11-bit codes";
+	
+	HuffmanOptions counted;
+	counted.format = FORMAT_COUNTED;
+	formats += counted;
+	names += "counted length";
+	
+	HuffmanOptions context;
+	context.format = FORMAT_CONTEXT;
+	formats += context;
+	names += "order-1 contexts";
+	
+	HuffmanOptions blocks;
+	blocks.format = FORMAT_BLOCKS;
+	formats += blocks;
+	names += "blocks";
+	
+	HuffmanOptions single;
+	single.format = FORMAT_BLOCKS;
+	single.numStreams = 1;
+	formats += single;
+	names += "blocks, one stream";
+	
+	/* Small blocks on several threads, so that most files span many blocks. */
+	HuffmanOptions parallel;
+	parallel.format = FORMAT_BLOCKS;
+	parallel.blockSize = 4096;
+	parallel.numThreads = 4;
+	parallel.numStreams = 3;
+	formats += parallel;
+	names += "4KB blocks, 4 threads, 3 streams";
+	
+	HuffmanOptions pipelined;
+	pipelined.format = FORMAT_BLOCKS;
+	pipelined.blockSize = 4096;
+	pipelined.numThreads = 2;
+	pipelined.pipelineDepth = 3;
+	formats += pipelined;
+	names += "4KB blocks, pipelined";
+	
+	return formats;
+}
+
 /* Function: testCompleteStack
  * --------------------------------------------------------
  * This test will run your compress and decompress functions
@@ -698,39 +821,1357 @@ void testCompleteStack() {
 	Vector<string> files;
 	files += "singleChar", "nonRepeated", "alphaOnce", "allRepeated", "fibonacci", "poem", "allCharsOnce", "tomSawyer", "dikdik.jpg", "random";
 	
+	/* Construct the list of file formats to exercise. */
+	Vector<string> formatNames;
+	Vector<HuffmanOptions> formats = testFormats(formatNames);
+	
 	foreach (string file in files) {
-		logInfo("Testing compress and decompress on file test/encodeDecode/" + file);
+		for (int i = 0; i < formats.size(); i++) {
+			logInfo("Testing compress and decompress (" + formatNames[i] + ") on file test/encodeDecode/" + file);
+			
+			/* Take a snapshot of total memory usage. */
+			long difference = numAllocations() - numDeallocations();
 		
-		/* Take a snapshot of total memory usage. */
-		long difference = numAllocations() - numDeallocations();
+			/* Open the file to compress. */
+			ifbstream input("test/encodeDecode/" + file);
+			assertCondition(input.is_open(), ("Cannot open file test/encodeDecode/" + file + " for reading!"));
+		
+			/* Read the file into memory. */
+			ostringstream originalData;
+			originalData << input.rdbuf();
+			input.rewind();
+		
+			/* Compress the file into an ostringbstream so that we hold it in RAM. */
+			ostringbstream result;
+			compress(input, result, formats[i]);
+			
+			/* Decompress the input from memory. */
+			istringbstream compressedData(result.str());
+			ostringbstream decompressedData;
+			decompress(compressedData, decompressedData, formats[i]);
+			
+			/* Confirm that it matches. */
+			checkCondition(originalData.str() == decompressedData.str(),
+			               "Compressed/decompressed data matches.");
+			
+			/* The span API has to write exactly what the streams do, within its bound. */
+			string original = originalData.str();
+			vector<char> packed(maxCompressedSize(original.size(), formats[i]));
+			size_t packedSize = compressBuffer(original.data(), original.size(), &packed[0], packed.size(), formats[i]);
+			checkCondition(string(&packed[0], packedSize) == result.str(),
+			               "compressBuffer matches compress, inside maxCompressedSize.");
+			vector<char> unpacked(original.size() + 1);
+			size_t unpackedSize = decompressBuffer(&packed[0], packedSize, &unpacked[0], unpacked.size(), formats[i]);
+			checkCondition(string(&unpacked[0], unpackedSize) == original, "decompressBuffer restores the file.");
+										 
+			checkCondition(numAllocations() - numDeallocations() == difference,
+			               "No tree nodes leaked.");
+		}
+	}
+	
+	{
+		logInfo("Checking the bound and undersized buffers.");
+		string noise;
+		for (int i = 0; i < 20000; i++) noise += char((i * 7919 + i / 3) % 256);
+		bool bounded = true, rejected = true;
+		for (int i = 0; i < formats.size(); i++) {
+			vector<char> packed(maxCompressedSize(noise.size(), formats[i]));
+			size_t packedSize = compressBuffer(noise.data(), noise.size(), &packed[0], packed.size(), formats[i]);
+			bounded = bounded && packedSize <= packed.size();
+			
+			try {
+				compressBuffer(noise.data(), noise.size(), &packed[0], packedSize - 1, formats[i]);
+				rejected = false;
+			} catch (ErrorException&) {}
+			vector<char> unpacked(noise.size() - 1);
+			try {
+				decompressBuffer(&packed[0], packedSize, &unpacked[0], unpacked.size(), formats[i]);
+				rejected = false;
+			} catch (ErrorException&) {}
+		}
+		checkCondition(bounded, "Incompressible data stays within maxCompressedSize.");
+		checkCondition(rejected, "Buffers one byte too small are reported.");
+		
+		bool empty = true;
+		for (int i = 0; i < formats.size(); i++) {
+			vector<char> packed(maxCompressedSize(0, formats[i]));
+			size_t packedSize = compressBuffer("", 0, &packed[0], packed.size(), formats[i]);
+			char unused;
+			empty = empty && decompressBuffer(&packed[0], packedSize, &unused, 0, formats[i]) == 0;
+		}
+		checkCondition(empty, "Empty input round-trips through buffers in every format.");
+	}
+	
+	{
+		logInfo("Checking the stats compress and decompress report.");
+		string text;
+		for (int i = 0; i < 50000; i++) text += "eeeetttaaoinshrdlu"[(i * 7 + i / 13) % 18];
+		bool sizes = true, codes = true, timed = true;
+		for (int i = 0; i < formats.size(); i++) {
+			HuffmanOptions options = formats[i];
+			HuffmanStats packing, unpacking;
+			options.stats = &packing;
+			istringbstream source(text);
+			ostringbstream packed;
+			compress(source, packed, options);
+			
+			options.stats = &unpacking;
+			istringbstream compressed(packed.str());
+			ostringbstream unpacked;
+			decompress(compressed, unpacked, options);
+			
+			sizes = sizes && packing.bytesIn == text.size() && packing.bytesOut == packed.str().size() &&
+			        unpacking.bytesIn == packed.str().size() && unpacking.bytesOut == text.size();
+			codes = codes && packing.symbolsCoded >= text.size() && packing.bitsWritten <= 8 * packing.bytesOut &&
+			        packing.averageCodeLength() >= 1 && packing.averageCodeLength() <= packing.maxCodeDepth &&
+			        packing.maxCodeDepth <= MAX_CODE_LENGTH && unpacking.symbolsCoded == 0;
+			timed = timed && packing.encodeSeconds > 0 && unpacking.decodeSeconds > 0 &&
+			        packing.countSeconds >= 0 && packing.treeSeconds >= 0 && packing.headerSeconds >= 0 &&
+			        unpacking.countSeconds == 0;
+			if (!sizes || !codes || !timed) logInfo("Stats are off for " + formatNames[i] + ".");
+		}
+		checkCondition(sizes, "Stats count the bytes read and written in every format.");
+		checkCondition(codes, "Stats count the codes compress wrote.");
+		checkCondition(timed, "Stats time the stages that ran.");
+		
+		HuffmanStats total;
+		HuffmanOptions options;
+		options.stats = &total;
+		for (int round = 0; round < 2; round++) {
+			istringbstream source(text);
+			ostringbstream packed;
+			compress(source, packed, options);
+		}
+		checkCondition(total.bytesIn == 2 * text.size(), "Stats add up over calls.");
+		total.clear();
+		checkCondition(total.bytesIn == 0 && total.encodeSeconds == 0, "clear resets the stats.");
+	}
+
+	{
+		logInfo("Reusing Encoder and Decoder objects across inputs.");
+		string inputs[] = {"", "a", "hello, world", string(5000, 'z'), "abracadabra alakazam"};
+		for (int i = 0; i < 200; i++) inputs[4] += char(i * 31);
+		bool same = true, restored = true;
+		for (int i = 0; i < formats.size(); i++) {
+			Encoder encoder(formats[i]);
+			Decoder decoder(formats[i]);
+			vector<char> packed, unpacked;
+			for (int round = 0; round < 2; round++) {
+				for (size_t j = 0; j < sizeof inputs / sizeof inputs[0]; j++) {
+					const string& text = inputs[j];
+					encoder.compress(text.data(), text.size(), packed);
+					vector<char> expected(maxCompressedSize(text.size(), formats[i]));
+					expected.resize(compressBuffer(text.data(), text.size(), &expected[0], expected.size(), formats[i]));
+					same = same && packed == expected;
+
+					decoder.decompress(&packed[0], packed.size(), unpacked);
+					restored = restored && string(unpacked.begin(), unpacked.end()) == text;
+					vector<char> span(text.size() + 1);
+					restored = restored && decoder.decompress(&packed[0], packed.size(), &span[0], span.size()) == text.size() &&
+					           string(&span[0], text.size()) == text;
+				}
+			}
+			if (!same || !restored) logInfo("Reuse fails for " + formatNames[i] + ".");
+		}
+		checkCondition(same, "A reused Encoder writes what compressBuffer writes.");
+		checkCondition(restored, "A reused Decoder restores every input.");
+
+		string sample = "it was the best of times, it was the worst of times";
+		shared_ptr<const CachedTables> tables = Encoder::train(sample.data(), sample.size(), 12);
+		vector<string> results(4);
+		ThreadPool pool(4);
+		pool.run(4, [&](int task) {
+			Encoder encoder(HuffmanOptions(), tables);
+			string text = sample + integerToString(task);
+			vector<char> packed;
+			for (int round = 0; round < 50; round++) encoder.compress(text.data(), text.size(), packed);
+			vector<char> unpacked(text.size());
+			size_t used = decompressBuffer(&packed[0], packed.size(), &unpacked[0], unpacked.size(), HuffmanOptions());
+			results[task] = string(&unpacked[0], used);
+		});
+		bool shared = true;
+		for (int task = 0; task < 4; task++) shared = shared && results[task] == sample + integerToString(task);
+		checkCondition(shared, "Encoders on several threads share trained tables.");
+
+		string binary;
+		for (int i = 0; i < 1000; i++) binary += char(i * 7);
+		Encoder encoder(HuffmanOptions(), tables);
+		vector<char> packed;
+		encoder.compress(binary.data(), binary.size(), packed);
+		checkCondition(packed.size() <= encoder.maxCompressedSize(binary.size()), "Trained tables stay within maxCompressedSize.");
+		vector<char> unpacked(binary.size());
+		decompressBuffer(&packed[0], packed.size(), &unpacked[0], unpacked.size(), HuffmanOptions());
+		checkCondition(string(unpacked.begin(), unpacked.end()) == binary, "Trained tables code bytes the sample never had.");
+	}
+
+	endTest("Complete Stack Tests");
+}
+
+/* Function: queueEncodingTree
+ * --------------------------------------------------------
+ * Builds an encoding tree the textbook way, merging the two
+ * lightest nodes of a PriorityQueue until one is left.  This
+ * is how buildEncodingTree used to work, so every tree it
+ * builds now has to match this one exactly.
+ */
+Node* queueEncodingTree(Map<ext_char, int>& frequencies) {
+	PriorityQueue<Node*> pq;
+	foreach (ext_char ch in frequencies) {
+		Node* leaf = new Node;
+		leaf->character = ch;
+		leaf->weight = frequencies.get(ch);
+		leaf->zero = leaf->one = NULL;
+		pq.enqueue(leaf, leaf->weight);
+	}
+	while (pq.size() > 1) {
+		Node* parent = new Node;
+		parent->zero = pq.dequeue();
+		parent->one = pq.dequeue();
+		parent->weight = parent->zero->weight + parent->one->weight;
+		parent->character = NOT_A_CHAR;
+		pq.enqueue(parent, parent->weight);
+	}
+	return pq.dequeue();
+}
+
+/* Function: testCodeTables
+ * --------------------------------------------------------
+ * Checks the canonical code machinery: canonical codes must
+ * cost exactly as many bits as the tree they came from, the
+ * packed length table must survive a round trip, and damaged
+ * length tables must be rejected rather than decoded.
+ */
+void testCodeTables() {
+	beginTest("Code Table Tests");
+	
+	Vector<string> files;
+	files += "singleChar", "alphaOnce", "fibonacci", "poem", "allCharsOnce", "random";
 	
-		/* Open the file to compress. */
+	foreach (string file in files) {
+		logInfo("Building canonical codes for test/encodeDecode/" + file);
 		ifbstream input("test/encodeDecode/" + file);
 		assertCondition(input.is_open(), ("Cannot open file test/encodeDecode/" + file + " for reading!"));
-	
-		/* Read the file into memory. */
-		ostringstream originalData;
-		originalData << input.rdbuf();
+		
+		Map<ext_char, int> frequencies = getFrequencyTable(input);
+		input.rewind();
+		Node* tree = buildEncodingTree(frequencies);
+		
+		EncodeTable table;
+		buildEncodeTable(tree, table);
+		assignCanonicalCodes(table);
+		
+		/* Canonical codes keep the tree's lengths, so the cost must match. */
+		int canonicalCost = 0;
+		foreach (ext_char ch in frequencies) {
+			canonicalCost += frequencies[ch] * table.lengths[ch];
+		}
+		checkCondition(canonicalCost == treeCost(tree), "Canonical codes cost as many bits as the tree.");
+		
+		/* The length table reads back to identical codes. */
+		ostringbstream header;
+		writeCodeLengths(header, table);
+		header.flushBits();
+		istringbstream headerIn(header.str());
+		EncodeTable readBack;
+		readCodeLengths(headerIn, readBack);
+		bool same = true;
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+			same &= (readBack.lengths[ch] == table.lengths[ch] && readBack.codes[ch] == table.codes[ch]);
+		}
+		checkCondition(same, "Code length table round-trips (" + integerToString(header.str().size()) + " bytes).");
+		
+		/* Encoding and decoding with the canonical tables restores the file. */
+		ostringstream fileContents;
+		fileContents << input.rdbuf();
 		input.rewind();
+		
+		ostringbstream compressed;
+		encodeFile(input, table, compressed);
+		DecodeTable decoder;
+		buildDecodeTable(readBack, decoder);
+		istringbstream toDecompress(compressed.str());
+		ostringbstream decompressed;
+		decodeFile(toDecompress, decoder, decompressed);
+		checkCondition(fileContents.str() == decompressed.str(),
+		               "Encoding then decoding with canonical codes gets back the original file.");
+		
+		freeTree(tree);
+	}
+	
+	/* Length-limited trees must respect the limit and stay close to optimal. */
+	{
+		ifbstream input("test/encodeDecode/fibonacci");
+		Map<ext_char, int> frequencies = getFrequencyTable(input);
+		Node* unlimited = buildEncodingTree(frequencies);
+		int optimalCost = treeCost(unlimited);
+		freeTree(unlimited);
+		
+		int limits[] = { 32, 15, 12, 11, 6 };
+		for (int i = 0; i < 5; i++) {
+			logInfo("Building a length-limited tree for test/encodeDecode/fibonacci with limit " + integerToString(limits[i]));
+			long disparity = numAllocations() - numDeallocations();
+			Node* tree = buildLimitedEncodingTree(frequencies, limits[i]);
+			
+			Map<ext_char, int> remaining = frequencies;
+			recCheckTreeCorrectness(tree, remaining);
+			checkCondition(remaining.isEmpty(), "All letters accounted for.");
+			checkCondition(treeDepth(tree) <= limits[i], "No code is longer than the limit.");
+			checkCondition(treeCost(tree) >= optimalCost, "The limited tree is never cheaper than Huffman's.");
+			if (treeDepth(tree) < limits[i]) {
+				checkCondition(treeCost(tree) == optimalCost, "A limit the tree doesn't reach costs nothing.");
+			}
+			freeTree(tree);
+			checkCondition(numAllocations() - numDeallocations() == disparity, "No tree nodes leaked.");
+		}
+	}
+	
+	{
+		logInfo("Checking the two-queue builder against a priority queue on many tie-heavy inputs.");
+		bool sameTrees = true, sameLengths = true;
+		unsigned int seed = 12345;
+		for (int round = 0; round < 200; round++) {
+			Map<ext_char, int> frequencies;
+			uint64_t weights[NUM_SYMBOLS] = {0};
+			int symbols = 1 + round % NUM_SYMBOLS;
+			for (int i = 0; i < symbols; i++) {
+				seed = seed * 1103515245 + 12345;
+				ext_char ch = (seed >> 8) % NUM_SYMBOLS;
+				int weight = 1 + (seed >> 20) % (1 + round % 9);
+				frequencies.put(ch, weight);
+				weights[ch] = weight;
+			}
+			
+			Node* expected = queueEncodingTree(frequencies);
+			Node* tree = buildEncodingTree(frequencies);
+			sameTrees = sameTrees && recCheckTreesEqual(expected, tree);
+			
+			EncodeTable fromTree, direct;
+			buildEncodeTable(expected, fromTree);
+			buildCodeLengths(weights, direct);
+			for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+				sameLengths = sameLengths && fromTree.lengths[ch] == direct.lengths[ch];
+			}
+			freeTree(expected);
+			freeTree(tree);
+		}
+		checkCondition(sameTrees, "Trees match the priority queue's, ties included.");
+		checkCondition(sameLengths, "buildCodeLengths matches the tree's code lengths.");
+	}
+	
+	{
+		logInfo("Checking that an oversubscribed length table is rejected.");
+		EncodeTable table;
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) table.lengths[ch] = 0;
+		table.lengths['a'] = table.lengths['b'] = table.lengths['c'] = 1;
+		bool rejected = false;
+		try {
+			assignCanonicalCodes(table);
+		} catch (ErrorException&) {
+			rejected = true;
+		}
+		checkCondition(rejected, "Three codes of length one are rejected.");
+	}
+	
+	{
+		logInfo("Training a dictionary and compressing messages against it.");
+		string corpus;
+		for (int i = 0; i < 200; i++) {
+			corpus += "{\"id\": " + integerToString(i) + ", \"name\": \"item\", \"tags\": [\"a\", \"b\"]}\n";
+		}
+		istringbstream sample(corpus);
+		HuffmanDictionary dictionary;
+		trainDictionary(sample, 0, dictionary);
+		
+		bool everyByte = true;
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) everyByte = everyByte && dictionary.encodeTable.lengths[ch] != 0;
+		checkCondition(everyByte, "Every byte and PSEUDO_EOF has a code.");
+		
+		ostringbstream saved;
+		writeDictionary(saved, dictionary);
+		istringbstream savedSource(saved.str());
+		HuffmanDictionary loaded;
+		readDictionary(savedSource, loaded);
+		bool sameCodes = loaded.id == dictionary.id;
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+			sameCodes = sameCodes && loaded.encodeTable.codes[ch] == dictionary.encodeTable.codes[ch] &&
+			            loaded.encodeTable.lengths[ch] == dictionary.encodeTable.lengths[ch];
+		}
+		checkCondition(sameCodes, "A saved dictionary loads with the same id and codes.");
+		
+		string damaged = saved.str();
+		damaged[5] ^= 1;
+		istringbstream damagedSource(damaged);
+		bool rejected = false;
+		try {
+			readDictionary(damagedSource, loaded);
+		} catch (ErrorException&) {
+			rejected = true;
+		}
+		checkCondition(rejected, "A dictionary whose id doesn't match is rejected.");
+		
+		HuffmanOptions options;
+		options.format = FORMAT_DICTIONARY;
+		options.dictionary = &loaded;
+		string message = "{\"id\": 77, \"name\": \"item\", \"tags\": [\"b\"], \"extra\": \"\xff\x01\"}";
+		istringbstream messageSource(message);
+		ostringbstream packed;
+		compress(messageSource, packed, options);
+		
+		messageSource.rewind();
+		ostringbstream canonical;
+		HuffmanOptions canonicalOptions;
+		canonicalOptions.format = FORMAT_CANONICAL;
+		compress(messageSource, canonical, canonicalOptions);
+		checkCondition(packed.str().size() < canonical.str().size(), "The message is smaller than with its own table.");
+		
+		istringbstream packedSource(packed.str());
+		ostringbstream unpacked;
+		decompress(packedSource, unpacked, options);
+		checkCondition(unpacked.str() == message, "The message, unseen bytes included, round-trips.");
+		checkCondition(packed.str().size() <= maxCompressedSize(message.size(), options),
+		               "The message fits in maxCompressedSize.");
+		
+		HuffmanDictionary other;
+		istringbstream otherSample("completely different text");
+		trainDictionary(otherSample, 12, other);
+		options.dictionary = &other;
+		istringbstream wrongSource(packed.str());
+		ostringbstream wrongOutput;
+		rejected = false;
+		try {
+			decompress(wrongSource, wrongOutput, options);
+		} catch (ErrorException&) {
+			rejected = true;
+		}
+		checkCondition(rejected, "Decompressing with the wrong dictionary is reported.");
+	}
+	
+	{
+		logInfo("Checking counts too large for an int.");
+		uint64_t counts[256] = {0};
+		counts['a'] = 3000000000ULL;
+		counts['b'] = 5000000000ULL;
+		counts['c'] = 1;
+		counts['d'] = 1ULL << 40;
+		Map<ext_char, int> frequencies = getFrequencyTable(counts);
+		long long total = 0;
+		foreach (ext_char ch in frequencies) total += frequencies[ch];
+		checkCondition(frequencies.size() == 5 && frequencies['c'] >= 1 && frequencies[PSEUDO_EOF] == 1,
+		               "Every character that occurs keeps a weight.");
+		checkCondition(total <= numeric_limits<int>::max() && frequencies['a'] < frequencies['b'] && frequencies['b'] < frequencies['d'],
+		               "Weights are scaled into an int in proportion.");
+		Node* tree = buildEncodingTree(frequencies);
+		checkCondition(tree->weight == total, "The tree's weights don't overflow.");
+		freeTree(tree);
+		
+		/* Fibonacci weights make the deepest possible tree. */
+		uint64_t weights[NUM_SYMBOLS] = {0};
+		uint64_t previous = 1, current = 1;
+		for (int ch = 0; ch < 90; ch++) {
+			weights[ch] = current;
+			uint64_t next = previous + current;
+			previous = current;
+			current = next;
+		}
+		EncodeTable table;
+		buildCanonicalTable(weights, 0, table);
+		int longest = 0;
+		for (int ch = 0; ch < NUM_SYMBOLS; ch++) longest = max(longest, int(table.lengths[ch]));
+		checkCondition(longest == MAX_CODE_LENGTH, "64-bit weights are held to MAX_CODE_LENGTH.");
+	}
+	
+	{
+		logInfo("Checking the counted-length format.");
+		HuffmanOptions counted;
+		counted.format = FORMAT_COUNTED;
+		string text = "counted loops need no end marker";
+		istringbstream source(text);
+		ostringbstream packed;
+		compress(source, packed, counted);
+		
+		istringbstream header(packed.str());
+		header.readBits(8);
+		bool lengthStored = header.readBits(64) == text.size();
+		EncodeTable codes;
+		readCodeLengths(header, codes);
+		checkCondition(lengthStored, "The header holds the number of bytes.");
+		checkCondition(codes.lengths[PSEUDO_EOF] == 0, "PSEUDO_EOF has no code.");
+		
+		string truncated = packed.str().substr(0, packed.str().size() - 2);
+		istringbstream truncatedSource(truncated);
+		ostringbstream output;
+		bool rejected = false;
+		try {
+			decompress(truncatedSource, output, counted);
+		} catch (ErrorException&) {
+			rejected = true;
+		}
+		checkCondition(rejected, "Truncated data is reported.");
+	}
+	
+	{
+		logInfo("Checking the context-modelled format.");
+		string log;
+		for (int i = 0; i < 2000; i++) {
+			log += "2024-01-" + integerToString(10 + i % 20) + " INFO request id=" + integerToString(i * 7919 % 100000);
+			log += (i % 3 == 0)? " status=200 path=/index.html\n" : " status=404 path=/missing\n";
+		}
+		HuffmanOptions context;
+		context.format = FORMAT_CONTEXT;
+		HuffmanOptions canonical;
+		canonical.format = FORMAT_CANONICAL;
+		string packed[3];
+		for (int k = 0; k < 3; k++) {
+			HuffmanOptions options = (k == 2)? canonical : context;
+			if (k == 1) options.contextTables = 1;
+			istringbstream source(log);
+			ostringbstream result;
+			compress(source, result, options);
+			packed[k] = result.str();
+		}
+		istringbstream header(packed[0]);
+		header.readBits(8);
+		int tables = int(header.readBits(4)) + 1;
+		checkCondition(tables > 1 && tables <= MAX_CONTEXT_TABLES, "Log text is split among several tables.");
+		checkCondition(packed[0].size() * 10 < packed[2].size() * 8, "Contexts beat order-0 by over 20% on log text.");
+		checkCondition(packed[1].size() <= packed[2].size() + 1, "A single table costs what the canonical format does.");
+		
+		string noise;
+		uint32_t state = 12345;
+		for (int i = 0; i < 20000; i++) {
+			state = state * 1103515245u + 12345u;
+			noise += char(state >> 24);
+		}
+		istringbstream noiseSource(noise);
+		ostringbstream noisePacked;
+		compress(noiseSource, noisePacked, context);
+		checkCondition(((unsigned char)noisePacked.str()[1] & 0x0F) == 0, "Data without contexts gets one table.");
+		
+		bool rejected = true;
+		for (int damage = 0; damage < 2; damage++) {
+			string damaged = packed[0];
+			if (damage == 0) damaged = damaged.substr(0, damaged.size() / 2);
+			else damaged[1] = char((damaged[1] & 0xF0) | 1);
+			istringbstream damagedSource(damaged);
+			ostringbstream output;
+			try {
+				decompress(damagedSource, output, context);
+				rejected = false;
+			} catch (ErrorException&) {
+			}
+		}
+		checkCondition(rejected, "Truncated data and a damaged context map are reported.");
+	}
 	
-		/* Compress the file into an ostringbstream so that we hold it in RAM. */
+	{
+		logInfo("Decompressing through a table cache.");
+		Vector<string> texts;
+		texts += "first text, first table", "second text: a different table", "third!!";
+		Vector<string> formatNames;
+		Vector<HuffmanOptions> formats = testFormats(formatNames);
+		TableCache cache(2);
+		bool matched = true;
+		for (int i = 0; i < formats.size(); i++) {
+			for (int j = 0; j < texts.size(); j++) {
+				istringbstream source(texts[j]);
+				ostringbstream packed;
+				compress(source, packed, formats[i]);
+				for (int round = 0; round < 2; round++) {
+					HuffmanOptions options = formats[i];
+					options.tableCache = &cache;
+					istringbstream packedSource(packed.str());
+					ostringbstream unpacked;
+					decompress(packedSource, unpacked, options);
+					matched = matched && unpacked.str() == texts[j];
+				}
+			}
+		}
+		checkCondition(matched, "Every format decodes correctly through the cache.");
+		checkCondition(cache.hits() == cache.misses(), "The second decode of each file hits the cache.");
+		checkCondition(cache.size() == 2, "The cache holds no more than its capacity.");
+		
+		cache.clear();
+		HuffmanOptions canonical;
+		canonical.format = FORMAT_CANONICAL;
+		string packedTexts[3];
+		for (int j = 0; j < 3; j++) {
+			istringbstream source(texts[j]);
+			ostringbstream packed;
+			compress(source, packed, canonical);
+			packedTexts[j] = packed.str();
+		}
+		canonical.tableCache = &cache;
+		int order[] = {0, 1, 0, 2, 1};
+		for (int k = 0; k < 5; k++) {
+			istringbstream packedSource(packedTexts[order[k]]);
+			ostringbstream unpacked;
+			decompress(packedSource, unpacked, canonical);
+		}
+		checkCondition(cache.hits() == 1 && cache.misses() == 4, "The least recently used table is discarded first.");
+		
+		cache.clear();
+		string repeated;
+		for (int i = 0; i < 64 * 30; i++) repeated += "the same block of text, over and over";
+		HuffmanOptions blocks;
+		blocks.format = FORMAT_BLOCKS;
+		blocks.blockSize = int(repeated.size() / 64);
+		blocks.numThreads = 4;
+		blocks.reuseTables = false;
+		istringbstream source(repeated);
+		ostringbstream packed;
+		compress(source, packed, blocks);
+		blocks.tableCache = &cache;
+		istringbstream packedSource(packed.str());
+		ostringbstream unpacked;
+		decompress(packedSource, unpacked, blocks);
+		checkCondition(unpacked.str() == repeated, "Parallel blocks decode correctly through the cache.");
+		checkCondition(cache.size() == 1 && cache.hits() + cache.misses() == 64 && cache.misses() <= 4,
+		               "Identical blocks share one table.");
+	}
+
+	{
+		logInfo("Checking that every packing kernel writes the same bits.");
+		checkCondition(isKernelSupported(KERNEL_SCALAR) && isKernelSupported(bestEncodeKernel()),
+		               "The scalar kernel and the best kernel are supported.");
+		logInfo(string("Best kernel here: ") + kernelName(bestEncodeKernel()));
+
+		/* Alphabets small enough for the vector kernels, then codes
+		 * up to 16, 32 and 64 bits long, which take the other paths.
+		 */
+		string data;
+		for (int i = 0; i < 10000; i++) data += char("abcdefg"[(i * 7 + i / 5) % 7]);
+		int limits[] = {0, 16, 32, 0};
+		bool same = true;
+		for (int t = 0; t < 4; t++) {
+			uint64_t weights[NUM_SYMBOLS] = {0};
+			for (int ch = 0; ch < 256; ch++) {
+				weights[ch] = (t == 0)? ((ch >= 'a' && ch <= 'g')? 100 + ch : 0) : uint64_t(1) << (ch / 5);
+			}
+			weights[PSEUDO_EOF] = 1;
+			EncodeTable table;
+			buildCanonicalTable(weights, limits[t], table);
+			string text = data;
+			if (t > 0) for (int i = 0; i < 3000; i++) text[i * 3] = char(i * 13);
+
+			for (int offset = 0; offset < 3; offset++) {
+				ostringbstream expected;
+				expected.writeBits(5, offset * 3);
+				for (size_t i = 0; i < text.size(); i++) {
+					unsigned char ch = (unsigned char)text[i];
+					expected.writeBits(table.codes[ch], table.lengths[ch]);
+				}
+				expected.flushBits();
+
+				const EncodeKernel kernels[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_NEON};
+				for (int k = 0; k < 3; k++) {
+					if (!isKernelSupported(kernels[k])) continue;
+					for (size_t length = 0; length < 70; length += 23) {
+						ostringbstream actual;
+						actual.writeBits(5, offset * 3);
+						packCodes(text.data(), text.size() - length, table, actual, kernels[k]);
+						packCodes(text.data() + text.size() - length, length, table, actual, kernels[k]);
+						actual.flushBits();
+						if (actual.str() != expected.str()) {
+							logInfo(string("The ") + kernelName(kernels[k]) + " kernel differs on table " + integerToString(t) + ".");
+							same = false;
+						}
+					}
+				}
+			}
+		}
+		checkCondition(same, "Every kernel packs codes exactly as writeBits does.");
+	}
+
+	endTest("Code Table Tests");
+}
+
+/* Class: PipeBuffer
+ * --------------------------------------------------------
+ * A stream buffer over a string that, like a pipe, cannot
+ * seek and hands out at most a few bytes per read.
+ */
+class PipeBuffer: public streambuf {
+public:
+	PipeBuffer(const string& data) : data(data), pos(0) {}
+	
+protected:
+	int_type underflow() {
+		if (pos == data.size()) return traits_type::eof();
+		size_t count = min(data.size() - pos, size_t(7));
+		setg(&data[pos], &data[pos], &data[pos] + count);
+		pos += count;
+		return traits_type::to_int_type(data[pos - count]);
+	}
+	
+private:
+	string data;
+	size_t pos;
+};
+
+/* Function: blockRoundTrip
+ * --------------------------------------------------------
+ * Decompresses data on the given number of threads, returning
+ * the result, or "<error>" if decompress reports an error.
+ */
+string blockRoundTrip(const string& data, int numThreads) {
+	HuffmanOptions options;
+	options.numThreads = numThreads;
+	istringbstream source(data);
+	ostringbstream result;
+	try {
+		decompress(source, result, options);
+	} catch (ErrorException&) {
+		return "<error>";
+	}
+	return result.str();
+}
+
+/* Function: testBlockContainer
+ * --------------------------------------------------------
+ * Checks the block container: that its index describes every
+ * block, that decoding gives the same result on any number
+ * of threads, and that a container whose index is lost can
+ * still be read front to back.
+ */
+void testBlockContainer() {
+	beginTest("Block Container Tests");
+	
+	string text;
+	for (int i = 0; i < 50000; i++) {
+		text += char((i % 7 == 0)? 'a' + i % 26 : " etaoin"[i % 7]);
+	}
+	
+	HuffmanOptions options;
+	options.format = FORMAT_BLOCKS;
+	options.blockSize = 4096;
+	options.numThreads = 4;
+	
+	istringbstream input(text);
+	ostringbstream output;
+	compress(input, output, options);
+	string packed = output.str();
+	
+	{
+		logInfo("Checking the block index.");
+		istringbstream source(packed);
+		vector<BlockIndexEntry> index;
+		checkCondition(readBlockIndex(source, index), "The index is found.");
+		checkCondition(index.size() == 13, "There is one entry per 4KB block.");
+		
+		bool tiled = true;
+		for (size_t i = 0; i < index.size(); i++) {
+			tiled = tiled && index[i].outputOffset == i * 4096;
+			tiled = tiled && index[i].length == ((i + 1 < index.size())? 4096 : text.size() % 4096);
+			if (i + 1 < index.size()) tiled = tiled && index[i].frameOffset + index[i].frameSize == index[i + 1].frameOffset;
+		}
+		checkCondition(tiled, "Entries cover the blocks and frames in order.");
+		checkCondition(source.tellg() == streampos(0), "Reading the index leaves the stream where it was.");
+	}
+	
+	{
+		logInfo("Decoding on different numbers of threads.");
+		checkCondition(blockRoundTrip(packed, 1) == text, "One thread decodes the container.");
+		checkCondition(blockRoundTrip(packed, 3) == text, "Three threads decode the container.");
+		checkCondition(blockRoundTrip(packed, 16) == text, "More threads than blocks decode the container.");
+	}
+	
+	{
+		logInfo("Decoding a container whose trailer is missing.");
+		string damaged = packed.substr(0, packed.size() - 1);
+		istringbstream source(damaged);
+		vector<BlockIndexEntry> index;
+		checkCondition(!readBlockIndex(source, index), "The index is not found.");
+		checkCondition(blockRoundTrip(damaged, 4) == text, "Frames are still read in order.");
+	}
+	
+	{
+		logInfo("Decoding a container with a damaged frame header.");
+		string damaged = packed;
+		damaged[6 + 4] ^= 0x01;
+		checkCondition(blockRoundTrip(damaged, 4) == "<error>", "The damage is reported.");
+
+		string huge = packed.substr(0, 6 + 4) + string("\xF0\xFF\xFF\xFF", 4) + packed.substr(6 + 8, 8);
+		checkCondition(blockRoundTrip(huge, 4) == "<error>", "A frame claiming a 4GB payload is reported, not read.");
+	}
+
+	{
+		logInfo("Checking frame checksums.");
+		checkCondition(crc32c(0, "123456789", 9) == 0xE3069283u, "CRC-32C of the standard check string is right.");
+		bool agreed = crc32cPortable(crc32cPortable(0, text.data(), 1000), text.data() + 1000, 3000) ==
+		              crc32c(0, text.data(), 4000);
+		for (size_t length = 0; length < 40; length++) {
+			agreed = agreed && crc32c(0, text.data() + 3, length) == crc32cPortable(0, text.data() + 3, length);
+		}
+		checkCondition(agreed, "Hardware and table checksums agree, in one piece or several.");
+		
+		istringbstream source(packed);
+		checkCondition(verify(source, options) == text.size(), "verify accepts the container and gives its length.");
+		PipeBuffer pipe(packed);
+		istream pipeSource(&pipe);
+		istreambstream piped(pipeSource);
+		checkCondition(verify(piped, options) == text.size(), "verify reads a pipe.");
+		
+		istringbstream indexSource(packed);
+		vector<BlockIndexEntry> index;
+		readBlockIndex(indexSource, index);
+		string damaged = packed;
+		damaged[index[5].frameOffset + index[5].frameSize / 2] ^= 0x10;
+		checkCondition(blockRoundTrip(damaged, 4) == "<error>", "decompress reports a damaged payload.");
+		string message;
+		try {
+			istringbstream damagedSource(damaged);
+			verify(damagedSource, options);
+		} catch (ErrorException& e) {
+			message = e.what();
+		}
+		checkCondition(message == "Block 5 fails its checksum.", "verify names the damaged block.");
+		
+		bool rejected = false;
+		try {
+			istringbstream damagedSource(damaged);
+			ostringbstream range;
+			decompressRange(damagedSource, index[5].outputOffset, 10, range, options);
+		} catch (ErrorException&) {
+			rejected = true;
+		}
+		checkCondition(rejected, "decompressRange reports a damaged block.");
+		
+		int problems = 0;
+		for (int damage = 0; damage < 3; damage++) {
+			string broken = packed;
+			if (damage == 0) broken = packed.substr(0, packed.size() - 1);
+			if (damage == 1) broken[packed.size() - 20] ^= 0x01;
+			if (damage == 2) broken = packed.substr(0, index[3].frameOffset);
+			try {
+				istringbstream brokenSource(broken);
+				verify(brokenSource, options);
+			} catch (ErrorException&) {
+				problems++;
+			}
+		}
+		checkCondition(problems == 3, "verify reports a damaged index or trailer and truncation.");
+		
+		HuffmanOptions large = options;
+		large.blockSize = 1 << 18;
+		string noise;
+		for (int i = 0; i < 300000; i++) noise += char((size_t(i) * 7919 + i / 3) % 256);
+		istringbstream noiseSource(noise);
+		ostringbstream noisePacked;
+		compress(noiseSource, noisePacked, large);
+		string largePacked = noisePacked.str();
+		istringbstream largeSource(largePacked);
+		checkCondition(verify(largeSource, large) == noise.size(), "verify checks payloads larger than its chunks.");
+		largePacked[6 + 9 + 200000] ^= 0x04;
+		message.clear();
+		try {
+			istringbstream largeDamaged(largePacked);
+			verify(largeDamaged, large);
+		} catch (ErrorException& e) {
+			message = e.what();
+		}
+		checkCondition(message == "Block 0 fails its checksum.", "verify finds damage past the first chunk.");
+		
+		string huge = packed.substr(0, 6 + 4) + string("\xF0\xFF\xFF\xFF", 4) + packed.substr(6 + 8, 8);
+		message.clear();
+		try {
+			istringbstream hugeSource(huge);
+			verify(hugeSource, options);
+		} catch (ErrorException& e) {
+			message = e.what();
+		}
+		checkCondition(message == "Block frame is damaged: its payload is too large.",
+		               "verify reports a 4GB payload without reading it.");
+		
+		HuffmanOptions canonical;
+		canonical.format = FORMAT_CANONICAL;
+		istringbstream textSource(text);
+		ostringbstream textPacked;
+		compress(textSource, textPacked, canonical);
+		istringbstream textPackedSource(textPacked.str());
+		checkCondition(verify(textPackedSource, canonical) == text.size(), "verify decodes other formats.");
+	}
+	
+	{
+		logInfo("Overlapping reading, coding and writing in a pipeline.");
+		bool same = true, restored = true;
+		for (int depth = 2; depth <= 4; depth++) {
+			HuffmanOptions pipelined = options;
+			pipelined.pipelineDepth = depth;
+			istringbstream source(text);
+			ostringbstream result;
+			compress(source, result, pipelined);
+			same = same && result.str() == packed;
+
+			istringbstream packedSource(packed);
+			ostringbstream unpacked;
+			decompress(packedSource, unpacked, pipelined);
+			restored = restored && unpacked.str() == text;
+		}
+		checkCondition(same, "A pipeline writes the same container as serial compression.");
+		checkCondition(restored, "A pipeline decodes the container.");
+
+		HuffmanOptions pipelined = options;
+		pipelined.pipelineDepth = 3;
+		pipelined.maxMemory = 4096;
+		string damaged = packed.substr(0, packed.size() / 2);
+		bool rejected = false;
+		try {
+			istringbstream source(damaged);
+			ostringbstream unpacked;
+			decompress(source, unpacked, pipelined);
+		} catch (ErrorException&) {
+			rejected = true;
+		}
+		checkCondition(rejected, "An error in the reading thread is reported.");
+	}
+	
+	{
+		logInfo("Streaming through pipes that cannot seek.");
+		HuffmanOptions streaming = options;
+		streaming.format = FORMAT_FREQUENCIES;
+		streaming.maxMemory = 3 * 4096;
+		
+		PipeBuffer textPipe(text);
+		istream source(&textPipe);
 		ostringbstream result;
-		compress(input, result);
+		compressStream(source, result, streaming);
+		checkCondition(result.str() == packed, "compressStream matches compress.");
 		
-		/* Decompress the input from memory. */
-		istringbstream compressedData(result.str());
-		ostringbstream decompressedData;
-		decompress(compressedData, decompressedData);
+		PipeBuffer packedPipe(packed);
+		istream packedSource(&packedPipe);
+		istreambstream input(packedSource);
+		vector<BlockIndexEntry> index;
+		checkCondition(!readBlockIndex(input, index), "A pipe has no usable index.");
 		
-		/* Confirm that it matches. */
-		checkCondition(originalData.str() == decompressedData.str(),
-		               "Compressed/decompressed data matches.");
-									 
-		checkCondition(numAllocations() - numDeallocations() == difference,
-		               "No tree nodes leaked.");
+		ostringbstream decompressed;
+		decompress(input, decompressed, streaming);
+		checkCondition(decompressed.str() == text, "A pipe decompresses within the memory ceiling.");
 	}
 	
-	endTest("Complete Stack Tests");
+	{
+		logInfo("Round-tripping interleaved streams directly.");
+		uint64_t weights[NUM_SYMBOLS] = {0};
+		countFrequencies((const unsigned char*)text.data(), text.size(), weights);
+		weights[PSEUDO_EOF] = 1;
+		EncodeTable codes;
+		buildCanonicalTable(weights, 0, codes);
+		DecodeTable table;
+		buildDecodeTable(codes, table);
+		
+		bool matched = true, rejected = true;
+		for (int streams = 1; streams <= MAX_STREAMS; streams++) {
+			for (size_t length = 0; length < 10; length++) {
+				size_t size = (length < 9)? length : text.size();
+				ostringbstream encoded;
+				encodeInterleaved(text.data(), size, codes, streams, encoded);
+				
+				istringbstream source(encoded.str());
+				string decoded(size, '\0');
+				decodeInterleaved(source, table, &decoded[0], size);
+				matched = matched && decoded == text.substr(0, size);
+				
+				if (size > 0) {
+					string cut = encoded.str().substr(0, encoded.str().size() - 1);
+					istringbstream shortSource(cut);
+					try {
+						decodeInterleaved(shortSource, table, &decoded[0], size);
+						rejected = false;
+					} catch (ErrorException&) {
+					}
+				}
+			}
+		}
+		checkCondition(matched, "Every stream count reproduces every length.");
+		checkCondition(rejected, "A truncated stream is reported.");
+		
+		ostringbstream encoded;
+		encodeInterleaved(text.data(), text.size(), codes, 4, encoded);
+		string huge = encoded.str();
+		huge.replace(1, 4, "\xF0\xFF\xFF\xFF", 4);
+		int refused = 0;
+		for (int inMemory = 0; inMemory < 2; inMemory++) {
+			istringbstream copied(huge);
+			imembstream spanned(huge.data(), huge.size());
+			string decoded(text.size(), '\0');
+			try {
+				decodeInterleaved(inMemory? (ibstream&)spanned : (ibstream&)copied, table, &decoded[0], decoded.size());
+			} catch (ErrorException&) {
+				refused++;
+			}
+		}
+		checkCondition(refused == 2, "A stream size larger than the data is reported, in memory or not.");
+	}
+	
+	{
+		logInfo("Reusing tables between blocks.");
+		string mixed;
+		for (int i = 0; i < 6; i++) {
+			for (int j = 0; j < 1500; j++) mixed += "log line " + integerToString(j % 10) + ": all quiet\n";
+			for (int j = 0; j < 40000; j++) mixed += char("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[(j * 37 + j / 7 + i) % 64]);
+		}
+		HuffmanOptions reused = options;
+		reused.blockSize = 4096;
+		HuffmanOptions fresh = reused;
+		fresh.reuseTables = false;
+		
+		Vector<int> threads;
+		threads += 1, 3;
+		string packed;
+		bool matched = true;
+		for (int t = 0; t < threads.size(); t++) {
+			reused.numThreads = threads[t];
+			istringbstream source(mixed);
+			ostringbstream result;
+			compress(source, result, reused);
+			if (t > 0) matched = matched && result.str() == packed;
+			packed = result.str();
+		}
+		checkCondition(matched, "The choice of tables doesn't depend on the thread count.");
+		
+		istringbstream source(mixed);
+		ostringbstream unshared;
+		compress(source, unshared, fresh);
+		checkCondition(packed.size() < unshared.str().size(), "Reusing tables makes the file smaller.");
+		
+		istringbstream packedSource(packed);
+		vector<BlockIndexEntry> index;
+		readBlockIndex(packedSource, index);
+		int reuses = 0, sends = 0;
+		for (size_t i = 0; i < index.size(); i++) {
+			if ((unsigned char)packed[index[i].frameOffset + 8] & BLOCK_REUSED_TABLE) reuses++; else sends++;
+		}
+		checkCondition(reuses > 0 && sends > 6, "Some blocks send tables and some reuse them.");
+		checkCondition(blockRoundTrip(packed, 4) == mixed, "Blocks that reuse tables round-trip.");
+		
+		string damaged = packed;
+		for (size_t i = 0; i < index.size(); i++) {
+			if ((unsigned char)packed[index[i].frameOffset + 8] & BLOCK_REUSED_TABLE) {
+				damaged[index[i].frameOffset + 9] ^= 1;
+				break;
+			}
+		}
+		checkCondition(blockRoundTrip(damaged, 4) == "<error>", "A reuse of the wrong table is reported.");
+		
+		/* Point a reuse at a table older than the last one sent,
+		 * fixing the checksum so that only the distance is wrong.
+		 */
+		size_t target = index.size(), lastSent = index.size(), older = index.size();
+		for (size_t i = 0; i < index.size() && target == index.size(); i++) {
+			int type = (unsigned char)packed[index[i].frameOffset + 8];
+			if (type == BLOCK_STORED || type == BLOCK_RUNS) continue;
+			if ((type & BLOCK_REUSED_TABLE) == 0) {
+				older = lastSent;
+				lastSent = i;
+			} else if (older != index.size()) {
+				target = i;
+			}
+		}
+		checkCondition(target != index.size(), "Some block reuses a table after two were sent.");
+		if (target != index.size()) {
+			string stale = packed;
+			char* frame = &stale[index[target].frameOffset];
+			uint32_t distance = uint32_t(target - older);
+			for (int k = 0; k < 4; k++) frame[9 + k] = char(distance >> (8 * k));
+			uint32_t checksum = crc32c(0, frame, index[target].frameSize - 4);
+			for (int k = 0; k < 4; k++) frame[index[target].frameSize - 4 + k] = char(checksum >> (8 * k));
+			checkCondition(blockRoundTrip(stale, 4) == "<error>", "decompress reports a reuse of an older table.");
+			
+			int refused = 0;
+			size_t starts[] = {older, lastSent, target};
+			for (int k = 0; k < 3; k++) {
+				try {
+					istringbstream staleSource(stale);
+					ostringbstream range;
+					decompressRange(staleSource, index[starts[k]].outputOffset,
+					                index[target].outputOffset + 10 - index[starts[k]].outputOffset, range, options);
+				} catch (ErrorException&) {
+					refused++;
+				}
+			}
+			checkCondition(refused == 3, "decompressRange reports it from within or before the range.");
+		}
+		
+		HuffmanOptions cached = options;
+		TableCache cache;
+		cached.tableCache = &cache;
+		istringbstream cachedSource(packed);
+		ostringbstream cachedOutput;
+		decompress(cachedSource, cachedOutput, cached);
+		checkCondition(cachedOutput.str() == mixed && cache.hits() + cache.misses() == sends,
+		               "Only blocks that send tables look them up.");
+	}
+	
+	{
+		logInfo("Decompressing byte ranges.");
+		string mixed;
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 1500; j++) mixed += "log line " + integerToString(j % 10) + ": all quiet\n";
+			mixed += string(9000, 'z');
+			for (int j = 0; j < 6000; j++) mixed += char((j * 7919 + j / 3 + i) % 256);
+		}
+		istringbstream source(mixed);
+		ostringbstream result;
+		compress(source, result, options);
+		string packed = result.str();
+		
+		istringbstream indexSource(packed);
+		vector<BlockIndexEntry> index;
+		readBlockIndex(indexSource, index);
+		bool stored = false, runs = false, reused = false;
+		for (size_t i = 0; i < index.size(); i++) {
+			int type = (unsigned char)packed[index[i].frameOffset + 8];
+			stored = stored || type == BLOCK_STORED;
+			runs = runs || type == BLOCK_RUNS;
+			reused = reused || (type & BLOCK_REUSED_TABLE) != 0;
+		}
+		checkCondition(stored && runs && reused, "The data has stored, run and reused-table blocks.");
+		
+		bool matched = true;
+		for (size_t offset = 0; offset < mixed.size(); offset += 3001) {
+			for (size_t length = 1; length <= 10000; length *= 10) {
+				istringbstream rangeSource(packed);
+				ostringbstream range;
+				uint64_t written = decompressRange(rangeSource, offset, length, range, options);
+				string expected = mixed.substr(offset, length);
+				matched = matched && written == expected.size() && range.str() == expected;
+			}
+		}
+		checkCondition(matched, "Ranges within and across blocks match the data.");
+		
+		istringbstream endSource(packed);
+		ostringbstream end;
+		uint64_t written = decompressRange(endSource, mixed.size() - 10, 100, end, options);
+		checkCondition(written == 10 && end.str() == mixed.substr(mixed.size() - 10), "A range past the end stops at the end.");
+		
+		string damaged = packed.substr(0, packed.size() - 1);
+		istringbstream damagedSource(damaged);
+		ostringbstream late;
+		decompressRange(damagedSource, 20000, 5000, late, options);
+		checkCondition(late.str() == mixed.substr(20000, 5000), "A container without its index is decoded up to the range.");
+		
+		HuffmanOptions canonical;
+		canonical.format = FORMAT_CANONICAL;
+		istringbstream textSource(text);
+		ostringbstream textPacked;
+		compress(textSource, textPacked, canonical);
+		istringbstream textRangeSource(textPacked.str());
+		ostringbstream textRange;
+		decompressRange(textRangeSource, 1000, 4000, textRange, canonical);
+		checkCondition(textRange.str() == text.substr(1000, 4000), "Other formats give the same range.");
+	}
+	
+	{
+		logInfo("Storing incompressible blocks.");
+		string noise;
+		for (int i = 0; i < 30000; i++) noise += char((i * 7919 + i / 3) % 256);
+		string mixed = noise + text.substr(0, 20000) + noise.substr(0, 9000);
+		
+		istringbstream noiseSource(noise);
+		ostringbstream noisePacked;
+		compress(noiseSource, noisePacked, options);
+		istringbstream noiseIndexSource(noisePacked.str());
+		vector<BlockIndexEntry> index;
+		readBlockIndex(noiseIndexSource, index);
+		bool allStored = !index.empty();
+		for (size_t i = 0; i < index.size(); i++) {
+			allStored = allStored && (unsigned char)noisePacked.str()[index[i].frameOffset + 8] == BLOCK_STORED;
+		}
+		checkCondition(allStored, "Every block of noise is stored.");
+		checkCondition(noisePacked.str().size() <= noise.size() + 26 + index.size() * 33,
+		               "Noise grows by no more than the frame headers, checksums and index.");
+		checkCondition(blockRoundTrip(noisePacked.str(), 3) == noise, "Stored blocks round-trip.");
+		
+		istringbstream mixedSource(mixed);
+		ostringbstream mixedPacked;
+		compress(mixedSource, mixedPacked, options);
+		string packedMixed = mixedPacked.str();
+		istringbstream mixedIndexSource(packedMixed);
+		readBlockIndex(mixedIndexSource, index);
+		int stored = 0;
+		for (size_t i = 0; i < index.size(); i++) {
+			if ((unsigned char)packedMixed[index[i].frameOffset + 8] == BLOCK_STORED) stored++;
+		}
+		checkCondition(stored > 0 && stored < int(index.size()), "Only the incompressible blocks of mixed data are stored.");
+		checkCondition(blockRoundTrip(packedMixed, 4) == mixed, "Mixed stored and coded blocks round-trip.");
+		
+		string damaged = packedMixed;
+		damaged[index[0].frameOffset] ^= 1;
+		checkCondition(blockRoundTrip(damaged, 1) == "<error>", "A stored block of the wrong size is reported.");
+	}
+	
+	{
+		logInfo("Sending runs of equal bytes.");
+		string zeros(20000, '\0');
+		istringbstream zeroSource(zeros);
+		ostringbstream zeroPacked;
+		compress(zeroSource, zeroPacked, options);
+		istringbstream zeroIndexSource(zeroPacked.str());
+		vector<BlockIndexEntry> index;
+		readBlockIndex(zeroIndexSource, index);
+		bool allRuns = !index.empty();
+		for (size_t i = 0; i < index.size(); i++) {
+			allRuns = allRuns && (unsigned char)zeroPacked.str()[index[i].frameOffset + 8] == BLOCK_RUNS;
+		}
+		checkCondition(allRuns, "Every block of zeros is sent as runs.");
+		checkCondition(zeroPacked.str().size() <= 26 + index.size() * (33 + 3), "Each block of zeros takes a few bytes.");
+		checkCondition(blockRoundTrip(zeroPacked.str(), 2) == zeros, "Blocks of zeros round-trip.");
+		
+		string padded;
+		for (int i = 0; i < 40; i++) padded += string(997, char(i % 3)) + "header" + integerToString(i);
+		padded += text.substr(0, 8192);
+		istringbstream paddedSource(padded);
+		ostringbstream paddedPacked;
+		compress(paddedSource, paddedPacked, options);
+		string packedPadded = paddedPacked.str();
+		istringbstream paddedIndexSource(packedPadded);
+		readBlockIndex(paddedIndexSource, index);
+		int runs = 0;
+		for (size_t i = 0; i < index.size(); i++) {
+			if ((unsigned char)packedPadded[index[i].frameOffset + 8] == BLOCK_RUNS) runs++;
+		}
+		checkCondition(runs > 0 && runs < int(index.size()), "Padded blocks are sent as runs and text is coded.");
+		checkCondition(blockRoundTrip(packedPadded, 3) == padded, "Runs mixed with coded blocks round-trip.");
+		
+		/* Lengthen the first run of zeros past the end of its block. */
+		string damaged = zeroPacked.str();
+		readBlockIndex(zeroIndexSource, index);
+		damaged[index[0].frameOffset + 10] ^= 0x01;
+		checkCondition(blockRoundTrip(damaged, 1) == "<error>", "Runs that don't fill their block are reported.");
+	}
+	
+	{
+		logInfo("Compressing empty input.");
+		istringbstream empty("");
+		ostringbstream result;
+		compress(empty, result, options);
+		istringbstream source(result.str());
+		vector<BlockIndexEntry> index;
+		checkCondition(readBlockIndex(source, index) && index.empty(), "The index is found and empty.");
+		checkCondition(blockRoundTrip(result.str(), 4) == "", "Empty input round-trips.");
+	}
+	
+	endTest("Block Container Tests");
+}
+
+/* Function: testPattern
+ * --------------------------------------------------------
+ * Returns an irregular bit pattern exactly width bits wide.
+ */
+uint64_t testPattern(int width) {
+	return (width == 0)? 0 : 0x9E3779B97F4A7C15ULL >> (64 - width);
+}
+
+/* Function: testBulkBitIO
+ * --------------------------------------------------------
+ * Checks the bulk bit functions of ibstream and obstream:
+ * that they agree with readBit/writeBit on bit order, that
+ * values of every width survive a round trip, and that they
+ * can be mixed with ordinary reads and writes once the
+ * stream has been flushed or aligned.
+ */
+void testBulkBitIO() {
+	beginTest("Bulk Bit I/O Tests");
+	
+	{
+		logInfo("Checking that writeBits lays bits out like writeBit.");
+		ostringbstream bulk, single;
+		bulk.writeBits(0x2D, 7);
+		bulk.flushBits();
+		for (int i = 0; i < 7; i++) single.writeBit((0x2D >> i) & 1);
+		checkCondition(bulk.str() == single.str(), "writeBits and writeBit produce the same bytes.");
+	}
+	
+	{
+		logInfo("Round-tripping values of every width from 0 to 64 bits.");
+		ostringbstream out;
+		for (int width = 0; width <= 64; width++) {
+			out.writeBits(testPattern(width), width);
+		}
+		out.flushBits();
+		
+		istringbstream source(out.str());
+		bool allMatch = true;
+		for (int width = 0; width <= 64; width++) {
+			if (source.readBits(width) != testPattern(width)) allMatch = false;
+		}
+		checkCondition(allMatch, "Every width reads back the value that was written.");
+		checkCondition(!source.fail(), "Reading exactly the written bits leaves the stream good.");
+		source.readBits(16);
+		checkCondition(source.fail(), "Reading past the end puts the stream into a fail state.");
+	}
+	
+	{
+		logInfo("Mixing bulk bits with ordinary stream operations.");
+		ostringbstream out;
+		out << 137 << ' ';
+		out.writeBits(5, 3);
+		out.flushBits();
+		out << "tail";
+		
+		istringbstream source(out.str());
+		int number;
+		source >> number;
+		source.get();
+		checkCondition(number == 137, "Text before the bits reads back correctly.");
+		checkCondition(source.readBits(3) == 5, "Bits read back correctly.");
+		source.alignBits();
+		string tail;
+		source >> tail;
+		checkCondition(tail == "tail", "Text after the bits reads back after alignBits.");
+	}
+	
+	{
+		logInfo("Writing and reading memory-mapped files.");
+		string text;
+		for (int i = 0; i < 100000; i++) text += char('a' + (i * 7 + i / 13) % 23);
+		{
+			omapbstream out("test/mapped.tmp", 1);
+			assertCondition(out.is_open(), "Cannot create test/mapped.tmp!");
+			out.writeBits(testPattern(13), 13);
+			out.flushBits();
+			out << text;
+			checkCondition(out.size() == long(2 + text.size()), "size counts everything written.");
+		}
+		
+		ifbstream plain("test/mapped.tmp");
+		ostringstream contents;
+		contents << plain.rdbuf();
+		checkCondition(contents.str().size() == 2 + text.size() && contents.str().substr(2) == text,
+		               "The file is cut back to exactly what was written.");
+		
+		imapbstream mapped("test/mapped.tmp");
+		assertCondition(mapped.is_open(), "Cannot map test/mapped.tmp!");
+		checkCondition(mapped.length() == 2 + text.size() && mapped.size() == long(mapped.length()),
+		               "The mapping covers the whole file.");
+		checkCondition(string(mapped.data() + 2, text.size()) == text, "The mapped bytes match the file.");
+		checkCondition(mapped.readBits(13) == testPattern(13), "Bits read back from the mapping.");
+		mapped.alignBits();
+		checkCondition(mapped.tellg() == streampos(2), "Aligning leaves the stream after the bits.");
+		
+		const char* data;
+		size_t length;
+		checkCondition(mappedBytes(mapped, data, length) && length == text.size() && data == mapped.data() + 2,
+		               "mappedBytes gives the unread part of the mapping.");
+		checkCondition(!mappedBytes(plain, data, length), "mappedBytes ignores ordinary streams.");
+		
+		Vector<string> formatNames;
+		Vector<HuffmanOptions> formats = testFormats(formatNames);
+		bool sameOutput = true;
+		for (int i = 0; i < formats.size(); i++) {
+			mapped.rewind();
+			plain.rewind();
+			ostringbstream fromMapped, fromPlain;
+			compress(mapped, fromMapped, formats[i]);
+			compress(plain, fromPlain, formats[i]);
+			sameOutput = sameOutput && fromMapped.str() == fromPlain.str();
+		}
+		checkCondition(sameOutput, "Mapped input compresses the same as a file buffer in every format.");
+		mapped.close();
+		plain.close();
+		remove("test/mapped.tmp");
+	}
+	
+	endTest("Bulk Bit I/O Tests");
 }
 
 /* Function: printBits
@@ -913,6 +2354,9 @@ void displayMenu() {
 	cout << setw(2) << COMPRESS << ": Compress a file" << endl;
 	cout << setw(2) << DECOMPRESS << ": Decompress a compressed file" << endl;
 	cout << setw(2) << COMPARE << ": Compare two files for equality" << endl;
+	cout << setw(2) << AUTOMATIC_BIT_IO_TESTS << ": Automatically test bulk bit I/O" << endl;
+	cout << setw(2) << AUTOMATIC_TABLE_TESTS << ": Automatically test canonical code tables" << endl;
+	cout << setw(2) << AUTOMATIC_BLOCK_TESTS << ": Automatically test the block container" << endl;
 	cout << setw(2) << QUIT << ": Quit" << endl;
 }
 
@@ -976,6 +2420,15 @@ int main() {
 			case COMPARE:
 				compareFiles();
 				break;
+			case AUTOMATIC_BIT_IO_TESTS:
+				testBulkBitIO();
+				break;
+			case AUTOMATIC_TABLE_TESTS:
+				testCodeTables();
+				break;
+			case AUTOMATIC_BLOCK_TESTS:
+				testBlockContainer();
+				break;
 			case QUIT:
 				return 0;
 			default:
@@ -0,0 +1,331 @@
+/**********************************************************
+ * File: HuffmanSimd.cpp
+ *
+ * Implementation of the code packing kernels.
+ *
+ * Every kernel works from one 64-bit entry per byte, holding
+ * the code in its low bits and the length in its top byte, and
+ * packs the codes into whole 64-bit words that go to outfile a
+ * batch at a time.  Short codes are merged into one value
+ * before they are appended: each is shifted up by the total
+ * length of the codes before it, so a group can be ORed
+ * together and appended in one step.  The scalar kernel
+ * merges four codes of up to 16 bits, or two of up to 32.
+ * The vector kernels merge eight codes of up to 8 bits, a
+ * group to each 64-bit lane, so that the merge runs down the
+ * lanes: AVX2 fetches the entries for four groups with one
+ * gather, while NEON, which has no gather, looks them up one
+ * by one and merges two groups at once.  Merging groups of
+ * four in vectors was tried too, but it was no faster than
+ * the scalar kernel, so longer codes are always packed by it.
+ *
+ * The AVX2 kernel is compiled for AVX2 by a target attribute,
+ * so the rest of the program needs no special flags, and is
+ * only called once the processor has been seen to support it.
+ * NEON is part of every ARMv8 processor, so the NEON kernel is
+ * simply compiled in on ARM.
+ */
+
+#include <algorithm>
+#include <stdint.h>
+#include "HuffmanSimd.h"
+#include "error.h"
+using namespace std;
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HUFFMAN_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HUFFMAN_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Constant: PACK_WORDS
+ * How many finished words collect before they go to outfile.
+ * Input is packed in chunks small enough that their codes
+ * always fit, so the kernels never stop to write.
+ */
+static const int PACK_WORDS = 1024;
+
+/* Constant: CODE_MASK
+ * The bits of an entry that hold the code.
+ */
+static const uint64_t CODE_MASK = (uint64_t(1) << 48) - 1;
+
+/* Type: PackState
+ * Words finished but not yet written, and the bits of the
+ * word being filled.  bits is always below 64.  The kernels
+ * work on a copy in locals, since their stores to words could
+ * otherwise alias pending.
+ */
+struct PackState {
+	uint64_t* words;
+	int count;
+	uint64_t pending;
+	int bits;
+};
+
+/* Function: appendBits
+ * --------------------------------------------------------
+ * Adds the low length bits of code, at most 64 of them, to
+ * the word being filled.  The bits that don't fit start the
+ * next word.
+ */
+static inline void appendBits(PackState& state, uint64_t code, int length) {
+	state.pending |= code << state.bits;
+	state.bits += length;
+	if (state.bits >= 64) {
+		state.words[state.count++] = state.pending;
+		state.bits -= 64;
+		state.pending = (state.bits == 0)? 0 : code >> (length - state.bits);
+	}
+}
+
+/* Function: packScalar
+ * --------------------------------------------------------
+ * Merges four codes at a time if they are short enough, two
+ * at a time if two still fit in a word, and otherwise appends
+ * them one by one.
+ */
+static void packScalar(const unsigned char* data, size_t length, const uint64_t entries[256],
+                       int longest, PackState& shared) {
+	PackState state = shared;
+	size_t i = 0;
+	if (longest <= 16) {
+		for (; i + 4 <= length; i += 4) {
+			uint64_t e0 = entries[data[i]], e1 = entries[data[i + 1]];
+			uint64_t e2 = entries[data[i + 2]], e3 = entries[data[i + 3]];
+			int l0 = int(e0 >> 56), l1 = int(e1 >> 56), l2 = int(e2 >> 56), l3 = int(e3 >> 56);
+			uint64_t merged = (e0 & CODE_MASK) | ((e1 & CODE_MASK) << l0) |
+			                  ((e2 & CODE_MASK) << (l0 + l1)) | ((e3 & CODE_MASK) << (l0 + l1 + l2));
+			appendBits(state, merged, l0 + l1 + l2 + l3);
+		}
+	} else if (longest <= 32) {
+		for (; i + 2 <= length; i += 2) {
+			uint64_t e0 = entries[data[i]], e1 = entries[data[i + 1]];
+			int l0 = int(e0 >> 56);
+			appendBits(state, (e0 & CODE_MASK) | ((e1 & CODE_MASK) << l0), l0 + int(e1 >> 56));
+		}
+	}
+	for (; i < length; i++) {
+		appendBits(state, entries[data[i]] & CODE_MASK, int(entries[data[i]] >> 56));
+	}
+	shared = state;
+}
+
+#ifdef HUFFMAN_HAVE_AVX2
+
+/* Function: mergeStepAvx2
+ * --------------------------------------------------------
+ * Adds the code in each lane of entries to the lane's merged
+ * value, above the offset bits already there, and moves the
+ * offset past it.
+ */
+#define mergeStepAvx2(merged, offset, entries, mask) \
+	(merged) = _mm256_or_si256((merged), _mm256_sllv_epi64(_mm256_and_si256((entries), (mask)), (offset))); \
+	(offset) = _mm256_add_epi64((offset), _mm256_srli_epi64((entries), 56))
+
+/* Function: packAvx2
+ * --------------------------------------------------------
+ * Packs 32 bytes at a time as four groups of eight, one group
+ * to a 64-bit lane, so that byte j of every group is byte j of
+ * its lane: shifting the lanes down by 8j bits and masking
+ * gives the four indices for one gather.  The merge then runs
+ * down the lanes with no work across them, and only the four
+ * appends are left to scalar code.  Returns how many bytes it
+ * packed; the caller packs the rest.
+ */
+__attribute__((target("avx2")))
+static size_t packAvx2(const unsigned char* data, size_t length, const uint64_t entries[256],
+                       PackState& shared) {
+	PackState state = shared;
+	const long long* base = (const long long*)entries;
+	const __m256i mask = _mm256_set1_epi64x((long long)CODE_MASK);
+	const __m256i lowByte = _mm256_set1_epi64x(0xFF);
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i*)(data + i));
+		__m256i e0 = _mm256_i64gather_epi64(base, _mm256_and_si256(bytes, lowByte), 8);
+		__m256i e1 = _mm256_i64gather_epi64(base, _mm256_and_si256(_mm256_srli_epi64(bytes, 8), lowByte), 8);
+		__m256i e2 = _mm256_i64gather_epi64(base, _mm256_and_si256(_mm256_srli_epi64(bytes, 16), lowByte), 8);
+		__m256i e3 = _mm256_i64gather_epi64(base, _mm256_and_si256(_mm256_srli_epi64(bytes, 24), lowByte), 8);
+		__m256i e4 = _mm256_i64gather_epi64(base, _mm256_and_si256(_mm256_srli_epi64(bytes, 32), lowByte), 8);
+		__m256i e5 = _mm256_i64gather_epi64(base, _mm256_and_si256(_mm256_srli_epi64(bytes, 40), lowByte), 8);
+		__m256i e6 = _mm256_i64gather_epi64(base, _mm256_and_si256(_mm256_srli_epi64(bytes, 48), lowByte), 8);
+		__m256i e7 = _mm256_i64gather_epi64(base, _mm256_srli_epi64(bytes, 56), 8);
+
+		__m256i merged = _mm256_and_si256(e0, mask);
+		__m256i offset = _mm256_srli_epi64(e0, 56);
+		mergeStepAvx2(merged, offset, e1, mask);
+		mergeStepAvx2(merged, offset, e2, mask);
+		mergeStepAvx2(merged, offset, e3, mask);
+		mergeStepAvx2(merged, offset, e4, mask);
+		mergeStepAvx2(merged, offset, e5, mask);
+		mergeStepAvx2(merged, offset, e6, mask);
+		mergeStepAvx2(merged, offset, e7, mask);
+
+		uint64_t codes[4], lengths[4];
+		_mm256_storeu_si256((__m256i*)codes, merged);
+		_mm256_storeu_si256((__m256i*)lengths, offset);
+		for (int g = 0; g < 4; g++) appendBits(state, codes[g], int(lengths[g]));
+	}
+	shared = state;
+	return i;
+}
+
+/* Function: cpuHasAvx2
+ * --------------------------------------------------------
+ * Asks the processor, through the compiler's cpuid wrapper.
+ */
+static bool cpuHasAvx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+}
+
+#endif
+
+#ifdef HUFFMAN_HAVE_NEON
+
+/* Function: packNeon
+ * --------------------------------------------------------
+ * Packs 16 bytes at a time as two groups of eight, one group
+ * to a lane, as packAvx2 does.  With no gather, the entries
+ * are looked up one by one and paired into vectors; the
+ * shifts, merges and offsets are then done for both groups
+ * at once.  Returns how many bytes it packed.
+ */
+static size_t packNeon(const unsigned char* data, size_t length, const uint64_t entries[256],
+                       PackState& shared) {
+	PackState state = shared;
+	const uint64x2_t mask = vdupq_n_u64(CODE_MASK);
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		uint64x2_t merged = vdupq_n_u64(0);
+		uint64x2_t offset = vdupq_n_u64(0);
+		for (int j = 0; j < 8; j++) {
+			uint64x2_t pair = vcombine_u64(vcreate_u64(entries[data[i + j]]), vcreate_u64(entries[data[i + 8 + j]]));
+			merged = vorrq_u64(merged, vshlq_u64(vandq_u64(pair, mask), vreinterpretq_s64_u64(offset)));
+			offset = vaddq_u64(offset, vshrq_n_u64(pair, 56));
+		}
+		appendBits(state, vgetq_lane_u64(merged, 0), int(vgetq_lane_u64(offset, 0)));
+		appendBits(state, vgetq_lane_u64(merged, 1), int(vgetq_lane_u64(offset, 1)));
+	}
+	shared = state;
+	return i;
+}
+
+#endif
+
+/* Function: isKernelSupported
+ * Usage: if (isKernelSupported(KERNEL_AVX2)) { ... }
+ * --------------------------------------------------------
+ * The processor is asked once; the answer can't change.
+ */
+bool isKernelSupported(EncodeKernel kernel) {
+	switch (kernel) {
+	case KERNEL_SCALAR:
+		return true;
+	case KERNEL_AVX2: {
+#ifdef HUFFMAN_HAVE_AVX2
+		static const bool supported = cpuHasAvx2();
+		return supported;
+#else
+		return false;
+#endif
+	}
+	case KERNEL_NEON:
+#ifdef HUFFMAN_HAVE_NEON
+		return true;
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+/* Function: bestEncodeKernel
+ * Usage: EncodeKernel kernel = bestEncodeKernel();
+ * --------------------------------------------------------
+ * A machine supports at most one of the vector kernels.
+ */
+EncodeKernel bestEncodeKernel() {
+	if (isKernelSupported(KERNEL_AVX2)) return KERNEL_AVX2;
+	if (isKernelSupported(KERNEL_NEON)) return KERNEL_NEON;
+	return KERNEL_SCALAR;
+}
+
+/* Function: kernelName
+ * Usage: cout << kernelName(kernel) << endl;
+ * --------------------------------------------------------
+ * Names for reports and benchmarks.
+ */
+const char* kernelName(EncodeKernel kernel) {
+	switch (kernel) {
+	case KERNEL_SCALAR: return "scalar";
+	case KERNEL_AVX2: return "avx2";
+	case KERNEL_NEON: return "neon";
+	}
+	return "unknown";
+}
+
+/* Function: packCodes
+ * Usage: packCodes(data, length, table, outfile, kernel);
+ * --------------------------------------------------------
+ * Builds the entries, masking off any bits above each code as
+ * writeBits would.  Then, a chunk at a time, lets the kernel
+ * pack what it can, packs the rest with the scalar kernel and
+ * writes the finished words.  The final partial word goes out
+ * as a short run of bits, so outfile is left where encodeBytes
+ * would leave it.
+ */
+void packCodes(const char* data, size_t length, const EncodeTable& table, obstream& outfile,
+               EncodeKernel kernel) {
+	if (!isKernelSupported(kernel)) error(string("The ") + kernelName(kernel) + " kernel is not supported here.");
+
+	uint64_t entries[256];
+	int longest = 0;
+	for (int ch = 0; ch < 256; ch++) {
+		int bits = table.lengths[ch];
+		uint64_t code = (bits >= 64)? table.codes[ch] : table.codes[ch] & ((uint64_t(1) << bits) - 1);
+		entries[ch] = (code & CODE_MASK) | (uint64_t(bits) << 56);
+		longest = max(longest, bits);
+	}
+	if (longest > 48) {
+		for (size_t i = 0; i < length; i++) {
+			unsigned char ch = (unsigned char)data[i];
+			outfile.writeBits(table.codes[ch], table.lengths[ch]);
+		}
+		return;
+	}
+
+	uint64_t words[PACK_WORDS];
+	PackState state;
+	state.words = words;
+	state.count = 0;
+	state.pending = 0;
+	state.bits = 0;
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	const size_t chunkSize = size_t(64) * (PACK_WORDS - 1) / max(longest, 1);
+	while (length > 0) {
+		size_t chunk = min(length, chunkSize);
+		size_t done = 0;
+		if (longest <= MAX_VECTOR_CODE_LENGTH) {
+#ifdef HUFFMAN_HAVE_AVX2
+			if (kernel == KERNEL_AVX2) done = packAvx2(bytes, chunk, entries, state);
+#endif
+#ifdef HUFFMAN_HAVE_NEON
+			if (kernel == KERNEL_NEON) done = packNeon(bytes, chunk, entries, state);
+#endif
+		}
+		packScalar(bytes + done, chunk - done, entries, longest, state);
+
+		for (int w = 0; w < state.count; w++) outfile.writeBits(words[w], 64);
+		state.count = 0;
+		bytes += chunk;
+		length -= chunk;
+	}
+	if (state.bits > 0) outfile.writeBits(state.pending, state.bits);
+}
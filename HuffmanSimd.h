@@ -0,0 +1,69 @@
+/**********************************************************
+ * File: HuffmanSimd.h
+ *
+ * Kernels that pack the codes of a run of bytes into the
+ * output, one scalar and one for each vector instruction set
+ * the encoder knows, and the run-time choice between them.
+ * Every kernel writes exactly the bits the others do, so the
+ * choice only changes how fast encodeBytes runs.
+ */
+
+#ifndef HuffmanSimd_Included
+#define HuffmanSimd_Included
+
+#include <cstddef>
+#include "bstream.h"
+#include "HuffmanTables.h"
+
+/* Type: EncodeKernel
+ * The ways codes can be packed.  KERNEL_SCALAR works on any
+ * machine; KERNEL_AVX2 needs an x86 processor with AVX2, and
+ * KERNEL_NEON an ARM build with NEON.
+ */
+enum EncodeKernel {
+	KERNEL_SCALAR,
+	KERNEL_AVX2,
+	KERNEL_NEON
+};
+
+/* Constant: MAX_VECTOR_CODE_LENGTH
+ * The longest code the vector kernels handle.  Eight codes
+ * this long fill one 64-bit lane; tables with longer codes
+ * are packed by the scalar kernel whatever is asked for.
+ */
+const int MAX_VECTOR_CODE_LENGTH = 8;
+
+/* Function: isKernelSupported
+ * Usage: if (isKernelSupported(KERNEL_AVX2)) { ... }
+ * --------------------------------------------------------
+ * Returns whether this build and this processor can run the
+ * given kernel.
+ */
+bool isKernelSupported(EncodeKernel kernel);
+
+/* Function: bestEncodeKernel
+ * Usage: EncodeKernel kernel = bestEncodeKernel();
+ * --------------------------------------------------------
+ * Returns the fastest kernel this machine supports.  The
+ * processor is only examined the first time.
+ */
+EncodeKernel bestEncodeKernel();
+
+/* Function: kernelName
+ * Usage: cout << kernelName(kernel) << endl;
+ * --------------------------------------------------------
+ * Returns "scalar", "avx2" or "neon".
+ */
+const char* kernelName(EncodeKernel kernel);
+
+/* Function: packCodes
+ * Usage: packCodes(data, length, table, outfile, KERNEL_AVX2);
+ * --------------------------------------------------------
+ * Writes the codes of the given bytes to outfile, as
+ * encodeBytes does, with the given kernel.  Reports an error
+ * if the kernel isn't supported.
+ */
+void packCodes(const char* data, size_t length, const EncodeTable& table, obstream& outfile,
+               EncodeKernel kernel);
+
+#endif
@@ -0,0 +1,68 @@
+/**********************************************************
+ * File: HuffmanStats.cpp
+ *
+ * Implementation of HuffmanStats and StageTimer.
+ */
+
+#include <algorithm>
+#include "HuffmanStats.h"
+
+/* Member function: clear
+ * Usage: stats.clear();
+ * --------------------------------------------------------
+ * Every field is a number, so each is simply zeroed.
+ */
+void HuffmanStats::clear() {
+	countSeconds = treeSeconds = headerSeconds = encodeSeconds = decodeSeconds = 0;
+	bytesIn = bytesOut = 0;
+	bitsWritten = symbolsCoded = 0;
+	maxCodeDepth = 0;
+	allocations = 0;
+}
+
+/* Member function: averageCodeLength
+ * Usage: double bits = stats.averageCodeLength();
+ * --------------------------------------------------------
+ * Bits per character coded.
+ */
+double HuffmanStats::averageCodeLength() const {
+	return (symbolsCoded == 0)? 0 : double(bitsWritten) / double(symbolsCoded);
+}
+
+/* Member function: addCodes
+ * Usage: stats.addCodes(weights, table);
+ * --------------------------------------------------------
+ * Characters that never occur don't count toward the depth,
+ * though they may have codes.
+ */
+void HuffmanStats::addCodes(const uint64_t weights[NUM_SYMBOLS], const EncodeTable& table) {
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		if (weights[ch] == 0) continue;
+		bitsWritten += weights[ch] * table.lengths[ch];
+		symbolsCoded += weights[ch];
+		maxCodeDepth = std::max(maxCodeDepth, int(table.lengths[ch]));
+	}
+}
+
+/* Constructor: StageTimer
+ * --------------------------------------------------------
+ * The clock is only read when there are stats to add to.
+ */
+StageTimer::StageTimer(HuffmanStats* stats, double HuffmanStats::* stage) : stats(stats), stage(stage) {
+	if (stats != NULL) start = std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer() {
+	stop();
+}
+
+/* Member function: stop
+ * --------------------------------------------------------
+ * Forgets the stats once the time is added, so a second stop
+ * (or the destructor) adds nothing.
+ */
+void StageTimer::stop() {
+	if (stats == NULL) return;
+	stats->*stage += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	stats = NULL;
+}
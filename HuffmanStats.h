@@ -0,0 +1,131 @@
+/**********************************************************
+ * File: HuffmanStats.h
+ *
+ * Optional measurements of where compress and decompress
+ * spend their time.  Point HuffmanOptions::stats at a
+ * HuffmanStats and every call adds its stage timings and
+ * counters to it; with stats left NULL nothing is measured,
+ * and each stage costs one extra pointer test.
+ */
+
+#ifndef HuffmanStats_Included
+#define HuffmanStats_Included
+
+#include <chrono>
+#include <stdint.h>
+#include "HuffmanTables.h"
+
+/* Type: HuffmanStats
+ * Totals over every call that was given these stats.  Times
+ * are wall-clock seconds, so the stages of FORMAT_BLOCKS,
+ * which run on several threads, are timed as a whole.
+ */
+struct HuffmanStats {
+	/* Time spent counting characters (compress only), and in
+	 * FORMAT_BLOCKS reading the blocks to count.
+	 */
+	double countSeconds;
+
+	/* Time spent building trees and code or decode tables,
+	 * or looking them up in a TableCache.
+	 */
+	double treeSeconds;
+
+	/* Time spent writing or reading file and block headers. */
+	double headerSeconds;
+
+	/* Time spent encoding the data and writing it out. */
+	double encodeSeconds;
+
+	/* Time spent reading the data and decoding it. */
+	double decodeSeconds;
+
+	/* The bytes read and written.  Compressed sizes come from
+	 * the positions of the streams (see tellBits), so they are
+	 * not counted when a stream can't report its position, as
+	 * a pipe can't.
+	 */
+	uint64_t bytesIn, bytesOut;
+
+	/* The bits of Huffman code compress wrote, headers not
+	 * included, and how many characters (PSEUDO_EOF too) they
+	 * code.  Stored blocks, runs and FORMAT_DICTIONARY files,
+	 * whose characters are never counted, are left out.
+	 */
+	uint64_t bitsWritten, symbolsCoded;
+
+	/* The longest code in any table compress coded with. */
+	int maxCodeDepth;
+
+	/* Nodes allocated during the calls (see numAllocations).
+	 * The count is process-wide, so it includes nodes other
+	 * threads allocated at the same time.
+	 */
+	long allocations;
+
+	HuffmanStats() {
+		clear();
+	}
+
+	/* Member function: clear
+	 * Usage: stats.clear();
+	 * ---------------------
+	 * Sets every total back to zero.
+	 */
+	void clear();
+
+	/* Member function: averageCodeLength
+	 * Usage: double bits = stats.averageCodeLength();
+	 * -----------------------------------------------
+	 * Returns bitsWritten over symbolsCoded, or 0 if nothing
+	 * was coded.
+	 */
+	double averageCodeLength() const;
+
+	/* Member function: addCodes
+	 * Usage: stats.addCodes(weights, table);
+	 * --------------------------------------
+	 * Adds characters coded weights[ch] times each with table
+	 * to bitsWritten, symbolsCoded and maxCodeDepth.
+	 */
+	void addCodes(const uint64_t weights[NUM_SYMBOLS], const EncodeTable& table);
+};
+
+/* Class: StageTimer
+ * ---------------------------------------------------------
+ * Adds the time from its construction to its destruction, or
+ * to stop, to one of the times in a HuffmanStats.  With NULL
+ * stats it never reads the clock.
+ */
+class StageTimer {
+public:
+	/* Constructor: StageTimer
+	 * Usage: StageTimer timer(options.stats, &HuffmanStats::countSeconds);
+	 * ---------------------------------------
+	 * Starts timing the given stage.
+	 */
+	StageTimer(HuffmanStats* stats, double HuffmanStats::* stage);
+
+	/* Destructor: ~StageTimer
+	 * -----------------------
+	 * Stops the timer if stop hasn't.
+	 */
+	~StageTimer();
+
+	/* Member function: stop
+	 * Usage: timer.stop();
+	 * --------------------
+	 * Adds the time so far to the stage and stops the timer.
+	 */
+	void stop();
+
+private:
+	HuffmanStats* stats;
+	double HuffmanStats::* stage;
+	std::chrono::steady_clock::time_point start;
+
+	StageTimer(const StageTimer&);
+	StageTimer& operator=(const StageTimer&);
+};
+
+#endif
@@ -0,0 +1,464 @@
+/**********************************************************
+ * File: HuffmanTables.cpp
+ *
+ * Implementation of the lookup tables from HuffmanTables.h.
+ */
+
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include "HuffmanTables.h"
+#include "error.h"
+#include "strlib.h"
+
+/* Constant: HISTOGRAM_CHUNK
+ * The most bytes counted into the 32-bit interleaved histograms
+ * before they are folded into the 64-bit totals.  Each lane sees
+ * at most a quarter of a chunk, so none of them can overflow.
+ */
+static const size_t HISTOGRAM_CHUNK = size_t(1) << 30;
+
+/* Function: countFrequencies
+ * Usage: countFrequencies(data, length, counts);
+ * --------------------------------------------------------
+ * Counts into four independent histograms and merges them at
+ * the end.  Runs of the same byte would otherwise make every
+ * increment wait on the store of the one before it; spreading
+ * consecutive bytes across separate tables breaks that chain.
+ */
+void countFrequencies(const unsigned char* data, size_t length, uint64_t counts[256]) {
+	while (length > 0) {
+		size_t chunk = std::min(length, HISTOGRAM_CHUNK);
+		uint32_t lanes[4][256] = {{0}};
+
+		size_t i = 0;
+		for (; i + 8 <= chunk; i += 8) {
+			lanes[0][data[i    ]]++;
+			lanes[1][data[i + 1]]++;
+			lanes[2][data[i + 2]]++;
+			lanes[3][data[i + 3]]++;
+			lanes[0][data[i + 4]]++;
+			lanes[1][data[i + 5]]++;
+			lanes[2][data[i + 6]]++;
+			lanes[3][data[i + 7]]++;
+		}
+		for (; i < chunk; i++) lanes[0][data[i]]++;
+
+		for (int ch = 0; ch < 256; ch++) {
+			counts[ch] += uint64_t(lanes[0][ch]) + lanes[1][ch] + lanes[2][ch] + lanes[3][ch];
+		}
+		data += chunk;
+		length -= chunk;
+	}
+}
+
+/* Function: sortByWeight
+ * --------------------------------------------------------
+ * Stably sorts the count characters in symbols by weight with
+ * an LSD radix sort on bytes, skipping the high bytes that
+ * are zero in every weight.
+ */
+static void sortByWeight(const uint64_t weights[NUM_SYMBOLS], ext_char symbols[], int count) {
+	uint64_t all = 0;
+	for (int i = 0; i < count; i++) {
+		all |= weights[symbols[i]];
+	}
+
+	ext_char scratch[NUM_SYMBOLS];
+	for (int shift = 0; shift < 64 && (all >> shift) != 0; shift += 8) {
+		int starts[256 + 1] = {0};
+		for (int i = 0; i < count; i++) {
+			starts[((weights[symbols[i]] >> shift) & 0xFF) + 1]++;
+		}
+		for (int digit = 0; digit < 256; digit++) {
+			starts[digit + 1] += starts[digit];
+		}
+		for (int i = 0; i < count; i++) {
+			scratch[starts[(weights[symbols[i]] >> shift) & 0xFF]++] = symbols[i];
+		}
+		std::copy(scratch, scratch + count, symbols);
+	}
+}
+
+/* Function: buildTreeShape
+ * Usage: buildTreeShape(weights, symbols, count, shape);
+ * --------------------------------------------------------
+ * The classic two-queue construction.  The leaf queue is the
+ * sorted leaves and the merged queue is the internal slots
+ * created so far; each step takes the lighter front twice.
+ */
+void buildTreeShape(const uint64_t weights[NUM_SYMBOLS], const ext_char* symbols, int count, TreeShape& shape) {
+	if (count < 0 || count > NUM_SYMBOLS) error("Cannot build a tree of " + integerToString(count) + " leaves.");
+	shape.numLeaves = count;
+	std::copy(symbols, symbols + count, shape.leaves);
+	sortByWeight(weights, shape.leaves, count);
+
+	uint64_t slotWeights[2 * NUM_SYMBOLS];
+	for (int i = 0; i < count; i++) {
+		slotWeights[i] = weights[shape.leaves[i]];
+	}
+
+	int nextLeaf = 0, nextMerged = count, created = count;
+	for (int i = 0; i + 1 < count; i++) {
+		int children[2];
+		for (int k = 0; k < 2; k++) {
+			if (nextLeaf < count && (nextMerged == created || slotWeights[nextLeaf] <= slotWeights[nextMerged])) {
+				children[k] = nextLeaf++;
+			} else {
+				children[k] = nextMerged++;
+			}
+		}
+		shape.zero[i] = children[0];
+		shape.one[i] = children[1];
+		slotWeights[created++] = slotWeights[children[0]] + slotWeights[children[1]];
+	}
+}
+
+/* Function: buildCodeLengths
+ * Usage: buildCodeLengths(weights, table);
+ * --------------------------------------------------------
+ * Every internal node is created after its children, so one
+ * pass from the root back down hands out all the depths.
+ */
+void buildCodeLengths(const uint64_t weights[NUM_SYMBOLS], EncodeTable& table) {
+	ext_char symbols[NUM_SYMBOLS];
+	int count = 0;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		table.codes[ch] = 0;
+		table.lengths[ch] = 0;
+		if (weights[ch] != 0) symbols[count++] = ch;
+	}
+	if (count <= 1) return;
+
+	TreeShape shape;
+	buildTreeShape(weights, symbols, count, shape);
+
+	int depths[2 * NUM_SYMBOLS];
+	depths[2 * count - 2] = 0;
+	for (int i = count - 2; i >= 0; i--) {
+		int depth = depths[count + i] + 1;
+		if (depth > MAX_CODE_LENGTH) error("Encoding tree is too deep to build a code table.");
+		depths[shape.zero[i]] = depths[shape.one[i]] = depth;
+	}
+	for (int i = 0; i < count; i++) {
+		table.lengths[shape.leaves[i]] = (unsigned char)depths[i];
+	}
+}
+
+/* Type: PackageItem
+ * An entry in one of package-merge's lists: a single leaf,
+ * or a package of two items from the list below it.
+ */
+struct PackageItem {
+	uint64_t weight;
+	int symbol;       // the character for a leaf, -1 for a package
+	int first, second; // indices of the packaged items
+};
+
+/* Function: countLeaves
+ * --------------------------------------------------------
+ * Adds one to the length of every leaf inside item.  Each
+ * appearance of a leaf among the chosen items costs it one
+ * more bit.
+ */
+static void countLeaves(const std::vector<PackageItem>& items, int item, EncodeTable& table) {
+	if (items[item].symbol >= 0) {
+		table.lengths[items[item].symbol]++;
+	} else {
+		countLeaves(items, items[item].first, table);
+		countLeaves(items, items[item].second, table);
+	}
+}
+
+/* Function: buildLimitedCodeLengths
+ * Usage: buildLimitedCodeLengths(weights, 12, table);
+ * --------------------------------------------------------
+ * Package-merge: start from the leaves sorted by weight, then
+ * maxLength - 1 times pair up neighbouring items into packages
+ * and merge them back with the leaves.  The cheapest 2n - 2
+ * items of the final list determine the lengths.  Ties are
+ * broken by character so the result is deterministic.
+ */
+void buildLimitedCodeLengths(const uint64_t weights[NUM_SYMBOLS], int maxLength, EncodeTable& table) {
+	std::vector<PackageItem> items;
+	ext_char sorted[NUM_SYMBOLS];
+	int n = 0;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		table.codes[ch] = 0;
+		table.lengths[ch] = 0;
+		if (weights[ch] != 0) sorted[n++] = ch;
+	}
+	sortByWeight(weights, sorted, n);
+
+	if (n <= 1) return;
+	if (maxLength < 1 || maxLength > MAX_CODE_LENGTH || (maxLength < 31 && (1 << maxLength) < n))
+		error("Cannot fit " + integerToString(n) + " codes within length " + integerToString(maxLength) + ".");
+
+	std::vector<int> leaves;
+	for (int i = 0; i < n; i++) {
+		PackageItem leaf = { weights[sorted[i]], sorted[i], 0, 0 };
+		leaves.push_back(int(items.size()));
+		items.push_back(leaf);
+	}
+
+	std::vector<int> list = leaves;
+	for (int level = 1; level < maxLength; level++) {
+		std::vector<int> packages;
+		for (size_t i = 0; i + 1 < list.size(); i += 2) {
+			PackageItem package = { items[list[i]].weight + items[list[i + 1]].weight, -1, list[i], list[i + 1] };
+			packages.push_back(int(items.size()));
+			items.push_back(package);
+		}
+
+		/* Merge, preferring leaves on ties. */
+		std::vector<int> merged;
+		size_t a = 0, b = 0;
+		while (a < leaves.size() || b < packages.size()) {
+			if (b == packages.size() ||
+			    (a < leaves.size() && items[leaves[a]].weight <= items[packages[b]].weight)) {
+				merged.push_back(leaves[a++]);
+			} else {
+				merged.push_back(packages[b++]);
+			}
+		}
+		list.swap(merged);
+	}
+
+	for (int i = 0; i < 2 * n - 2; i++) {
+		countLeaves(items, list[i], table);
+	}
+}
+
+/* Function: collectCodes
+ * --------------------------------------------------------
+ * Walks the tree, recording the code of every leaf.
+ */
+static void collectCodes(Node* tree, uint64_t code, int depth, EncodeTable& table) {
+	if (tree == NULL) return;
+	if (tree->character != NOT_A_CHAR) {
+		if (depth > MAX_CODE_LENGTH) error("Encoding tree is too deep to build a code table.");
+		table.codes[tree->character] = code;
+		table.lengths[tree->character] = (unsigned char)depth;
+		return;
+	}
+	collectCodes(tree->zero, code, depth + 1, table);
+	collectCodes(tree->one, depth < MAX_CODE_LENGTH ? code | (uint64_t(1) << depth) : code,
+	             depth + 1, table);
+}
+
+/* Function: buildEncodeTable
+ * Usage: buildEncodeTable(encodingTree, table);
+ * --------------------------------------------------------
+ * Records the code of every leaf of the encoding tree in
+ * table.  Characters absent from the tree get length zero.
+ */
+void buildEncodeTable(Node* encodingTree, EncodeTable& table) {
+	if (encodingTree == NULL) error("Cannot build a code table from an empty tree.");
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		table.codes[ch] = 0;
+		table.lengths[ch] = 0;
+	}
+	collectCodes(encodingTree, 0, 0, table);
+}
+
+/* Function: fillLevel
+ * --------------------------------------------------------
+ * Fills the table of 2^tableBits entries starting at base
+ * with the given characters' codes, all of which share their
+ * first shift bits.  Codes that fit replicate themselves over
+ * every slot whose low bits match; longer codes are grouped
+ * by their bits at this level and handed to a secondary table.
+ */
+static void fillLevel(DecodeTable& table, size_t base, int tableBits, int shift,
+                      const std::vector<ext_char>& members, const EncodeTable& codes) {
+	std::map<unsigned int, std::vector<ext_char> > longer;
+	const unsigned int mask = (1u << tableBits) - 1;
+
+	for (size_t i = 0; i < members.size(); i++) {
+		ext_char ch = members[i];
+		int remaining = codes.lengths[ch] - shift;
+		unsigned int index = (unsigned int)(codes.codes[ch] >> shift) & mask;
+
+		if (remaining <= tableBits) {
+			DecodeEntry leaf = { (unsigned int)ch, (unsigned short)remaining, 0 };
+			for (unsigned int slot = index; slot <= mask; slot += (1u << remaining)) {
+				table.entries[base + slot] = leaf;
+			}
+		} else {
+			longer[index].push_back(ch);
+		}
+	}
+
+	for (std::map<unsigned int, std::vector<ext_char> >::iterator itr = longer.begin();
+	     itr != longer.end(); ++itr) {
+		/* Size the secondary table for the longest code it has to hold. */
+		int widest = 0;
+		for (size_t i = 0; i < itr->second.size(); i++) {
+			widest = std::max(widest, codes.lengths[itr->second[i]] - shift - tableBits);
+		}
+		int subBits = std::min(widest, DECODE_TABLE_BITS);
+
+		size_t offset = table.entries.size();
+		table.entries.resize(offset + (size_t(1) << subBits));
+		DecodeEntry link = { (unsigned int)offset, (unsigned short)tableBits, (unsigned short)subBits };
+		table.entries[base + itr->first] = link;
+
+		fillLevel(table, offset, subBits, shift + tableBits, itr->second, codes);
+	}
+}
+
+/* Function: buildDecodeTable
+ * Usage: buildDecodeTable(encodeTable, table);
+ * --------------------------------------------------------
+ * Fills in table so that it decodes exactly the codes in the
+ * given encode table.  If no character has a code, the table
+ * describes the single-leaf tree holding only PSEUDO_EOF.
+ */
+void buildDecodeTable(const EncodeTable& codes, DecodeTable& table) {
+	int longest = 0;
+	std::vector<ext_char> members;
+	for (ext_char ch = 0; ch < NUM_SYMBOLS; ch++) {
+		if (codes.lengths[ch] == 0) continue;
+		longest = std::max(longest, int(codes.lengths[ch]));
+		members.push_back(ch);
+	}
+	if (members.empty()) members.push_back(PSEUDO_EOF);
+
+	/* Small trees don't need the full primary table. */
+	table.primaryBits = std::min(longest, DECODE_TABLE_BITS);
+	table.entries.clear();
+	table.entries.resize(size_t(1) << table.primaryBits);
+	fillLevel(table, 0, table.primaryBits, 0, members, codes);
+}
+
+/* Function: buildDecodeTable
+ * Usage: buildDecodeTable(encodingTree, table);
+ * --------------------------------------------------------
+ * Fills in table so that it decodes exactly the codes
+ * described by the given encoding tree.
+ */
+void buildDecodeTable(Node* encodingTree, DecodeTable& table) {
+	EncodeTable codes;
+	buildEncodeTable(encodingTree, codes);
+	buildDecodeTable(codes, table);
+}
+
+/* Function: reverseBits
+ * --------------------------------------------------------
+ * Returns the low length bits of code in reverse order.
+ * Canonical codes are defined most significant bit first,
+ * but the stream is written least significant bit first.
+ */
+static uint64_t reverseBits(uint64_t code, int length) {
+	uint64_t result = 0;
+	for (int i = 0; i < length; i++) {
+		result = (result << 1) | (code & 1);
+		code >>= 1;
+	}
+	return result;
+}
+
+/* Function: assignCanonicalCodes
+ * Usage: assignCanonicalCodes(table);
+ * --------------------------------------------------------
+ * Counts the codes of each length, checks that they exactly
+ * fill the code space, and then numbers them consecutively
+ * within each length.
+ */
+void assignCanonicalCodes(EncodeTable& table) {
+	int lengthCounts[MAX_CODE_LENGTH + 1] = {0};
+	int longest = 0;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		if (table.lengths[ch] > MAX_CODE_LENGTH) error("Code length is out of range.");
+		if (table.lengths[ch] != 0) lengthCounts[table.lengths[ch]]++;
+		longest = std::max(longest, int(table.lengths[ch]));
+	}
+
+	/* Walk down the tree level by level, tracking how many slots are
+	 * still open.  Once there are more open slots than characters
+	 * there is no need to keep doubling.
+	 */
+	if (longest > 0) {
+		long long openSlots = 1;
+		for (int length = 1; length <= longest; length++) {
+			openSlots = std::min(openSlots * 2, (long long)NUM_SYMBOLS + 1) - lengthCounts[length];
+			if (openSlots < 0) error("Code lengths describe an impossible prefix code.");
+		}
+		if (openSlots != 0) error("Code lengths describe an incomplete prefix code.");
+	}
+
+	uint64_t nextCode[MAX_CODE_LENGTH + 1] = {0};
+	uint64_t code = 0;
+	for (int length = 1; length <= longest; length++) {
+		code = (code + lengthCounts[length - 1]) << 1;
+		nextCode[length] = code;
+	}
+
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		int length = table.lengths[ch];
+		table.codes[ch] = (length == 0)? 0 : reverseBits(nextCode[length]++, length);
+	}
+}
+
+/* Constant: LENGTH_WIDTH_BITS, RUN_COUNT_BITS, MIN_RUN
+ * Field sizes of the code length table; see writeCodeLengths.
+ */
+static const int LENGTH_WIDTH_BITS = 3;
+static const int RUN_COUNT_BITS = 8;
+static const int MIN_RUN = 2;
+
+/* Function: writeCodeLengths
+ * Usage: writeCodeLengths(outfile, table);
+ * --------------------------------------------------------
+ * Emits each stretch of equal lengths either as a run or as
+ * individual literals, whichever takes fewer bits.
+ */
+void writeCodeLengths(obstream& outfile, const EncodeTable& table) {
+	int longest = 1;
+	for (int ch = 0; ch < NUM_SYMBOLS; ch++) {
+		longest = std::max(longest, int(table.lengths[ch]));
+	}
+	int width = 0;
+	while ((1 << width) <= longest) width++;
+	outfile.writeBits(width - 1, LENGTH_WIDTH_BITS);
+
+	const int maxRun = MIN_RUN + (1 << RUN_COUNT_BITS) - 1;
+	for (int ch = 0; ch < NUM_SYMBOLS; ) {
+		int run = 1;
+		while (ch + run < NUM_SYMBOLS && run < maxRun &&
+		       table.lengths[ch + run] == table.lengths[ch]) {
+			run++;
+		}
+
+		if (run * (1 + width) > 1 + width + RUN_COUNT_BITS) {
+			outfile.writeBits(1, 1);
+			outfile.writeBits(table.lengths[ch], width);
+			outfile.writeBits(run - MIN_RUN, RUN_COUNT_BITS);
+			ch += run;
+		} else {
+			outfile.writeBits(0, 1);
+			outfile.writeBits(table.lengths[ch], width);
+			ch++;
+		}
+	}
+}
+
+/* Function: readCodeLengths
+ * Usage: readCodeLengths(infile, table);
+ * --------------------------------------------------------
+ * Inverts writeCodeLengths, then assigns canonical codes,
+ * which also validates the lengths.
+ */
+void readCodeLengths(ibstream& infile, EncodeTable& table) {
+	int width = int(infile.readBits(LENGTH_WIDTH_BITS)) + 1;
+
+	for (int ch = 0; ch < NUM_SYMBOLS; ) {
+		bool isRun = infile.readBits(1) != 0;
+		int length = int(infile.readBits(width));
+		int run = isRun? int(infile.readBits(RUN_COUNT_BITS)) + MIN_RUN : 1;
+		if (infile.fail() || ch + run > NUM_SYMBOLS) error("Corrupt code length table.");
+
+		for (int i = 0; i < run; i++) table.lengths[ch++] = (unsigned char)length;
+	}
+	assignCanonicalCodes(table);
+}
@@ -0,0 +1,231 @@
+/**********************************************************
+ * File: HuffmanTables.h
+ *
+ * Flat lookup tables derived from a Huffman encoding tree.
+ * The tree is convenient to build and to reason about, but
+ * walking it one bit at a time is slow; the tables here
+ * let the decoder resolve many bits with a single lookup.
+ */
+
+#ifndef HuffmanTables_Included
+#define HuffmanTables_Included
+
+#include <vector>
+#include <stdint.h>
+#include "HuffmanTypes.h"
+#include "bstream.h"
+
+/* Constant: NUM_SYMBOLS
+ * The number of characters a table has to cover: every byte
+ * value plus PSEUDO_EOF.
+ */
+const int NUM_SYMBOLS = PSEUDO_EOF + 1;
+
+/* Constant: DECODE_TABLE_BITS
+ * The number of bits resolved by one lookup in the primary
+ * decode table.  Codes longer than this continue into a
+ * secondary table.  2^11 entries keeps the primary table
+ * comfortably inside the L1 cache.
+ */
+const int DECODE_TABLE_BITS = 11;
+
+/* Constant: MAX_CODE_LENGTH
+ * Longest code the tables can represent.  Codes are stored
+ * in 64-bit integers; trees built from int weights can never
+ * get this deep, since that would take a Fibonacci-sized
+ * number of characters.
+ */
+const int MAX_CODE_LENGTH = 64;
+
+/* Type: EncodeTable
+ * The code for every character, packed into integers so that
+ * the encoder can emit a whole code with one shift.  Codes are
+ * stored least significant bit first, so bit i of a code is the
+ * i-th bit written to the stream.  A length of zero means the
+ * character has no code, except in the degenerate tree holding
+ * only PSEUDO_EOF, whose code is empty.
+ */
+struct EncodeTable {
+	uint64_t codes[NUM_SYMBOLS];
+	unsigned char lengths[NUM_SYMBOLS];
+};
+
+/* Type: DecodeEntry
+ * One slot of a decode table.  A slot is either a leaf, which
+ * names a character and says how many bits its code used at
+ * this level, or a link to a secondary table that resolves
+ * the bits following this level.
+ */
+struct DecodeEntry {
+	/* For a leaf, the decoded character (possibly PSEUDO_EOF).
+	 * For a link, the index of the first entry of the secondary
+	 * table.
+	 */
+	unsigned int value;
+
+	/* The number of bits consumed at this level.  For a link
+	 * this is the full width of the table containing it.
+	 */
+	unsigned short length;
+
+	/* Zero for a leaf.  For a link, the number of bits used to
+	 * index the secondary table.
+	 */
+	unsigned short subBits;
+};
+
+/* Type: DecodeTable
+ * A multi-level decode table.  The primary table occupies the
+ * first 2^primaryBits entries and is indexed by the next bits
+ * of the stream, least significant bit first (the order in
+ * which obstream::writeBit lays bits out); secondary tables
+ * follow it in the same vector.
+ */
+struct DecodeTable {
+	int primaryBits;
+	std::vector<DecodeEntry> entries;
+};
+
+/* Function: decodeSymbol
+ * Usage: ext_char ch = decodeSymbol(infile, table);
+ * --------------------------------------------------------
+ * Decodes one character from infile: looks up as many bits
+ * as the primary table covers, following links into the
+ * secondary tables for codes that don't fit.  Defined here
+ * so that decoding loops can inline it.
+ */
+inline ext_char decodeSymbol(ibstream& infile, const DecodeTable& table) {
+	const DecodeEntry* entry = &table.entries[infile.peekBits(table.primaryBits)];
+	while (entry->subBits != 0) {
+		infile.skipBits(entry->length);
+		entry = &table.entries[entry->value + infile.peekBits(entry->subBits)];
+	}
+	infile.skipBits(entry->length);
+	return ext_char(entry->value);
+}
+
+/* Function: countFrequencies
+ * Usage: countFrequencies(data, length, counts);
+ * --------------------------------------------------------
+ * Adds the number of occurrences of each byte value in
+ * data[0 .. length) to counts, which is indexed by the byte
+ * as an unsigned value (0 to 255).  Counts accumulate, so a
+ * large input can be tallied block by block.
+ */
+void countFrequencies(const unsigned char* data, size_t length, uint64_t counts[256]);
+
+/* Type: TreeShape
+ * An encoding tree laid out flat in node slots.  Slots 0 to
+ * numLeaves - 1 are the leaves, ordered by weight and then by
+ * position in the list they were built from; slot
+ * numLeaves + i is the i-th internal node created, whose
+ * children are slots zero[i] and one[i].  The last slot
+ * filled is the root.
+ */
+struct TreeShape {
+	int numLeaves;
+	ext_char leaves[NUM_SYMBOLS];
+	int zero[NUM_SYMBOLS];
+	int one[NUM_SYMBOLS];
+};
+
+/* Function: buildTreeShape
+ * Usage: buildTreeShape(weights, symbols, count, shape);
+ * --------------------------------------------------------
+ * Runs Huffman's algorithm over the count characters listed
+ * in symbols (in increasing order, weights taken from
+ * weights) in linear time: the leaves are radix-sorted once,
+ * and since merged nodes come out in order of weight they
+ * only need a second queue, not a heap.  Ties go to leaves
+ * before merged nodes, then to the earlier node, which is
+ * exactly the order of a first-in first-out priority queue;
+ * buildEncodingTree has always built its trees that way, so
+ * existing files decode unchanged.
+ */
+void buildTreeShape(const uint64_t weights[NUM_SYMBOLS], const ext_char* symbols, int count, TreeShape& shape);
+
+/* Function: buildCodeLengths
+ * Usage: buildCodeLengths(weights, table);
+ * --------------------------------------------------------
+ * Sets the lengths in table to those of the Huffman tree for
+ * the characters of nonzero weight, without building any
+ * Nodes.  Use assignCanonicalCodes to turn them into codes.
+ */
+void buildCodeLengths(const uint64_t weights[NUM_SYMBOLS], EncodeTable& table);
+
+/* Function: buildLimitedCodeLengths
+ * Usage: buildLimitedCodeLengths(weights, 12, table);
+ * --------------------------------------------------------
+ * Computes optimal code lengths for the given character
+ * weights subject to no code being longer than maxLength,
+ * using the package-merge algorithm.  Characters of weight
+ * zero get no code.  Only the lengths in table are set; use
+ * assignCanonicalCodes to turn them into codes.
+ *
+ * Bounding the length bounds the size of the decode table,
+ * so a limit of DECODE_TABLE_BITS or less means every code
+ * is resolved by a single lookup.  Reports an error if
+ * maxLength is too short to give every character a code.
+ */
+void buildLimitedCodeLengths(const uint64_t weights[NUM_SYMBOLS], int maxLength, EncodeTable& table);
+
+/* Function: buildEncodeTable
+ * Usage: buildEncodeTable(encodingTree, table);
+ * --------------------------------------------------------
+ * Records the code of every leaf of the encoding tree in
+ * table.  Characters absent from the tree get length zero.
+ */
+void buildEncodeTable(Node* encodingTree, EncodeTable& table);
+
+/* Function: buildDecodeTable
+ * Usage: buildDecodeTable(encodingTree, table);
+ *        buildDecodeTable(encodeTable, table);
+ * --------------------------------------------------------
+ * Fills in table so that it decodes exactly the codes
+ * described by the given encoding tree or encode table.  A
+ * tree consisting of a single leaf yields a zero-length code,
+ * which matches what encodeFile writes for such a tree.
+ */
+void buildDecodeTable(Node* encodingTree, DecodeTable& table);
+void buildDecodeTable(const EncodeTable& codes, DecodeTable& table);
+
+/* Function: assignCanonicalCodes
+ * Usage: assignCanonicalCodes(table);
+ * --------------------------------------------------------
+ * Replaces the codes in table with the canonical Huffman
+ * codes for the lengths it holds: shorter codes come first,
+ * and codes of equal length are handed out in character
+ * order.  Since the codes follow from the lengths alone, the
+ * lengths are all a file header needs to store.
+ *
+ * Reports an error unless the lengths describe a complete
+ * prefix code (or no code at all, the PSEUDO_EOF-only case),
+ * so corrupt headers are caught before decoding starts.
+ */
+void assignCanonicalCodes(EncodeTable& table);
+
+/* Function: writeCodeLengths
+ * Usage: writeCodeLengths(outfile, table);
+ * --------------------------------------------------------
+ * Writes the code lengths in table through the bulk bit
+ * interface.  The format is a 3-bit field holding the width
+ * w (1 to 7) of one length, followed by items that together
+ * cover all NUM_SYMBOLS characters in order:
+ *
+ *   0 [w bits length]                 one character
+ *   1 [w bits length] [8 bits n - 2]  a run of n equal lengths
+ *
+ * A typical text table fits in well under a hundred bytes.
+ * The caller is responsible for flushing the bits.
+ */
+void writeCodeLengths(obstream& outfile, const EncodeTable& table);
+
+/* Function: readCodeLengths
+ * Usage: readCodeLengths(infile, table);
+ * --------------------------------------------------------
+ * Reads lengths written by writeCodeLengths into table and
+ * assigns their canonical codes.
+ */
+void readCodeLengths(ibstream& infile, EncodeTable& table);
+
+#endif
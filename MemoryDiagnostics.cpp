@@ -4,12 +4,18 @@
  * Implementation of memory diagnostic functions.
  */
 
+#include <atomic>
 #include "MemoryDiagnostics.h"
 #include "HuffmanTypes.h"
 
-/* Global variables (ewww!) tracking total allocations. */
-static long gTotalAllocs = 0;
-static long gTotalFrees = 0;
+/* Global variables (ewww!) tracking total allocations.  They are
+ * atomic because the block compressor builds trees on several
+ * threads at once.
+ */
+static std::atomic<long> gTotalAllocs(0);
+static std::atomic<long> gTotalFrees(0);
+static std::atomic<long> gArenaAllocs(0);
+static std::atomic<long> gArenaFrees(0);
 
 /* Operators new and delete
  * Usage: Implicit
@@ -48,3 +54,36 @@ long numDeallocations() {
 	return gTotalFrees;
 }
 
+/* Function: numArenaAllocations
+ * Usage: long x = numArenaAllocations();
+ * --------------------------------------------------------
+ * Returns how many allocations were served by a NodeArena.
+ */
+long numArenaAllocations() {
+	return gArenaAllocs;
+}
+
+/* Function: numArenaDeallocations
+ * Usage: long x = numArenaDeallocations();
+ * --------------------------------------------------------
+ * Returns how many deallocations came from releasing a
+ * NodeArena.
+ */
+long numArenaDeallocations() {
+	return gArenaFrees;
+}
+
+/* Functions: recordArenaAllocations, recordArenaDeallocations
+ * Usage: recordArenaAllocations(1);
+ * --------------------------------------------------------
+ * Arena nodes count toward both the arena totals and the
+ * overall totals.
+ */
+void recordArenaAllocations(long count) {
+	gArenaAllocs += count;
+	gTotalAllocs += count;
+}
+void recordArenaDeallocations(long count) {
+	gArenaFrees += count;
+	gTotalFrees += count;
+}
@@ -3,7 +3,8 @@
  *
  * Code to allow for memory diagnostics.  These functions
  * allow us to count how many Nodes you have allocated and
- * deallocated.
+ * deallocated.  Nodes taken from a NodeArena are counted
+ * too, so they can be checked for leaks like any other.
  */
 #ifndef MemoryDiagnostics_Included
 #define MemoryDiagnostics_Included
@@ -24,4 +25,29 @@ long numAllocations();
  */
 long numDeallocations();
 
+/* Function: numArenaAllocations
+ * Usage: long x = numArenaAllocations();
+ * --------------------------------------------------------
+ * Returns how many of the allocations counted by
+ * numAllocations were served by a NodeArena.
+ */
+long numArenaAllocations();
+
+/* Function: numArenaDeallocations
+ * Usage: long x = numArenaDeallocations();
+ * --------------------------------------------------------
+ * Returns how many of the deallocations counted by
+ * numDeallocations came from releasing a NodeArena.
+ */
+long numArenaDeallocations();
+
+/* Functions: recordArenaAllocations, recordArenaDeallocations
+ * Usage: recordArenaAllocations(1);
+ * --------------------------------------------------------
+ * Called by NodeArena to add nodes it hands out or releases
+ * to the counts above.
+ */
+void recordArenaAllocations(long count);
+void recordArenaDeallocations(long count);
+
 #endif
@@ -0,0 +1,72 @@
+/**********************************************************
+ * File: NodeArena.cpp
+ *
+ * Implementation of the NodeArena class.
+ */
+
+#include "NodeArena.h"
+#include "MemoryDiagnostics.h"
+#include "error.h"
+
+/* Constructor: NodeArena
+ * --------------------------------------------------------
+ * The nodes are plain data, so there is nothing to set up
+ * beyond the count.
+ */
+NodeArena::NodeArena() : used(0) {
+}
+
+/* Destructor: ~NodeArena
+ * --------------------------------------------------------
+ * Releasing here keeps the diagnostics balanced for callers
+ * that let the arena go out of scope.
+ */
+NodeArena::~NodeArena() {
+	release();
+}
+
+/* Member function: allocate
+ * --------------------------------------------------------
+ * Hands out the next unused node.
+ */
+Node* NodeArena::allocate() {
+	if (used == CAPACITY) error("Node arena is full.");
+	recordArenaAllocations(1);
+	return &nodes[used++];
+}
+
+/* Member function: release
+ * --------------------------------------------------------
+ * Forgets the nodes; none of them owns anything.
+ */
+void NodeArena::release() {
+	recordArenaDeallocations(used);
+	used = 0;
+}
+
+/* Member function: size
+ * --------------------------------------------------------
+ * The number of nodes handed out since the last release.
+ */
+int NodeArena::size() const {
+	return used;
+}
+
+/* Member function: indexOf
+ * --------------------------------------------------------
+ * A node belongs to the arena if it lies among the nodes
+ * handed out so far.
+ */
+int NodeArena::indexOf(const Node* node) const {
+	if (node < nodes || node >= nodes + used) return -1;
+	return int(node - nodes);
+}
+
+/* Member function: nodeAt
+ * --------------------------------------------------------
+ * Checks the index against the nodes handed out so far.
+ */
+Node* NodeArena::nodeAt(int index) {
+	if (index < 0 || index >= used) error("Node index is outside the arena.");
+	return &nodes[index];
+}
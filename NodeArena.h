@@ -0,0 +1,91 @@
+/**********************************************************
+ * File: NodeArena.h
+ *
+ * A fixed pool of Nodes for encoding trees that only live
+ * for a moment, such as the tree built for each block of a
+ * FORMAT_BLOCKS file.  Taking nodes from an arena costs no
+ * calls to the heap, and the whole tree is released at once
+ * rather than node by node with freeTree.
+ */
+
+#ifndef NodeArena_Included
+#define NodeArena_Included
+
+#include "HuffmanTypes.h"
+
+/* Class: NodeArena
+ * ---------------------------------------------------------
+ * Holds room for the largest possible encoding tree: one
+ * leaf per character plus PSEUDO_EOF and fewer internal
+ * nodes than leaves.  Nodes are handed out in order, so each
+ * has a stable index that can stand in for its address.
+ * Allocations and releases are reported to the counters in
+ * MemoryDiagnostics.h, so a tree whose arena is never
+ * released shows up as a leak.
+ */
+class NodeArena {
+public:
+	/* Constant: CAPACITY
+	 * The number of nodes an arena holds.
+	 */
+	static const int CAPACITY = 2 * (PSEUDO_EOF + 1);
+
+	/* Constructor: NodeArena
+	 * Usage: NodeArena arena;
+	 * -----------------------
+	 * Creates an empty arena.  The nodes live inside the arena
+	 * object itself, so an arena on the stack uses no heap.
+	 */
+	NodeArena();
+
+	/* Destructor: ~NodeArena
+	 * ----------------------
+	 * Releases any nodes still allocated.
+	 */
+	~NodeArena();
+
+	/* Member function: allocate
+	 * Usage: Node* node = arena.allocate();
+	 * -------------------------------------
+	 * Returns an uninitialized node, or reports an error if the
+	 * arena is full.  The node must not be passed to freeTree
+	 * or delete; it stays valid until the arena is released.
+	 */
+	Node* allocate();
+
+	/* Member function: release
+	 * Usage: arena.release();
+	 * -----------------------
+	 * Frees every node allocated so far in constant time and
+	 * makes the whole arena available again.
+	 */
+	void release();
+
+	/* Member function: size
+	 * Usage: int n = arena.size();
+	 * ----------------------------
+	 * Returns the number of nodes currently allocated.
+	 */
+	int size() const;
+
+	/* Member functions: indexOf, nodeAt
+	 * Usage: int i = arena.indexOf(node->zero);
+	 *        Node* child = arena.nodeAt(i);
+	 * -----------------------------------------
+	 * Convert between a node and its index in the arena, the
+	 * order in which it was allocated.  indexOf returns -1 for
+	 * NULL or for a node that did not come from this arena.
+	 */
+	int indexOf(const Node* node) const;
+	Node* nodeAt(int index);
+
+private:
+	Node nodes[CAPACITY];
+	int used;
+
+	/* Copying would leave the copy's tree pointing into the original. */
+	NodeArena(const NodeArena&);
+	NodeArena& operator=(const NodeArena&);
+};
+
+#endif
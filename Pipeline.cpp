@@ -0,0 +1,118 @@
+/**********************************************************
+ * File: Pipeline.cpp
+ *
+ * Implementation of SlotQueue and runPipeline.
+ */
+
+#include <exception>
+#include <thread>
+#include "Pipeline.h"
+
+/* Constant: END_OF_SLOTS
+ * Pushed after the last slot, to tell the next stage that
+ * nothing more is coming.
+ */
+static const int END_OF_SLOTS = -1;
+
+SlotQueue::SlotQueue() : aborted(false) {
+}
+
+void SlotQueue::push(int slot) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		slots.push_back(slot);
+	}
+	ready.notify_one();
+}
+
+bool SlotQueue::pop(int& slot) {
+	std::unique_lock<std::mutex> guard(lock);
+	ready.wait(guard, [this] { return aborted || !slots.empty(); });
+	if (aborted) return false;
+	slot = slots.front();
+	slots.pop_front();
+	return true;
+}
+
+void SlotQueue::abort() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		aborted = true;
+	}
+	ready.notify_all();
+}
+
+/* Function: runPipeline
+ * Usage: runPipeline(depth, read, process, write);
+ * --------------------------------------------------------
+ * Slots go round from empty to filled to processed and back
+ * to empty.  A stage that throws records the exception and
+ * aborts all three queues, so the other stages stop at their
+ * next pop instead of waiting for slots that never come.
+ */
+void runPipeline(int depth, const std::function<bool(int)>& read,
+                 const std::function<void(int)>& process, const std::function<void(int)>& write) {
+	if (depth <= 1) {
+		bool more = true;
+		while (more) {
+			more = read(0);
+			process(0);
+			write(0);
+		}
+		return;
+	}
+
+	SlotQueue empty, filled, processed;
+	for (int slot = 0; slot < depth; slot++) empty.push(slot);
+
+	std::mutex failureLock;
+	std::exception_ptr failure;
+	auto fail = [&] {
+		{
+			std::lock_guard<std::mutex> guard(failureLock);
+			if (!failure) failure = std::current_exception();
+		}
+		empty.abort();
+		filled.abort();
+		processed.abort();
+	};
+
+	std::thread reader([&] {
+		try {
+			bool more = true;
+			int slot;
+			while (more && empty.pop(slot)) {
+				more = read(slot);
+				filled.push(slot);
+			}
+			filled.push(END_OF_SLOTS);
+		} catch (...) {
+			fail();
+		}
+	});
+	std::thread writer([&] {
+		try {
+			int slot;
+			while (processed.pop(slot) && slot != END_OF_SLOTS) {
+				write(slot);
+				empty.push(slot);
+			}
+		} catch (...) {
+			fail();
+		}
+	});
+
+	try {
+		int slot;
+		while (filled.pop(slot) && slot != END_OF_SLOTS) {
+			process(slot);
+			processed.push(slot);
+		}
+		processed.push(END_OF_SLOTS);
+	} catch (...) {
+		fail();
+	}
+	reader.join();
+	writer.join();
+	if (failure) std::rethrow_exception(failure);
+}
@@ -0,0 +1,81 @@
+/**********************************************************
+ * File: Pipeline.h
+ *
+ * Overlaps the reading, processing and writing of a stream
+ * of batches.  The block-parallel compressor and decompressor
+ * use it so that the next batch is read, and the last one
+ * written, while the thread pool works on the current one.
+ */
+
+#ifndef Pipeline_Included
+#define Pipeline_Included
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+/* Class: SlotQueue
+ * ---------------------------------------------------------
+ * A queue of slot numbers passed from one pipeline stage to
+ * the next.  Once aborted, every pop fails, so a stage that
+ * fails can stop the others wherever they are waiting.
+ */
+class SlotQueue {
+public:
+	SlotQueue();
+
+	/* Member function: push
+	 * Usage: queue.push(slot);
+	 * ------------------------
+	 * Adds a slot to the back of the queue.
+	 */
+	void push(int slot);
+
+	/* Member function: pop
+	 * Usage: if (queue.pop(slot)) { ... }
+	 * -----------------------------------
+	 * Waits for a slot and removes it from the front of the
+	 * queue, returning false instead if the queue is aborted.
+	 */
+	bool pop(int& slot);
+
+	/* Member function: abort
+	 * Usage: queue.abort();
+	 * ---------------------
+	 * Makes every waiting and future pop fail.
+	 */
+	void abort();
+
+private:
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<int> slots;
+	bool aborted;
+
+	/* Copying a queue makes no sense. */
+	SlotQueue(const SlotQueue&);
+	SlotQueue& operator=(const SlotQueue&);
+};
+
+/* Function: runPipeline
+ * Usage: runPipeline(depth, read, process, write);
+ * --------------------------------------------------------
+ * Passes depth slots, numbered 0 to depth - 1 and standing
+ * for buffers the caller owns, through three stages in turn:
+ * read fills a slot and returns whether more input follows,
+ * process works on it, and write empties it, after which it
+ * is read into again.  Each stage sees the slots in the order
+ * they were read.
+ *
+ * With a depth of 1 the stages simply take turns on the
+ * calling thread.  With more, read and write run on threads
+ * of their own, as far ahead and behind process as the slots
+ * allow, while process stays on the calling thread.  If a
+ * stage throws, the others are stopped and the first
+ * exception is rethrown here.
+ */
+void runPipeline(int depth, const std::function<bool(int)>& read,
+                 const std::function<void(int)>& process, const std::function<void(int)>& write);
+
+#endif
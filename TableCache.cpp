@@ -0,0 +1,133 @@
+/**********************************************************
+ * File: TableCache.cpp
+ *
+ * Implementation of the TableCache class.
+ */
+
+#include "TableCache.h"
+#include "HuffmanEncoding.h"
+
+/* Constructor: TableCache
+ * --------------------------------------------------------
+ * A capacity below one would discard every table as soon as
+ * it was built, so it is raised to one.
+ */
+TableCache::TableCache(int capacity) : limit(capacity < 1 ? 1 : capacity), numHits(0), numMisses(0) {
+}
+
+/* Member function: lookup
+ * Usage: std::shared_ptr<const CachedTables> tables = cache.lookup(lengths);
+ * --------------------------------------------------------
+ * The key is the lengths, one byte per character.  Tagging it
+ * keeps it apart from frequency keys.
+ */
+std::shared_ptr<const CachedTables> TableCache::lookup(const EncodeTable& lengths) {
+	std::string key(1, 'C');
+	key.append((const char*)lengths.lengths, NUM_SYMBOLS);
+
+	std::shared_ptr<const CachedTables> tables = find(key);
+	if (tables) return tables;
+
+	std::shared_ptr<CachedTables> built = std::make_shared<CachedTables>();
+	built->encodeTable = lengths;
+	assignCanonicalCodes(built->encodeTable);
+	buildDecodeTable(built->encodeTable, built->decodeTable);
+	return insert(key, built);
+}
+
+/* Member function: lookup
+ * Usage: std::shared_ptr<const CachedTables> tables = cache.lookup(frequencies);
+ * --------------------------------------------------------
+ * The key lists every character with its count, in the Map's
+ * order.  The tree is only needed long enough to read its
+ * codes off, so it comes from an arena.
+ */
+std::shared_ptr<const CachedTables> TableCache::lookup(Map<ext_char, int>& frequencies) {
+	std::string key(1, 'F');
+	foreach (ext_char ch in frequencies) {
+		uint32_t count = uint32_t(frequencies.get(ch));
+		char item[6] = {char(ch), char(ch >> 8), char(count), char(count >> 8), char(count >> 16), char(count >> 24)};
+		key.append(item, sizeof item);
+	}
+
+	std::shared_ptr<const CachedTables> tables = find(key);
+	if (tables) return tables;
+
+	std::shared_ptr<CachedTables> built = std::make_shared<CachedTables>();
+	NodeArena arena;
+	Node* root = buildEncodingTree(frequencies, arena);
+	buildEncodeTable(root, built->encodeTable);
+	buildDecodeTable(built->encodeTable, built->decodeTable);
+	return insert(key, built);
+}
+
+/* Member function: find
+ * --------------------------------------------------------
+ * Moves a hit to the front of the list and counts the
+ * lookup either way.
+ */
+std::shared_ptr<const CachedTables> TableCache::find(const std::string& key) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<std::string, std::list<Entry>::iterator>::iterator position = positions.find(key);
+	if (position == positions.end()) {
+		numMisses++;
+		return std::shared_ptr<const CachedTables>();
+	}
+	numHits++;
+	entries.splice(entries.begin(), entries, position->second);
+	return position->second->second;
+}
+
+/* Member function: insert
+ * --------------------------------------------------------
+ * Tables are built outside the lock, so another thread may
+ * have cached the same key in the meantime; its tables win,
+ * and the new ones are dropped.  Otherwise the new tables go
+ * to the front, and the oldest are discarded to make room.
+ */
+std::shared_ptr<const CachedTables> TableCache::insert(const std::string& key,
+                                                         const std::shared_ptr<const CachedTables>& tables) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<std::string, std::list<Entry>::iterator>::iterator position = positions.find(key);
+	if (position != positions.end()) return position->second->second;
+
+	entries.push_front(Entry(key, tables));
+	positions[key] = entries.begin();
+	while (int(entries.size()) > limit) {
+		positions.erase(entries.back().first);
+		entries.pop_back();
+	}
+	return tables;
+}
+
+/* Member functions: size, capacity, hits, misses
+ * --------------------------------------------------------
+ * Read under the lock, since other threads may be updating
+ * them.
+ */
+int TableCache::size() {
+	std::lock_guard<std::mutex> guard(lock);
+	return int(entries.size());
+}
+int TableCache::capacity() const {
+	return limit;
+}
+long TableCache::hits() {
+	std::lock_guard<std::mutex> guard(lock);
+	return numHits;
+}
+long TableCache::misses() {
+	std::lock_guard<std::mutex> guard(lock);
+	return numMisses;
+}
+
+/* Member function: clear
+ * --------------------------------------------------------
+ * Tables still held by callers live on until released.
+ */
+void TableCache::clear() {
+	std::lock_guard<std::mutex> guard(lock);
+	entries.clear();
+	positions.clear();
+	numHits = numMisses = 0;
+}
@@ -0,0 +1,109 @@
+/**********************************************************
+ * File: TableCache.h
+ *
+ * A bounded cache of built code tables.  Files and blocks
+ * that share a code table normally rebuild it every time
+ * they are decoded; with a cache the tables are built the
+ * first time a header is seen and reused after that.
+ */
+
+#ifndef TableCache_Included
+#define TableCache_Included
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "HuffmanTables.h"
+#include "map.h"
+
+/* Type: CachedTables
+ * The encode and decode tables for one header.
+ */
+struct CachedTables {
+	EncodeTable encodeTable;
+	DecodeTable decodeTable;
+};
+
+/* Class: TableCache
+ * ---------------------------------------------------------
+ * Maps headers to their built tables, discarding the least
+ * recently used tables once it holds capacity of them.  The
+ * key is the header itself (the code lengths, or the
+ * character counts of a frequency header), so tables are
+ * only shared between headers that are exactly equal.  Any
+ * number of threads may share one cache.
+ */
+class TableCache {
+public:
+	/* Constant: DEFAULT_CAPACITY
+	 * How many tables a cache holds unless told otherwise.
+	 */
+	static const int DEFAULT_CAPACITY = 64;
+
+	/* Constructor: TableCache
+	 * Usage: TableCache cache;
+	 *        TableCache cache(capacity);
+	 * -------------------------------------
+	 * Creates an empty cache holding up to capacity tables.
+	 */
+	explicit TableCache(int capacity = DEFAULT_CAPACITY);
+
+	/* Member function: lookup
+	 * Usage: std::shared_ptr<const CachedTables> tables = cache.lookup(lengths);
+	 *        std::shared_ptr<const CachedTables> tables = cache.lookup(frequencies);
+	 * -----------------------------
+	 * Returns the tables for the canonical code with the lengths
+	 * in the given table, or for the tree buildEncodingTree
+	 * builds from the given frequencies, building them if they
+	 * aren't cached.  The tables stay valid for as long as the
+	 * pointer is held, even if the cache discards them.
+	 */
+	std::shared_ptr<const CachedTables> lookup(const EncodeTable& lengths);
+	std::shared_ptr<const CachedTables> lookup(Map<ext_char, int>& frequencies);
+
+	/* Member functions: size, capacity
+	 * Usage: int n = cache.size();
+	 * ---------------------------
+	 * Return how many tables are held and how many may be.
+	 */
+	int size();
+	int capacity() const;
+
+	/* Member functions: hits, misses
+	 * Usage: long n = cache.hits();
+	 * ---------------------------
+	 * Return how many lookups found their tables and how many
+	 * had to build them.
+	 */
+	long hits();
+	long misses();
+
+	/* Member function: clear
+	 * Usage: cache.clear();
+	 * ---------------------------
+	 * Discards every table and resets the counts.
+	 */
+	void clear();
+
+private:
+	typedef std::pair<std::string, std::shared_ptr<const CachedTables> > Entry;
+
+	std::shared_ptr<const CachedTables> find(const std::string& key);
+	std::shared_ptr<const CachedTables> insert(const std::string& key, const std::shared_ptr<const CachedTables>& tables);
+
+	int limit;
+	std::mutex lock;
+
+	/* Entries from most to least recently used. */
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> positions;
+	long numHits, numMisses;
+
+	/* Copying a cache makes no sense. */
+	TableCache(const TableCache&);
+	TableCache& operator=(const TableCache&);
+};
+
+#endif
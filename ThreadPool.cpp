@@ -0,0 +1,124 @@
+/**********************************************************
+ * File: ThreadPool.cpp
+ *
+ * Implementation of the ThreadPool class.
+ */
+
+#include <algorithm>
+#include "ThreadPool.h"
+
+/* Constructor: ThreadPool
+ * --------------------------------------------------------
+ * Starts one worker fewer than requested, since the thread
+ * calling run does its share of the work.
+ */
+ThreadPool::ThreadPool(int numThreads)
+	: task(NULL), taskCount(0), nextTask(0), unfinished(0), generation(0), stopping(false) {
+	if (numThreads <= 0) numThreads = std::max(1, int(std::thread::hardware_concurrency()));
+	for (int i = 1; i < numThreads; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+/* Destructor: ~ThreadPool
+ * --------------------------------------------------------
+ * Tells every worker to stop and waits for them to exit.
+ */
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+/* Member function: size
+ * --------------------------------------------------------
+ * Workers plus the calling thread.
+ */
+int ThreadPool::size() const {
+	return int(workers.size()) + 1;
+}
+
+/* Member function: run
+ * --------------------------------------------------------
+ * Publishes the batch, helps drain it, then waits for the
+ * tasks other threads picked up.
+ */
+void ThreadPool::run(int count, const std::function<void(int)>& job) {
+	if (count <= 0) return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		task = &job;
+		taskCount = count;
+		nextTask = 0;
+		unfinished = count;
+		failure = std::exception_ptr();
+		generation++;
+	}
+	wake.notify_all();
+
+	drainTasks();
+
+	std::exception_ptr error;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (unfinished != 0) done.wait(guard);
+		task = NULL;
+		error = failure;
+		failure = std::exception_ptr();
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+/* Member function: drainTasks
+ * --------------------------------------------------------
+ * Claims and runs tasks from the current batch until none
+ * are left unclaimed.  The batch cannot end while a task is
+ * still running, so the task pointer stays valid.
+ */
+void ThreadPool::drainTasks() {
+	while (true) {
+		const std::function<void(int)>* current;
+		int index;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (task == NULL || nextTask >= taskCount) return;
+			current = task;
+			index = nextTask++;
+		}
+
+		try {
+			(*current)(index);
+		} catch (...) {
+			std::lock_guard<std::mutex> guard(lock);
+			if (!failure) failure = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (--unfinished == 0) done.notify_all();
+	}
+}
+
+/* Member function: workerLoop
+ * --------------------------------------------------------
+ * Sleeps until a new batch with unclaimed tasks appears,
+ * works on it, and repeats until the pool shuts down.
+ */
+void ThreadPool::workerLoop() {
+	long seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (!stopping && (generation == seen || task == NULL || nextTask >= taskCount)) {
+				wake.wait(guard);
+			}
+			if (stopping) return;
+			seen = generation;
+		}
+		drainTasks();
+	}
+}
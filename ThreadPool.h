@@ -0,0 +1,78 @@
+/**********************************************************
+ * File: ThreadPool.h
+ *
+ * A small fixed-size pool of worker threads used by the
+ * block-parallel compressor and decompressor.
+ */
+
+#ifndef ThreadPool_Included
+#define ThreadPool_Included
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Class: ThreadPool
+ * ---------------------------------------------------------
+ * Runs batches of independent tasks on a set of threads that
+ * live as long as the pool does, so a long job pays for
+ * thread creation once rather than once per batch.
+ */
+class ThreadPool {
+public:
+	/* Constructor: ThreadPool
+	 * Usage: ThreadPool pool(numThreads);
+	 * -------------------------------------
+	 * Creates a pool that runs tasks on numThreads threads in
+	 * total, counting the thread that calls run.  A value of 0
+	 * means one thread per hardware core.
+	 */
+	explicit ThreadPool(int numThreads);
+
+	/* Destructor: ~ThreadPool
+	 * -----------------------
+	 * Stops and joins the worker threads.
+	 */
+	~ThreadPool();
+
+	/* Member function: size
+	 * Usage: int n = pool.size();
+	 * ---------------------------
+	 * Returns the number of threads tasks run on.
+	 */
+	int size() const;
+
+	/* Member function: run
+	 * Usage: pool.run(count, task);
+	 * -----------------------------
+	 * Calls task(0) through task(count - 1), spread across the
+	 * pool, and returns once all have finished.  The calling
+	 * thread takes part.  If any task throws, the first
+	 * exception is rethrown here after the others finish.
+	 */
+	void run(int count, const std::function<void(int)>& task);
+
+private:
+	void workerLoop();
+	void drainTasks();
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake, done;
+
+	/* The batch currently being run. */
+	const std::function<void(int)>* task;
+	int taskCount, nextTask, unfinished;
+	long generation;
+	bool stopping;
+	std::exception_ptr failure;
+
+	/* Copying a pool makes no sense. */
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+};
+
+#endif
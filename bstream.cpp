@@ -11,6 +11,15 @@
 #include "error.h"
 #include "strlib.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 static const int NUM_BITS_IN_BYTE = 8;
 
@@ -28,7 +37,9 @@ inline void SetNthBit(int n, int & inByte) { inByte |= (1 << n); }
  * We set initial state for lastTell and curByte to 0, then pos is
  * set at 8 so that next readBit will trigger a fresh read.
  */
-ibstream::ibstream() : istream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE) {}
+ibstream::ibstream() : istream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE) {
+	resetBits();
+}
 
 /* Member function ibstream::readBit
  * ---------------------------------
@@ -52,17 +63,124 @@ int ibstream::readBit() {
 	return result;
 }
 
+/* Member function ibstream::readBits
+ * ----------------------------------
+ * Peeks and skips in pieces of at most 32 bits, so that the
+ * read-ahead buffer never has to hold more than it can.
+ */
+uint64_t ibstream::readBits(int count) {
+	if (count > 32) {
+		uint64_t low = readBits(32);
+		return low | (readBits(count - 32) << 32);
+	}
+	uint64_t result = peekBits(count);
+	skipBits(count);
+	return result;
+}
+
+/* Member function ibstream::refillBits
+ * ------------------------------------
+ * Tops bitBuffer up to at least 57 bits, pulling a fresh block
+ * from the streambuf whenever byteBuffer runs out.	 Once the
+ * data is gone, zero bytes are appended and counted in padBits
+ * so that skipBits can tell when real data has been exhausted.
+ */
+void ibstream::refillBits() {
+	if (!is_open()) error("Cannot read bits from a stream that is not open.");
+	
+	while (bitCount <= 56) {
+		if (bytePos == byteCount) {
+			bytePos = 0;
+			byteCount = (rdbuf() == NULL)? 0 : int(rdbuf()->sgetn(byteBuffer, BIT_BUFFER_SIZE));
+			if (byteCount == 0) {
+				bitCount += NUM_BITS_IN_BYTE;
+				padBits += NUM_BITS_IN_BYTE;
+				continue;
+			}
+		}
+		bitBuffer |= uint64_t((unsigned char)byteBuffer[bytePos++]) << bitCount;
+		bitCount += NUM_BITS_IN_BYTE;
+	}
+}
+
+/* Member function ibstream::readBytes
+ * -----------------------------------
+ * Takes bytes from bitBuffer first, then from byteBuffer, and
+ * reads whatever is still missing straight from the streambuf.
+ */
+size_t ibstream::readBytes(char* buffer, size_t length) {
+	if (bitCount % NUM_BITS_IN_BYTE != 0) error("readBytes requires the stream to be at a byte boundary.");
+	
+	size_t done = 0;
+	while (done < length && bitCount > padBits) {
+		buffer[done++] = char(bitBuffer);
+		bitBuffer >>= NUM_BITS_IN_BYTE;
+		bitCount -= NUM_BITS_IN_BYTE;
+	}
+	if (padBits == 0 && done < length) {
+		size_t available = min(length - done, size_t(byteCount - bytePos));
+		copy(byteBuffer + bytePos, byteBuffer + bytePos + available, buffer + done);
+		bytePos += int(available);
+		done += available;
+		
+		if (done < length && rdbuf() != NULL) {
+			done += size_t(rdbuf()->sgetn(buffer + done, streamsize(length - done)));
+		}
+	}
+	if (done < length) setstate(ios::eofbit | ios::failbit);
+	return done;
+}
+
+/* Member function ibstream::alignBits
+ * -----------------------------------
+ * Works out how many whole bytes were read ahead but not consumed
+ * and seeks the streambuf back over them.	The bits left in a
+ * partially consumed byte are dropped.
+ */
+void ibstream::alignBits() {
+	int unread = max(bitCount - padBits, 0) / NUM_BITS_IN_BYTE + (byteCount - bytePos);
+	resetBits();
+	if (unread > 0 && rdbuf() != NULL &&
+	    rdbuf()->pubseekoff(-unread, ios::cur, ios::in) == streampos(-1)) {
+		setstate(ios::failbit);
+	}
+}
+
+/* Member function ibstream::resetBits
+ * -----------------------------------
+ * Forgets all read-ahead state used by the bulk bit functions.
+ */
+void ibstream::resetBits() {
+	bytePos = byteCount = 0;
+	bitBuffer = 0;
+	bitCount = padBits = 0;
+}
+
 /* Member function ibstream::rewind
  * ---------------------------------
  * Simply seeks back to beginning of file, so reading begins again
- * from start.
+ * from start.	Any bits read ahead are discarded.
  */
 void ibstream::rewind() {
 	if (!is_open()) error("Cannot rewind stream which is not open.");
+	resetBits();
 	clear();
 	seekg(0, ios::beg);
 }
 
+/* Member function ibstream::tellBits
+ * -----------------------------------
+ * The streambuf is ahead of the reader by the bytes waiting in
+ * byteBuffer and the real bits still in bitBuffer.
+ */
+long long ibstream::tellBits() {
+	if (rdbuf() == NULL) return -1;
+	streampos at = rdbuf()->pubseekoff(0, ios::cur, ios::in);
+	if (at == streampos(-1)) return -1;
+	long long ahead = (long long)(byteCount - bytePos) * NUM_BITS_IN_BYTE + max(bitCount - padBits, 0);
+	return (long long)at * NUM_BITS_IN_BYTE - ahead;
+}
+
 /* Member function ibstream::size
  * ------------------------------
  * Seek to file end and use tell to retrieve position.
@@ -98,7 +216,8 @@ bool ibstream::is_open() {
  * We set initial state for lastTell and curByte to 0, then pos is
  * set at 8 so that next writeBit will start a new byte.
  */
-obstream::obstream() : ostream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE) {}
+obstream::obstream() : ostream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE),
+	byteCount(0), bitBuffer(0), bitCount(0) {}
 
 /* Member function obstream::writeBit
  * ----------------------------------
@@ -133,20 +252,93 @@ void obstream::writeBit(int bit) {
 }
 
 
+/* Member function obstream::writeBytes
+ * ------------------------------------
+ * Moves the whole bytes in bitBuffer to byteBuffer, then copies
+ * small writes into byteBuffer and sends large ones directly.
+ */
+void obstream::writeBytes(const char* buffer, size_t length) {
+	if (bitCount % NUM_BITS_IN_BYTE != 0) error("writeBytes requires the stream to be at a byte boundary.");
+	
+	for (; bitCount > 0; bitCount -= NUM_BITS_IN_BYTE) {
+		if (byteCount == BIT_BUFFER_SIZE) drainBytes();
+		byteBuffer[byteCount++] = char(bitBuffer);
+		bitBuffer >>= NUM_BITS_IN_BYTE;
+	}
+	bitBuffer = 0;
+	
+	if (length > size_t(BIT_BUFFER_SIZE - byteCount)) {
+		drainBytes();
+		if (length >= size_t(BIT_BUFFER_SIZE)) {
+			if (rdbuf() == NULL || rdbuf()->sputn(buffer, streamsize(length)) != streamsize(length))
+				setstate(ios::badbit);
+			return;
+		}
+	}
+	copy(buffer, buffer + length, byteBuffer + byteCount);
+	byteCount += int(length);
+}
+
+/* Member function obstream::flushBits
+ * -----------------------------------
+ * Moves every bit left in bitBuffer into byteBuffer, rounding up
+ * to a whole byte, then hands byteBuffer to the streambuf.
+ */
+void obstream::flushBits() {
+	if (bitCount == 0 && byteCount == 0) return;
+	if (!is_open()) error("Cannot flush bits to stream which is not open.");
+	
+	for (; bitCount > 0; bitCount -= NUM_BITS_IN_BYTE) {
+		if (byteCount == BIT_BUFFER_SIZE) drainBytes();
+		byteBuffer[byteCount++] = char(bitBuffer);
+		bitBuffer >>= NUM_BITS_IN_BYTE;
+	}
+	bitBuffer = 0;
+	bitCount = 0;
+	drainBytes();
+}
+
+/* Member function obstream::drainBytes
+ * ------------------------------------
+ * Writes the completed bytes in byteBuffer to the streambuf in a
+ * single call, marking the stream bad if they don't all fit.
+ */
+void obstream::drainBytes() {
+	if (byteCount == 0) return;
+	if (rdbuf() == NULL || rdbuf()->sputn(byteBuffer, byteCount) != byteCount)
+		setstate(ios::badbit);
+	byteCount = 0;
+}
+
+/* Member function obstream::tellBits
+ * -----------------------------------
+ * The streambuf is behind the writer by the bytes waiting in
+ * byteBuffer and the bits in bitBuffer.
+ */
+long long obstream::tellBits() {
+	if (rdbuf() == NULL) return -1;
+	streampos at = rdbuf()->pubseekoff(0, ios::cur, ios::out);
+	if (at == streampos(-1)) return -1;
+	return ((long long)at + byteCount) * NUM_BITS_IN_BYTE + bitCount;
+}
+
 /* Member function obstream::size
  * ------------------------------
  * Seek to file end and use tell to retrieve position.
  * In order to not disrupt writing, we also record cur streampos and
- * re-seek to there before returning.
+ * re-seek to there before returning.  Bytes still held by writeBits
+ * are written out first; the bits of an unfinished byte, which must
+ * stay buffered, are counted on top.
  */
 long obstream::size() {
 	if (!is_open()) error("Cannot get size of stream which is not open.");
+	drainBytes();
 	clear();					// clear any error state
 	streampos cur = tellp();	// save current streampos
 	seekp(0, ios::end);			// seek to end
 	streampos end = tellp();	// get offset
 	seekp(cur);					// seek back to original pos
-	return long(end);
+	return long(end) + (bitCount + NUM_BITS_IN_BYTE - 1) / NUM_BITS_IN_BYTE;
 }
 
 /* Member function obstream::is_open
@@ -211,6 +403,23 @@ void ifbstream::close() {
 		setstate(ios::failbit);
 }
 
+/* Function: isSourceFile
+ * -------------------------------------------
+ * Refuses, with a warning, file names that look like source
+ * code, which the writing streams will not overwrite.
+ */
+static bool isSourceFile(const char* filename) {
+	if (endsWith(filename, ".cpp") || endsWith(filename, ".h") ||
+			endsWith(filename, ".hh") || endsWith(filename, ".cc")) {
+		cerr << "It is potentially extremely dangerous to write to file "
+				 << filename << ", because that might be your own source code.	"
+				 << "We're explicitly disallowing this operation.	 Please choose a "
+				 << "different filename." << endl;
+		return true;
+	}
+	return false;
+}
+
 /* Constructor ofbstream::ofbstream
  * -------------------------------------------
  * Wires up the stream class so that it knows to write data
@@ -234,6 +443,14 @@ ofbstream::ofbstream(string filename) {
 	open(filename);
 }
 
+/* Destructor ofbstream::~ofbstream
+ * -------------------------------------------
+ * Flushes pending bits while the file buffer still exists.
+ */
+ofbstream::~ofbstream() {
+	if (is_open()) flushBits();
+}
+
 /* Member function ofbstream::open
  * -------------------------------------------
  * Attempts to open the specified file, failing if unable
@@ -243,14 +460,8 @@ void ofbstream::open(const char* filename) {
 	/* Confirm we aren't about to do something that could potentially be a
 	 * Very Bad Idea.
 	 */
-	if (endsWith(filename, ".cpp") || endsWith(filename, ".h") ||
-			endsWith(filename, ".hh") || endsWith(filename, ".cc")) {
-		cerr << "It is potentially extremely dangerous to write to file "
-				 << filename << ", because that might be your own source code.	"
-				 << "We're explicitly disallowing this operation.	 Please choose a "
-				 << "different filename." << endl;
+	if (isSourceFile(filename)) {
 		setstate(ios::failbit);
-		
 	} else {
 		if (!fb.open(filename, ios::out | ios::binary))
 			setstate(ios::failbit);
@@ -270,9 +481,10 @@ bool ofbstream::is_open() {
 
 /* Member function ofbstream::close
  * -------------------------------------------
- * Closes the given file.
+ * Closes the given file, flushing any pending bits first.
  */
 void ofbstream::close() {
+	if (is_open()) flushBits();
 	if (!fb.close())
 		setstate(ios::failbit);
 }
@@ -306,8 +518,588 @@ ostringbstream::ostringbstream() {
 
 /* Member function ostringbstream::str
  * -------------------------------------------
- * Retrives the underlying string data.
+ * Retrives the underlying string data, including any pending
+ * bits.
  */
 string ostringbstream::str() {
+	flushBits();
 	return sb.str();
 }
+
+/* Constructor istreambstream::istreambstream
+ * -------------------------------------------
+ * Shares the buffer of the source stream.
+ */
+istreambstream::istreambstream(istream& source) {
+	init(source.rdbuf());
+}
+
+/* Constructor ostreambstream::ostreambstream
+ * -------------------------------------------
+ * Shares the buffer of the sink stream.
+ */
+ostreambstream::ostreambstream(ostream& sink) {
+	init(sink.rdbuf());
+}
+
+/* Destructor ostreambstream::~ostreambstream
+ * -------------------------------------------
+ * Flushes pending bits while the shared buffer still exists.
+ */
+ostreambstream::~ostreambstream() {
+	flushBits();
+}
+
+/* Class: imembuf
+ * -------------------------------------------
+ * A read-only stream buffer whose get area is a span of
+ * memory, so reads are memory copies and seeks just move
+ * the get pointer.
+ */
+class imembuf: public streambuf {
+public:
+	imembuf() : base(NULL), size(0), opened(false) {}
+	virtual ~imembuf() {}
+	
+	void setSpan(const char* data, size_t length);
+	
+	const char* base;
+	size_t size;
+	bool opened;
+	
+protected:
+	streamsize xsgetn(char* buffer, streamsize count);
+	pos_type seekoff(off_type offset, ios::seekdir dir, ios::openmode which);
+	pos_type seekpos(pos_type pos, ios::openmode which);
+};
+
+/* Member function imembuf::setSpan
+ * -------------------------------------------
+ * Points the get area at the span.  The bytes are never
+ * written through it.
+ */
+void imembuf::setSpan(const char* data, size_t length) {
+	base = data;
+	size = length;
+	opened = true;
+	char* start = const_cast<char*>(data);
+	setg(start, start, start + length);
+}
+
+/* Class: imapbuf
+ * -------------------------------------------
+ * An imembuf over a mapped file.
+ */
+class imapbuf: public imembuf {
+public:
+	~imapbuf() { unmap(); }
+	
+	bool map(const char* filename);
+	void unmap();
+	
+private:
+#if defined(_WIN32)
+	vector<char> contents;
+#endif
+};
+
+/* Member function imapbuf::map
+ * -------------------------------------------
+ * Maps the file, or reads it into memory where mapping is
+ * unavailable.  An empty file is open but has no mapping.
+ */
+bool imapbuf::map(const char* filename) {
+	unmap();
+#if defined(_WIN32)
+	ifstream file(filename, ios::binary);
+	if (!file) return false;
+	contents.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	base = contents.empty()? NULL : &contents[0];
+	size = contents.size();
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		::close(fd);
+		return false;
+	}
+	size = size_t(info.st_size);
+	if (size != 0) {
+		void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			::close(fd);
+			size = 0;
+			return false;
+		}
+		madvise(mapping, size, MADV_SEQUENTIAL);
+		base = (const char*)mapping;
+	}
+	::close(fd);
+#endif
+	setSpan(base, size);
+	return true;
+}
+
+/* Member function imapbuf::unmap
+ * -------------------------------------------
+ * Releases the mapping, if there is one.
+ */
+void imapbuf::unmap() {
+#if defined(_WIN32)
+	vector<char>().swap(contents);
+#else
+	if (base != NULL) munmap(const_cast<char*>(base), size);
+#endif
+	setSpan(NULL, 0);
+	opened = false;
+}
+
+/* Member function imembuf::xsgetn
+ * -------------------------------------------
+ * Copies straight out of the span.
+ */
+streamsize imembuf::xsgetn(char* buffer, streamsize count) {
+	streamsize available = min(count, streamsize(egptr() - gptr()));
+	memcpy(buffer, gptr(), size_t(available));
+	setg(eback(), gptr() + available, egptr());
+	return available;
+}
+
+/* Member functions imembuf::seekoff, imembuf::seekpos
+ * -------------------------------------------
+ * Moves the get pointer anywhere within the span.
+ */
+streambuf::pos_type imembuf::seekoff(off_type offset, ios::seekdir dir, ios::openmode which) {
+	off_type origin = (dir == ios::beg)? 0 : (dir == ios::end)? off_type(size) : off_type(gptr() - eback());
+	return seekpos(pos_type(origin + offset), which);
+}
+streambuf::pos_type imembuf::seekpos(pos_type pos, ios::openmode) {
+	off_type target = off_type(pos);
+	if (!opened || target < 0 || target > off_type(size)) return pos_type(off_type(-1));
+	char* start = const_cast<char*>(base);
+	setg(start, start + target, start + size);
+	return pos;
+}
+
+/* Constructor imembstream::imembstream
+ * -------------------------------------------
+ * Wires up the stream class to a buffer over the span.
+ */
+imembstream::imembstream(const char* data, size_t length) : buffer(new imembuf) {
+	buffer->setSpan(data, length);
+	init(buffer);
+}
+imembstream::imembstream() : buffer(new imembuf) {
+	init(buffer);
+}
+imembstream::imembstream(imembuf* buffer) : buffer(buffer) {
+	init(buffer);
+}
+
+/* Destructor imembstream::~imembstream
+ * -------------------------------------------
+ * Releases the buffer, which for a mapped file also unmaps
+ * it.
+ */
+imembstream::~imembstream() {
+	delete buffer;
+}
+
+/* Member function imembstream::is_open
+ * -------------------------------------------
+ * Determines whether there is a span to read.
+ */
+bool imembstream::is_open() {
+	return buffer->opened;
+}
+
+/* Member functions imembstream::data, imembstream::length
+ * -------------------------------------------
+ * The whole span.
+ */
+const char* imembstream::data() const {
+	return buffer->base;
+}
+size_t imembstream::length() const {
+	return buffer->size;
+}
+
+/* Member function imembstream::reset
+ * -------------------------------------------
+ * Rewinding drops the read-ahead and clears the state.
+ */
+void imembstream::reset(const char* data, size_t length) {
+	buffer->setSpan(data, length);
+	rewind();
+}
+
+/* Constructor imapbstream::imapbstream
+ * -------------------------------------------
+ * Wires up the stream class to the mapped buffer, then maps
+ * the given file, if there is one.
+ */
+imapbstream::imapbstream() : imembstream(new imapbuf) {
+}
+imapbstream::imapbstream(const char* filename) : imembstream(new imapbuf) {
+	open(filename);
+}
+imapbstream::imapbstream(string filename) : imembstream(new imapbuf) {
+	open(filename);
+}
+
+/* Member function imapbstream::open
+ * -------------------------------------------
+ * Maps the file, failing if unable to do so.
+ */
+void imapbstream::open(const char* filename) {
+	if (!static_cast<imapbuf*>(buffer)->map(filename))
+		setstate(ios::failbit);
+	else
+		rewind();
+}
+void imapbstream::open(string filename) {
+	open(filename.c_str());
+}
+
+/* Member function imapbstream::close
+ * -------------------------------------------
+ * Unmaps the file, if one is mapped.
+ */
+void imapbstream::close() {
+	if (!buffer->opened)
+		setstate(ios::failbit);
+	static_cast<imapbuf*>(buffer)->unmap();
+}
+
+/* Function: mappedBytes
+ * -------------------------------------------
+ * Finds the read position with tellg, which for a memory
+ * buffer is just arithmetic on the get pointer.
+ */
+bool mappedBytes(istream& stream, const char*& data, size_t& length) {
+	imembstream* mapped = dynamic_cast<imembstream*>(&stream);
+	if (mapped == NULL || !mapped->is_open()) return false;
+	
+	mapped->clear();
+	size_t position = size_t(mapped->tellg());
+	data = mapped->data() + position;
+	length = mapped->length() - position;
+	mapped->seekg(0, ios::end);
+	mapped->setstate(ios::eofbit);
+	return true;
+}
+
+/* Class: omapbuf
+ * -------------------------------------------
+ * A write-only stream buffer whose put area is the mapped
+ * file.  When the put area fills, the file and its mapping
+ * grow to twice the size.  The high-water mark of the put
+ * pointer is the size the file is cut to when closed.
+ */
+class omapbuf: public streambuf {
+public:
+	omapbuf() : base(NULL), capacity(0), written(0), fd(-1) {}
+	~omapbuf() { finish(); }
+	
+	bool create(const char* filename, size_t sizeHint);
+	bool finish();
+	bool isOpen() const;
+	
+protected:
+	int_type overflow(int_type ch);
+	streamsize xsputn(const char* data, streamsize count);
+	pos_type seekoff(off_type offset, ios::seekdir dir, ios::openmode which);
+	pos_type seekpos(pos_type pos, ios::openmode which);
+	
+private:
+	char* base;
+	size_t capacity, written;
+	int fd;
+#if defined(_WIN32)
+	string filename;
+	vector<char> contents;
+#endif
+	
+	bool reserve(size_t needed);
+	size_t used() const;
+	void placePut(size_t offset);
+};
+
+/* Member function omapbuf::create
+ * -------------------------------------------
+ * Creates the file and gives it room for sizeHint bytes.
+ */
+bool omapbuf::create(const char* name, size_t sizeHint) {
+	if (isOpen() && !finish()) return false;
+#if defined(_WIN32)
+	if (!ofstream(name, ios::binary)) return false;
+	filename = name;
+	fd = 0;
+#else
+	fd = ::open(name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) return false;
+#endif
+	written = 0;
+	if (!reserve(max(sizeHint, size_t(1)))) {
+		finish();
+		return false;
+	}
+	return true;
+}
+
+/* Member function omapbuf::isOpen
+ * -------------------------------------------
+ * Whether a file is being written.
+ */
+bool omapbuf::isOpen() const {
+	return fd >= 0;
+}
+
+/* Member function omapbuf::used
+ * -------------------------------------------
+ * The size of the data written so far.
+ */
+size_t omapbuf::used() const {
+	return max(written, size_t(pptr() - pbase()));
+}
+
+/* Member function omapbuf::placePut
+ * -------------------------------------------
+ * Resets the put area to the current mapping with the put
+ * pointer offset bytes in.  pbump only takes an int, hence
+ * the loop for files over 2GB.
+ */
+void omapbuf::placePut(size_t offset) {
+	setp(base, base + capacity);
+	while (offset > 0) {
+		int step = int(min(offset, size_t(1) << 30));
+		pbump(step);
+		offset -= size_t(step);
+	}
+}
+
+/* Member function omapbuf::reserve
+ * -------------------------------------------
+ * Makes room for at least needed bytes, growing by doubling
+ * so that a long run of writes costs few remaps.  On Linux
+ * the mapping is moved with mremap; elsewhere it is unmapped
+ * and mapped again.
+ */
+bool omapbuf::reserve(size_t needed) {
+	if (needed <= capacity) return true;
+	size_t size = max(needed, 2 * capacity);
+	size_t offset = size_t(pptr() - pbase());
+	written = used();
+#if defined(_WIN32)
+	contents.resize(size);
+	base = &contents[0];
+#else
+	if (ftruncate(fd, off_t(size)) != 0) return false;
+	void* mapping;
+#if defined(__linux__)
+	if (base != NULL) mapping = mremap(base, capacity, size, MREMAP_MAYMOVE);
+	else mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#else
+	if (base != NULL) munmap(base, capacity);
+	base = NULL;
+	capacity = 0;
+	mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+	if (mapping == MAP_FAILED) {
+		if (base == NULL) setp(NULL, NULL);
+		else placePut(offset);
+		return false;
+	}
+	base = (char*)mapping;
+#endif
+	capacity = size;
+	placePut(offset);
+	return true;
+}
+
+/* Member function omapbuf::finish
+ * -------------------------------------------
+ * Cuts the file back to the data written and releases it.
+ */
+bool omapbuf::finish() {
+	if (!isOpen()) return false;
+	size_t size = used();
+	bool ok = true;
+#if defined(_WIN32)
+	ofstream file(filename.c_str(), ios::binary);
+	ok = bool(file.write(base, streamsize(size)));
+	vector<char>().swap(contents);
+#else
+	if (base != NULL) munmap(base, capacity);
+	ok = ftruncate(fd, off_t(size)) == 0;
+	ok = ::close(fd) == 0 && ok;
+#endif
+	base = NULL;
+	capacity = written = 0;
+	fd = -1;
+	setp(NULL, NULL);
+	return ok;
+}
+
+/* Member function omapbuf::overflow
+ * -------------------------------------------
+ * Grows the file to make room for one more character.
+ */
+streambuf::int_type omapbuf::overflow(int_type ch) {
+	if (traits_type::eq_int_type(ch, traits_type::eof())) return traits_type::not_eof(ch);
+	if (!isOpen() || !reserve(size_t(pptr() - pbase()) + 1)) return traits_type::eof();
+	*pptr() = traits_type::to_char_type(ch);
+	pbump(1);
+	return ch;
+}
+
+/* Member function omapbuf::xsputn
+ * -------------------------------------------
+ * Grows the file once for the whole write, then copies.
+ */
+streamsize omapbuf::xsputn(const char* data, streamsize count) {
+	if (!isOpen() || !reserve(size_t(pptr() - pbase()) + size_t(count))) return 0;
+	size_t offset = size_t(pptr() - pbase());
+	memcpy(pptr(), data, size_t(count));
+	placePut(offset + size_t(count));
+	return count;
+}
+
+/* Member functions omapbuf::seekoff, omapbuf::seekpos
+ * -------------------------------------------
+ * Moves the put pointer within the data written so far,
+ * which is all obstream::size needs.
+ */
+streambuf::pos_type omapbuf::seekoff(off_type offset, ios::seekdir dir, ios::openmode which) {
+	off_type origin = (dir == ios::beg)? 0 : (dir == ios::end)? off_type(used()) : off_type(pptr() - pbase());
+	return seekpos(pos_type(origin + offset), which);
+}
+streambuf::pos_type omapbuf::seekpos(pos_type pos, ios::openmode) {
+	off_type target = off_type(pos);
+	if (!isOpen() || target < 0 || target > off_type(used())) return pos_type(off_type(-1));
+	written = used();
+	placePut(size_t(target));
+	return pos;
+}
+
+/* Constructor omapbstream::omapbstream
+ * -------------------------------------------
+ * Wires up the stream class to the mapped buffer, then
+ * creates the given file, if there is one.
+ */
+omapbstream::omapbstream() : buffer(new omapbuf) {
+	init(buffer);
+}
+omapbstream::omapbstream(const char* filename, size_t sizeHint) : buffer(new omapbuf) {
+	init(buffer);
+	open(filename, sizeHint);
+}
+omapbstream::omapbstream(string filename, size_t sizeHint) : buffer(new omapbuf) {
+	init(buffer);
+	open(filename, sizeHint);
+}
+
+/* Destructor omapbstream::~omapbstream
+ * -------------------------------------------
+ * Flushes pending bits and finishes the file.
+ */
+omapbstream::~omapbstream() {
+	if (is_open()) close();
+	delete buffer;
+}
+
+/* Member function omapbstream::open
+ * -------------------------------------------
+ * Creates the file, refusing names that look like source
+ * code as ofbstream does.
+ */
+void omapbstream::open(const char* filename, size_t sizeHint) {
+	if (isSourceFile(filename) || !buffer->create(filename, sizeHint))
+		setstate(ios::failbit);
+}
+void omapbstream::open(string filename, size_t sizeHint) {
+	open(filename.c_str(), sizeHint);
+}
+
+/* Member function omapbstream::close
+ * -------------------------------------------
+ * Flushes pending bits, then cuts the file to size.
+ */
+void omapbstream::close() {
+	if (is_open()) flushBits();
+	if (!buffer->finish())
+		setstate(ios::failbit);
+}
+
+/* Member function omapbstream::is_open
+ * -------------------------------------------
+ * Determines whether a file is open for writing.
+ */
+bool omapbstream::is_open() {
+	return buffer->isOpen();
+}
+
+/* Class: omembuf
+ * -------------------------------------------
+ * A write-only stream buffer whose put area is a fixed span.
+ * The default overflow reports the span full, which makes
+ * the stream go bad instead of writing past it.
+ */
+class omembuf: public streambuf {
+public:
+	omembuf(char* data, size_t capacity) {
+		setSpan(data, capacity);
+	}
+	
+	void setSpan(char* data, size_t capacity) {
+		setp(data, data + capacity);
+	}
+	
+	size_t used() const {
+		return size_t(pptr() - pbase());
+	}
+	
+protected:
+	/* Only reports the position; the put area never moves. */
+	virtual pos_type seekoff(off_type offset, ios::seekdir dir, ios::openmode which) {
+		if (offset != 0 || dir != ios::cur || !(which & ios::out)) return pos_type(off_type(-1));
+		return pos_type(off_type(used()));
+	}
+};
+
+/* Constructor omembstream::omembstream
+ * -------------------------------------------
+ * Wires up the stream class to a buffer over the span.
+ */
+omembstream::omembstream(char* data, size_t capacity) : buffer(new omembuf(data, capacity)) {
+	init(buffer);
+}
+
+/* Destructor omembstream::~omembstream
+ * -------------------------------------------
+ * Flushes pending bits while the buffer still exists.
+ */
+omembstream::~omembstream() {
+	flushBits();
+	delete buffer;
+}
+
+/* Member function omembstream::length
+ * -------------------------------------------
+ * Counts the bytes that reached the span.
+ */
+size_t omembstream::length() {
+	flushBits();
+	return buffer->used();
+}
+
+/* Member function omembstream::reset
+ * -------------------------------------------
+ * Pending bits belong to the old span, so they go there.
+ */
+void omembstream::reset(char* data, size_t capacity) {
+	flushBits();
+	buffer->setSpan(data, capacity);
+	clear();
+}
@@ -17,12 +17,14 @@
  * There are two subclasses of ibstream: ifbstream and istringbstream,
  * which are similar to the ifstream and istringstream classes.	 The
  * obstream class similarly has ofbstream and ostringbstream as
- * subclasses.
+ * subclasses.  A third pair, istreambstream and ostreambstream, wraps
+ * an existing stream such as cin or cout.
  */
 
 #ifndef _bstream_h
 #define _bstream_h
 
+#include <stdint.h>
 #include <istream>
 #include <ostream>
 #include <fstream>
@@ -61,6 +63,64 @@ public:
 	 */
 	int readBit();
 	
+	/*
+	 * Member function: readBits
+	 * Usage: value = in.readBits(12);
+	 * -------------------------------
+	 * Reads count (at most 64) bits and returns them packed into an
+	 * integer, the first bit read in the least significant position.
+	 * This matches the order used by readBit and writeBit.	 Reading
+	 * past the end of the data yields zero bits and puts the stream
+	 * into a fail state.
+	 *
+	 * The bulk functions (readBits, peekBits, skipBits) read ahead
+	 * from the underlying buffer in large blocks, so they should not
+	 * be mixed with get, >>, or readBit without first calling
+	 * alignBits.
+	 */
+	uint64_t readBits(int count);
+	
+	/*
+	 * Member function: peekBits
+	 * Usage: value = in.peekBits(11);
+	 * -------------------------------
+	 * Returns the next count (at most 56) bits without consuming them.
+	 * Bits past the end of the data read as zero.
+	 */
+	uint64_t peekBits(int count);
+	
+	/*
+	 * Member function: skipBits
+	 * Usage: in.skipBits(length);
+	 * ---------------------------
+	 * Consumes count (at most 56) bits.  Skipping past the end of the
+	 * data puts the stream into a fail state.
+	 */
+	void skipBits(int count);
+	
+	/*
+	 * Member function: readBytes
+	 * Usage: n = in.readBytes(buffer, length);
+	 * ----------------------------------------
+	 * Reads up to length whole bytes through the bulk bit buffer and
+	 * returns how many were read; a short count means the data ran out,
+	 * and puts the stream into a fail state.  The stream must be at a
+	 * byte boundary, as it is after reading a multiple of eight bits.
+	 */
+	size_t readBytes(char* buffer, size_t length);
+	
+	/*
+	 * Member function: alignBits
+	 * Usage: in.alignBits();
+	 * ----------------------
+	 * Discards any unread bits of the current byte and hands the bytes
+	 * read ahead by the bulk functions back to the underlying buffer,
+	 * so that ordinary reads resume at the next byte boundary.  Puts
+	 * the stream into a fail state if the underlying buffer cannot seek
+	 * back over the read-ahead.
+	 */
+	void alignBits();
+	
 	/*
 	 * Member function: rewind
 	 * Usage: in.rewind();
@@ -71,6 +131,17 @@ public:
 	 */
 	void rewind();
 	
+	/*
+	 * Member function: tellBits
+	 * Usage: long long bits = in.tellBits();
+	 * --------------------------------------
+	 * Returns how many bits of the stream have been consumed, counting
+	 * neither the bits read ahead by the bulk functions nor any padding
+	 * past the end, or -1 if the underlying buffer can't report its
+	 * position.  Unlike size, it never seeks or clears the stream state.
+	 */
+	long long tellBits();
+	
 	/*
 	 * Member function: size
 	 * Usage: sz = in.size();
@@ -93,6 +164,20 @@ public:
 private:
 	int pos, curByte;
 	streampos lastTell;
+	
+	/* Read-ahead state for the bulk bit functions.	 Bytes are pulled
+	 * from the streambuf BIT_BUFFER_SIZE at a time into byteBuffer,
+	 * then fed into the 64-bit bitBuffer.  padBits counts the zero
+	 * bits appended to bitBuffer after the data ran out.
+	 */
+	static const int BIT_BUFFER_SIZE = 4096;
+	char byteBuffer[BIT_BUFFER_SIZE];
+	int bytePos, byteCount;
+	uint64_t bitBuffer;
+	int bitCount, padBits;
+	
+	void refillBits();
+	void resetBits();
 };
 
 
@@ -127,11 +212,55 @@ public:
 	 */
 	void writeBit(int bit);
 	
+	/*
+	 * Member function: writeBits
+	 * Usage: out.writeBits(code, length);
+	 * -----------------------------------
+	 * Writes the low count (at most 64) bits of bits, least significant
+	 * bit first, the same order used by writeBit.  The bits are held in
+	 * an internal buffer and reach the underlying stream in large
+	 * blocks; call flushBits before using put, <<, or writeBit.
+	 */
+	void writeBits(uint64_t bits, int count);
+	
+	/*
+	 * Member function: writeBytes
+	 * Usage: out.writeBytes(buffer, length);
+	 * --------------------------------------
+	 * Writes length whole bytes through the bulk bit buffer.	 Large
+	 * writes go straight to the underlying stream.  The stream must be
+	 * at a byte boundary, as it is after writing a multiple of eight
+	 * bits.
+	 */
+	void writeBytes(const char* buffer, size_t length);
+	
+	/*
+	 * Member function: flushBits
+	 * Usage: out.flushBits();
+	 * -----------------------
+	 * Writes out everything buffered by writeBits, padding a final
+	 * partial byte with zero bits.	 After this call the stream is at a
+	 * byte boundary and ordinary writes may follow.
+	 */
+	void flushBits();
+	
+	/*
+	 * Member function: tellBits
+	 * Usage: long long bits = out.tellBits();
+	 * ---------------------------------------
+	 * Returns how many bits have been written to the stream, counting
+	 * those still buffered by writeBits, or -1 if the underlying buffer
+	 * can't report its position.  Unlike size, it never seeks or clears
+	 * the stream state.
+	 */
+	long long tellBits();
+	
 	/*
 	 * Member function: size
 	 * Usage: sz = in.size();
 	 * ----------------------
-	 * Returns the size in bytes of the file attached to this stream.
+	 * Returns the size in bytes of the file attached to this stream,
+	 * counting bits still buffered by writeBits.
 	 * Raises an error if this obstream has not been properly opened.
 	 */
 	long size();
@@ -149,6 +278,18 @@ public:
 private:
 	int pos, curByte;
 	streampos lastTell;
+	
+	/* Buffering state for writeBits.	 Bits collect in the 64-bit
+	 * bitBuffer; each finished 32-bit word moves to byteBuffer, which
+	 * goes to the streambuf whenever it fills up.
+	 */
+	static const int BIT_BUFFER_SIZE = 4096;
+	char byteBuffer[BIT_BUFFER_SIZE];
+	int byteCount;
+	uint64_t bitBuffer;
+	int bitCount;
+	
+	void drainBytes();
 };
 
 /*
@@ -251,6 +392,13 @@ public:
 	ofbstream(const char* filename);
 	ofbstream(string filename);
 	
+	/*
+	 * Destructor: ~ofbstream();
+	 * -------------------------
+	 * Flushes any bits still buffered by writeBits.
+	 */
+	~ofbstream();
+	
 	/*
 	 * Member function: open(const char* filename);
 	 * Member function: open(string filename);
@@ -277,8 +425,9 @@ public:
 	 * Member function: close();
 	 * Usage: ifb.close();
 	 * --------------------------
-	 * Closes the currently-opened file, if the stream is open.	 If the
-	 * stream is not open, puts the stream into a fail state.
+	 * Closes the currently-opened file, if the stream is open, after
+	 * flushing any bits buffered by writeBits.  If the stream is not
+	 * open, puts the stream into a fail state.
 	 */
 	void close();
 
@@ -287,6 +436,234 @@ private:
 	filebuf fb;
 };
 
+/*
+ * Class: imembstream
+ * ---------------
+ * An ibstream that reads a span of memory the caller owns, without
+ * copying it.  The span must outlive the stream.  Code that knows it
+ * has an imembstream (see mappedBytes) can work on the bytes in place.
+ */
+class imembuf;
+class imembstream: public ibstream {
+public:
+	/*
+	 * Constructor: imembstream(const char* data, size_t length);
+	 * Usage: imembstream input(buffer, length);
+	 * -------------------------
+	 * Constructs an imembstream reading the given bytes.
+	 */
+	imembstream(const char* data, size_t length);
+	
+	/*
+	 * Constructor: imembstream();
+	 * Usage: imembstream input;
+	 * -------------------------
+	 * Constructs an imembstream with no span, to be given one later
+	 * with reset.
+	 */
+	imembstream();
+	~imembstream();
+	
+	/*
+	 * Member function: is_open();
+	 * Usage: if (input.is_open()) { ... }
+	 * --------------------------
+	 * Returns whether or not there is a span to read.
+	 */
+	bool is_open();
+	
+	/*
+	 * Member functions: data(), length()
+	 * Usage: countFrequencies(input.data(), input.length(), counts);
+	 * --------------------------
+	 * Return the whole span being read.
+	 */
+	const char* data() const;
+	size_t length() const;
+	
+	/*
+	 * Member function: reset(const char* data, size_t length);
+	 * Usage: input.reset(buffer, length);
+	 * --------------------------
+	 * Starts reading a new span from its beginning, forgetting any
+	 * read-ahead and error state, so one stream can serve many spans.
+	 */
+	void reset(const char* data, size_t length);
+	
+protected:
+	/* Lets a subclass supply its own buffer, which the stream deletes. */
+	explicit imembstream(imembuf* buffer);
+	
+	imembuf* buffer;
+	
+private:
+	/* Copying a stream makes no sense. */
+	imembstream(const imembstream&);
+	imembstream& operator=(const imembstream&);
+};
+
+/*
+ * Class: imapbstream
+ * ---------------
+ * An ifbstream alternative that maps the whole file into memory instead
+ * of reading it through a file buffer.  Ordinary and bitwise reads work
+ * as usual, and like any imembstream the mapped bytes can be used in
+ * place.  Where memory mapping is unavailable the file is read into
+ * memory when it is opened.
+ */
+class imapbstream: public imembstream {
+public:
+	/*
+	 * Constructor: imapbstream();
+	 * Constructor: imapbstream(string filename);
+	 * Usage: imapbstream input("filename");
+	 * -------------------------
+	 * Constructs a new imapbstream, optionally mapping the specified
+	 * file.  If the file can't be mapped, the stream enters an error
+	 * state.
+	 */
+	imapbstream();
+	imapbstream(const char* filename);
+	imapbstream(string filename);
+	
+	/*
+	 * Member function: open(string filename);
+	 * Member function: close();
+	 * Usage: input.open("my-file.txt");
+	 * -------------------------
+	 * Maps or unmaps a file.  Failures put the stream in a fail state.
+	 * The pointer returned by data() is valid until the file is
+	 * closed.
+	 */
+	void open(const char* filename);
+	void open(string filename);
+	void close();
+};
+
+/*
+ * Class: omapbstream
+ * ---------------
+ * An ofbstream alternative that writes into a memory-mapped file.  The
+ * file is grown ahead of the data (starting from the size hint given
+ * to open, then doubling), written with plain memory copies, and cut
+ * back to the bytes actually written when the stream is closed.  The
+ * same safety check on source file names as ofbstream applies.
+ */
+class omapbuf;
+class omapbstream: public obstream {
+public:
+	/*
+	 * Constructor: omapbstream();
+	 * Constructor: omapbstream(string filename, size_t sizeHint = 0);
+	 * Usage: omapbstream output("filename", expectedSize);
+	 * -------------------------
+	 * Constructs a new omapbstream, optionally creating the specified
+	 * file with room for sizeHint bytes.
+	 */
+	omapbstream();
+	omapbstream(const char* filename, size_t sizeHint = 0);
+	omapbstream(string filename, size_t sizeHint = 0);
+	
+	/*
+	 * Destructor: ~omapbstream();
+	 * -------------------------
+	 * Closes the file if it is still open.
+	 */
+	~omapbstream();
+	
+	/*
+	 * Member function: open(string filename, size_t sizeHint = 0);
+	 * Member function: close();
+	 * Usage: output.open("my-file.txt");
+	 * -------------------------
+	 * Creates (or truncates) a file for writing, or finishes writing it,
+	 * flushing any bits buffered by writeBits.  Failures put the stream
+	 * in a fail state.
+	 */
+	void open(const char* filename, size_t sizeHint = 0);
+	void open(string filename, size_t sizeHint = 0);
+	void close();
+	
+	/*
+	 * Member function: is_open();
+	 * Usage: if (output.is_open()) { ... }
+	 * --------------------------
+	 * Returns whether or not a file is open for writing.
+	 */
+	bool is_open();
+	
+private:
+	omapbuf* buffer;
+	
+	/* Copying a stream makes no sense. */
+	omapbstream(const omapbstream&);
+	omapbstream& operator=(const omapbstream&);
+};
+
+/*
+ * Class: omembstream
+ * ---------------
+ * An obstream that writes into a fixed span of memory the caller owns.
+ * Writing more than fits puts the stream into a bad state rather than
+ * overrunning the span.
+ */
+class omembuf;
+class omembstream: public obstream {
+public:
+	/*
+	 * Constructor: omembstream(char* data, size_t capacity);
+	 * Usage: omembstream output(buffer, capacity);
+	 * -------------------------
+	 * Constructs an omembstream writing to the given span.
+	 */
+	omembstream(char* data, size_t capacity);
+	
+	/*
+	 * Destructor: ~omembstream();
+	 * -------------------------
+	 * Flushes any bits still buffered by writeBits.
+	 */
+	~omembstream();
+	
+	/*
+	 * Member function: length();
+	 * Usage: size_t n = output.length();
+	 * --------------------------
+	 * Flushes any buffered bits, then returns the number of bytes
+	 * written to the span.
+	 */
+	size_t length();
+	
+	/*
+	 * Member function: reset(char* data, size_t capacity);
+	 * Usage: output.reset(buffer, capacity);
+	 * --------------------------
+	 * Starts writing a new span from its beginning, forgetting any
+	 * error state.  Bits still buffered are written to the old span
+	 * first.
+	 */
+	void reset(char* data, size_t capacity);
+	
+private:
+	omembuf* buffer;
+	
+	/* Copying a stream makes no sense. */
+	omembstream(const omembstream&);
+	omembstream& operator=(const omembstream&);
+};
+
+/*
+ * Function: mappedBytes
+ * Usage: if (mappedBytes(stream, data, length)) { ... }
+ * ---------------------------
+ * If stream is an imembstream (including an imapbstream), points data
+ * at the length bytes it has yet to read, moves it to the end of the file as though it had read
+ * them, and returns true.  Otherwise returns false and leaves stream
+ * alone.  The stream must not have bits read ahead by the bulk bit
+ * functions.
+ */
+bool mappedBytes(istream& stream, const char*& data, size_t& length);
+
 /*
  * Class: istringbstream
  * ---------------
@@ -338,7 +715,8 @@ public:
 	/* Member function: string str();
 	 * Usage: cout << osb.str() << endl;
 	 * ----------------------------
-	 * Retrieves the underlying string of the istringbstream.
+	 * Retrieves the underlying string of the istringbstream, first
+	 * flushing any bits buffered by writeBits.
 	 */
 	string str();
 	
@@ -347,4 +725,79 @@ private:
 	stringbuf sb;
 };
 
+/*
+ * Class: istreambstream
+ * ---------------
+ * An ibstream that reads from the buffer of an existing stream, such
+ * as cin, so that pipes and sockets can be read bit-by-bit.  The
+ * other stream must outlive this one.  Such buffers often cannot
+ * seek, in which case rewind and size leave the stream in a fail
+ * state.
+ */
+class istreambstream: public ibstream {
+public:
+	/* Constructor: istreambstream(istream& source);
+	 * Usage: istreambstream input(cin);
+	 * --------------------------
+	 * Constructs an istreambstream reading what source would read.
+	 */
+	explicit istreambstream(istream& source);
+};
+
+/*
+ * Class: ostreambstream
+ * ---------------
+ * An obstream that writes to the buffer of an existing stream, such
+ * as cout.  The other stream must outlive this one.
+ */
+class ostreambstream: public obstream {
+public:
+	/* Constructor: ostreambstream(ostream& sink);
+	 * Usage: ostreambstream output(cout);
+	 * --------------------------
+	 * Constructs an ostreambstream writing where sink would write.
+	 */
+	explicit ostreambstream(ostream& sink);
+	
+	/*
+	 * Destructor: ~ostreambstream();
+	 * -------------------------
+	 * Flushes any bits still buffered by writeBits.
+	 */
+	~ostreambstream();
+};
+
+/*
+ * The bulk bit functions sit in the inner loop of the Huffman coder, so
+ * their fast paths are defined here where the compiler can inline them.
+ * Only refilling and draining the byte buffers goes out of line.
+ */
+inline uint64_t ibstream::peekBits(int count) {
+	if (bitCount < count) refillBits();
+	return bitBuffer & ((uint64_t(1) << count) - 1);
+}
+
+inline void ibstream::skipBits(int count) {
+	bitBuffer >>= count;
+	bitCount -= count;
+	if (bitCount < padBits) setstate(ios::eofbit | ios::failbit);
+}
+
+inline void obstream::writeBits(uint64_t bits, int count) {
+	if (count > 32) {
+		writeBits(bits & 0xFFFFFFFFu, 32);
+		bits >>= 32;
+		count -= 32;
+	}
+	bits &= (uint64_t(1) << count) - 1;
+	bitBuffer |= bits << bitCount;
+	bitCount += count;
+	if (bitCount >= 32) {
+		if (byteCount + 4 > BIT_BUFFER_SIZE) drainBytes();
+		for (int i = 0; i < 4; i++) byteBuffer[byteCount++] = char(bitBuffer >> (8 * i));
+		bitBuffer >>= 32;
+		bitCount -= 32;
+	}
+}
+
 #endif